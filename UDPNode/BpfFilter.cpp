@@ -0,0 +1,335 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "BpfFilter.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+// Offset of the UDP payload seen by a socket filter.
+static const uint32_t UDP_PAYLOAD_OFF = 8;
+
+void BpfProgram::stmt(uint16_t code, uint32_t k){
+    insn i;
+    i.code = code;
+    i.jt = NEXT;
+    i.jf = NEXT;
+    i.k = k;
+    _insns.push_back(i);
+}
+
+void BpfProgram::jump(uint16_t code, uint32_t k, int jt, int jf){
+    insn i;
+    i.code = code;
+    i.jt = jt;
+    i.jf = jf;
+    i.k = k;
+    _insns.push_back(i);
+}
+
+void BpfProgram::jumpTo(int label){
+    stmt(BPF_JMP | BPF_JA, (uint32_t)label);
+}
+
+int BpfProgram::newLabel(void){
+    _labels.push_back(-1);
+    return _labels.size() - 1;
+}
+
+void BpfProgram::mark(int label){
+    _labels[label] = _insns.size();
+}
+
+BpfProgram &BpfProgram::requireLength(unsigned int minlen, unsigned int maxlen){
+    // The length includes the 8-byte UDP header.
+    stmt(BPF_LD | BPF_W | BPF_LEN, 0);
+    jump(BPF_JMP | BPF_JGE | BPF_K, minlen + UDP_PAYLOAD_OFF, NEXT, REJECT);
+    jump(BPF_JMP | BPF_JGT | BPF_K, maxlen + UDP_PAYLOAD_OFF, REJECT, NEXT);
+    return *this;
+}
+
+BpfProgram &BpfProgram::requirePrefix(const std::string &magic){
+    // Compare a word at a time; a load past the end of the packet drops it.
+    size_t off = 0;
+    while(off < magic.size()){
+        size_t left = magic.size() - off;
+        uint32_t value = 0;
+        uint16_t size;
+        size_t width;
+        if(left >= 4){
+            size = BPF_W;
+            width = 4;
+        } else if(left >= 2){
+            size = BPF_H;
+            width = 2;
+        } else {
+            size = BPF_B;
+            width = 1;
+        }
+        for(size_t i = 0; i < width; i++){
+            value = (value << 8) | (unsigned char)magic[off + i];
+        }
+        stmt(BPF_LD | size | BPF_ABS, UDP_PAYLOAD_OFF + off);
+        jump(BPF_JMP | BPF_JEQ | BPF_K, value, NEXT, REJECT);
+        off += width;
+    }
+    return *this;
+}
+
+BpfProgram &BpfProgram::allowSources(const std::vector<std::string> &cidrs){
+    // Parse the networks into address words and prefix lengths per family.
+    struct network{
+        uint32_t words[4];
+        int prefix;
+    };
+    std::vector<network> v4, v6;
+    for(const auto &cidr : cidrs){
+        std::string addr = cidr;
+        int prefix = -1;
+        size_t slash = cidr.find('/');
+        if(slash != std::string::npos){
+            addr = cidr.substr(0, slash);
+
+            // Digits only, as atoi() would read "/x" as /0 and open the filter to every source.
+            const char *digits = cidr.c_str() + slash + 1;
+            char *end = nullptr;
+            long value = isdigit((unsigned char)digits[0]) ? strtol(digits, &end, 10) : -1;
+            if(value < 0 || *end != '\0' || value > 128){
+                _valid = false;
+                return *this;
+            }
+            prefix = (int)value;
+        }
+        network net;
+        memset(&net, 0, sizeof net);
+        unsigned char bytes[16];
+        if(inet_pton(AF_INET, addr.c_str(), bytes) == 1 && prefix <= 32){
+            net.prefix = prefix < 0 ? 32 : prefix;
+            memcpy(net.words, bytes, 4);
+            net.words[0] = ntohl(net.words[0]);
+            v4.push_back(net);
+        } else if(inet_pton(AF_INET6, addr.c_str(), bytes) == 1){
+            net.prefix = prefix < 0 ? 128 : prefix;
+            for(int w = 0; w < 4; w++){
+                memcpy(&net.words[w], bytes + 4 * w, 4);
+                net.words[w] = ntohl(net.words[w]);
+            }
+            v6.push_back(net);
+        } else {
+            _valid = false;
+            return *this;
+        }
+    }
+
+    int allowed = newLabel();
+    int checkv6 = newLabel();
+
+    // The IP version nibble tells which header the datagram came with.
+    stmt(BPF_LD | BPF_B | BPF_ABS, (uint32_t)(SKF_NET_OFF + 0));
+    stmt(BPF_ALU | BPF_AND | BPF_K, 0xf0);
+    jump(BPF_JMP | BPF_JEQ | BPF_K, 0x40, NEXT, checkv6);
+
+    // IPv4 source address at offset 12 of the IP header.
+    for(const auto &net : v4){
+        uint32_t mask = net.prefix == 0 ? 0 : 0xffffffffu << (32 - net.prefix);
+        stmt(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 12));
+        stmt(BPF_ALU | BPF_AND | BPF_K, mask);
+        jump(BPF_JMP | BPF_JEQ | BPF_K, net.words[0] & mask, allowed, NEXT);
+    }
+    jumpTo(REJECT);
+
+    // IPv6 source address at offset 8 of the IP header, compared word by word.
+    mark(checkv6);
+    for(const auto &net : v6){
+        int nextnet = newLabel();
+        for(int w = 0; w < 4 && net.prefix > 32 * w; w++){
+            int bits = std::min(32, net.prefix - 32 * w);
+            uint32_t mask = bits == 32 ? 0xffffffffu : 0xffffffffu << (32 - bits);
+            stmt(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 8 + 4 * w));
+            stmt(BPF_ALU | BPF_AND | BPF_K, mask);
+            jump(BPF_JMP | BPF_JEQ | BPF_K, net.words[w] & mask, NEXT, nextnet);
+        }
+        jumpTo(allowed);
+        mark(nextnet);
+    }
+    jumpTo(REJECT);
+
+    mark(allowed);
+    return *this;
+}
+
+BpfProgram BpfProgram::envelopeFormat(unsigned int maxlen){
+    // Every envelope written by UDPNode::serialize() starts with the time stamp key.
+    BpfProgram program;
+    const std::string magic = "{\"Time\":";
+    program.requireLength(magic.size(), maxlen).requirePrefix(magic);
+    return program;
+}
+
+std::vector<struct sock_filter> BpfProgram::reuseportSteering(steerRule rule, unsigned int shards, unsigned int keyoffset, unsigned int keylen){
+    std::vector<struct sock_filter> code;
+    if(shards == 0 || (rule == STEER_PAYLOAD_KEY && (keylen == 0 || keylen > 4))){
+        return code;
+    }
+    auto add = [&code](uint16_t c, uint32_t k){
+        struct sock_filter f = BPF_STMT(c, k);
+        code.push_back(f);
+    };
+    auto addJump = [&code](uint16_t c, uint32_t k, uint8_t jt, uint8_t jf){
+        struct sock_filter f = BPF_JUMP(c, k, jt, jf);
+        code.push_back(f);
+    };
+
+    if(rule == STEER_CPU){
+        add(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU));
+        add(BPF_ALU | BPF_MOD | BPF_K, shards);
+        add(BPF_RET | BPF_A, 0);
+        return code;
+    }
+
+    if(rule == STEER_SOURCE_HASH){
+        // IPv4: the source word. IPv6: the XOR of the four source words.
+        add(BPF_LD | BPF_B | BPF_ABS, (uint32_t)(SKF_NET_OFF + 0));
+        add(BPF_ALU | BPF_AND | BPF_K, 0xf0);
+        addJump(BPF_JMP | BPF_JEQ | BPF_K, 0x40, 0, 2);
+        add(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 12));
+        add(BPF_JMP | BPF_JA, 10);
+        add(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 8));
+        add(BPF_MISC | BPF_TAX, 0);
+        add(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 12));
+        add(BPF_ALU | BPF_XOR | BPF_X, 0);
+        add(BPF_MISC | BPF_TAX, 0);
+        add(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 16));
+        add(BPF_ALU | BPF_XOR | BPF_X, 0);
+        add(BPF_MISC | BPF_TAX, 0);
+        add(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 20));
+        add(BPF_ALU | BPF_XOR | BPF_X, 0);
+    } else if(keylen == 3){
+        // No 3-byte load exists: the half-word, shifted, ORed with the third byte.
+        add(BPF_LD | BPF_H | BPF_ABS, keyoffset);
+        add(BPF_ALU | BPF_LSH | BPF_K, 8);
+        add(BPF_MISC | BPF_TAX, 0);
+        add(BPF_LD | BPF_B | BPF_ABS, keyoffset + 2);
+        add(BPF_ALU | BPF_OR | BPF_X, 0);
+    } else {
+        uint16_t size = keylen == 4 ? BPF_W : keylen == 2 ? BPF_H : BPF_B;
+        add(BPF_LD | size | BPF_ABS, keyoffset);
+    }
+
+    // Mix the key so neighbouring values spread over the shards: A = (A * golden) ^ ((A * golden) >> 16).
+    add(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1);
+    add(BPF_MISC | BPF_TAX, 0);
+    add(BPF_ALU | BPF_RSH | BPF_K, 16);
+    add(BPF_ALU | BPF_XOR | BPF_X, 0);
+    add(BPF_ALU | BPF_MOD | BPF_K, shards);
+    add(BPF_RET | BPF_A, 0);
+    return code;
+}
+
+std::vector<struct sock_filter> BpfProgram::build(void) const{
+    std::vector<struct sock_filter> code;
+    if(!_valid){
+        return code;
+    }
+
+    // Layout: the checks, then accept, then reject. Targets are instruction
+    // indices, n being accept and n + 1 reject.
+    const int n = _insns.size();
+    auto target = [&](int label) -> int{
+        if(label == REJECT){
+            return n + 1;
+        }
+        return label >= 0 && label < (int)_labels.size() && _labels[label] >= 0 ? _labels[label] : -1;
+    };
+    auto isCond = [](const insn &in){
+        return BPF_CLASS(in.code) == BPF_JMP && in.code != (BPF_JMP | BPF_JA);
+    };
+
+    // Conditional jump offsets are 8 bits wide. One whose target is further
+    // away becomes a jump over two unconditional jumps, which have 32-bit
+    // offsets: "jcc 0, 1; ja true; ja false". Each widened jump moves the
+    // others' targets, so repeat until none is out of range.
+    std::vector<bool> wide(n, false);
+    std::vector<int> pos(n + 2);
+    for(bool changed = true; changed;){
+        int p = 0;
+        for(int i = 0; i < n; i++){
+            pos[i] = p;
+            p += wide[i] ? 3 : 1;
+        }
+        pos[n] = p;
+        pos[n + 1] = p + 1;
+        changed = false;
+        for(int i = 0; i < n; i++){
+            const insn &in = _insns[i];
+            if(!isCond(in) || wide[i]){
+                continue;
+            }
+            for(int label : {in.jt, in.jf}){
+                int t = label == NEXT ? i + 1 : target(label);
+                if(t < 0 || pos[t] <= pos[i]){
+                    return std::vector<struct sock_filter>();
+                }
+                if(pos[t] - (pos[i] + 1) > 255){
+                    wide[i] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    auto ja = [&](int label, int next) -> bool{
+        int t = label == NEXT ? next : target(label);
+        if(t < 0 || pos[t] < (int)code.size() + 1){
+            return false;
+        }
+        struct sock_filter f = BPF_STMT(BPF_JMP | BPF_JA, (uint32_t)(pos[t] - ((int)code.size() + 1)));
+        code.push_back(f);
+        return true;
+    };
+    for(int i = 0; i < n; i++){
+        const insn &in = _insns[i];
+        struct sock_filter f;
+        f.code = in.code;
+        f.jt = 0;
+        f.jf = 0;
+        f.k = in.k;
+        if(in.code == (BPF_JMP | BPF_JA)){
+            if(!ja((int)in.k, i + 1)){
+                return std::vector<struct sock_filter>();
+            }
+            continue;
+        }
+        if(isCond(in) && wide[i]){
+            f.jf = 1;
+            code.push_back(f);
+            ja(in.jt, i + 1);
+            ja(in.jf, i + 1);
+            continue;
+        }
+        if(isCond(in)){
+            f.jt = pos[in.jt == NEXT ? i + 1 : target(in.jt)] - (pos[i] + 1);
+            f.jf = pos[in.jf == NEXT ? i + 1 : target(in.jf)] - (pos[i] + 1);
+        }
+        code.push_back(f);
+    }
+
+    struct sock_filter ret_accept = BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+    struct sock_filter ret_reject = BPF_STMT(BPF_RET | BPF_K, 0);
+    code.push_back(ret_accept);
+    code.push_back(ret_reject);
+
+    // The kernel refuses longer programs.
+    if(code.size() > BPF_MAXINSNS){
+        return std::vector<struct sock_filter>();
+    }
+    return code;
+}
+
+bool BpfProgram::valid(void) const{
+    return !build().empty();
+}
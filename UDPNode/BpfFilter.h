@@ -0,0 +1,131 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <linux/filter.h>
+
+// Enumeration for the rules a SO_REUSEPORT steering program shards by.
+enum steerRule{
+    STEER_CPU = 0,          // CPU handling the packet, so each shard serves its own RSS queues.
+    STEER_SOURCE_HASH,      // Hash of the source IP address, so each sender sticks to one shard.
+    STEER_PAYLOAD_KEY       // Hash of up to 4 payload bytes at a fixed offset, e.g. a message key.
+};
+
+// Offset of the message text in a UDPNode envelope, {"Time":<10 digits>,"Msg":"...
+static const unsigned int ENVELOPE_MSG_OFFSET = 26;
+
+// Builder for classic BPF programs run by the kernel on every datagram
+// before it is queued to a socket.
+//
+// Checks are appended in the order they should run; a datagram failing any
+// of them is dropped in the kernel, one passing all of them is accepted.
+// For UDP sockets the program sees the UDP header at offset 0, so the
+// payload starts at offset 8, and the IP header through SKF_NET_OFF.
+class BpfProgram{
+    public:
+        /**
+         * @brief Requires the UDP payload length to lie within a range.
+         *
+         * @param minlen Minimum payload length in bytes.
+         * @param maxlen Maximum payload length in bytes.
+         * @return BpfProgram& This program.
+         */
+        BpfProgram &requireLength(unsigned int minlen, unsigned int maxlen);
+
+        /**
+         * @brief Requires the UDP payload to start with the given bytes.
+         *
+         * @param magic Bytes the payload must start with.
+         * @return BpfProgram& This program.
+         */
+        BpfProgram &requirePrefix(const std::string &magic);
+
+        /**
+         * @brief Requires the source address to lie in one of the given networks.
+         *
+         * @param cidrs IPv4 or IPv6 networks such as "10.0.0.0/8" or "fd00::/8"; a bare address is a host. A malformed network makes the program invalid.
+         * @return BpfProgram& This program.
+         */
+        BpfProgram &allowSources(const std::vector<std::string> &cidrs);
+
+        /**
+         * @brief Returns a program accepting only UDPNode envelopes of a plausible size.
+         *
+         * @param maxlen Maximum payload length, usually the receiver's maximum message size.
+         * @return BpfProgram The program.
+         */
+        static BpfProgram envelopeFormat(unsigned int maxlen);
+
+        /**
+         * @brief Returns a SO_ATTACH_REUSEPORT_CBPF program selecting a shard of a reuseport group.
+         *
+         * The program returns the index of the socket in the group, i.e. the
+         * order in which the shards were bound. Reuseport programs see the
+         * UDP payload at offset 0.
+         *
+         * @param rule What to shard by.
+         * @param shards Number of sockets in the group.
+         * @param keyoffset Payload offset of the key for STEER_PAYLOAD_KEY.
+         * @param keylen Key length in bytes for STEER_PAYLOAD_KEY: 1, 2, 3 or 4, read big-endian; other lengths are invalid.
+         * @return std::vector<struct sock_filter> The instructions, empty if the arguments are invalid.
+         */
+        static std::vector<struct sock_filter> reuseportSteering(steerRule rule, unsigned int shards, unsigned int keyoffset = ENVELOPE_MSG_OFFSET, unsigned int keylen = 4);
+
+        /**
+         * @brief Resolves the jumps and returns the program.
+         *
+         * Conditional jumps too far for their 8-bit offsets go through
+         * unconditional jumps, so the number of checks is limited only by
+         * the kernel's BPF_MAXINSNS.
+         *
+         * @return std::vector<struct sock_filter> The instructions, empty if the program is invalid.
+         */
+        std::vector<struct sock_filter> build(void) const;
+
+        /**
+         * @brief Checks whether every check added so far was valid and the program fits in BPF_MAXINSNS instructions.
+         *
+         * @return bool True if the program can be built.
+         */
+        bool valid(void) const;
+
+    private:
+        // Jump targets of an instruction.
+        enum{
+            NEXT = -1,      // The following instruction.
+            REJECT = -2     // The final reject instruction.
+        };
+
+        // Instruction whose jump targets are labels.
+        struct insn{
+            uint16_t code;
+            int jt, jf;     // Labels of conditional jumps, or NEXT/REJECT.
+            uint32_t k;     // Constant, or the label of an unconditional jump.
+        };
+
+        // Appends a statement.
+        void stmt(uint16_t code, uint32_t k);
+
+        // Appends a conditional jump.
+        void jump(uint16_t code, uint32_t k, int jt, int jf);
+
+        // Appends an unconditional jump to a label.
+        void jumpTo(int label);
+
+        // Creates a label and marks its position.
+        int newLabel(void);
+        void mark(int label);
+
+        // Program with symbolic jumps.
+        std::vector<insn> _insns;
+
+        // Instruction index of each label.
+        std::vector<int> _labels;
+
+        // False once an invalid check was added.
+        bool _valid = true;
+};
@@ -0,0 +1,264 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include "RingBuffer.h"
+
+// Fixed-capacity table holding only the latest value per 64-bit key.
+//
+// Values are a trivially copyable header plus up to `maxbytes` of payload,
+// stored inline in open-addressing slots. Each slot is protected by a
+// seqlock: writers take it by making the sequence odd, readers copy the
+// slot and retry while it is odd or if it changed meanwhile. Readers never
+// block writers and take no lock, but a reader may retry for as long as a
+// writer holds the slot, so reads are lock-free rather than wait-free. Keys
+// are never removed, so the capacity bounds the key space. Slots are
+// twice as many as keys for short probes; the payloads live in a separate
+// area with one row per key, given out in order of first write. A slot updated since it was last popped is listed
+// once in a ring of updated slots, however often it is overwritten.
+template <typename H>
+class ConflationTable{
+    static_assert(std::is_trivially_copyable<H>::value, "ConflationTable headers must be trivially copyable");
+
+    public:
+        /**
+         * @brief Constructs an empty table.
+         *
+         * @param capacity Maximum number of distinct keys.
+         * @param maxbytes Maximum payload size of a value.
+         */
+        ConflationTable(size_t capacity, size_t maxbytes):
+            _capacity(capacity), _maxbytes(maxbytes), _keys(0), _updated(capacity){
+            // Keep the load factor at or below one half so probes stay short.
+            size_t size = 2;
+            while(size < 2 * capacity){
+                size <<= 1;
+            }
+            _mask = size - 1;
+            _slots.reset(new slot[size]);
+            _data.reset(new char[capacity * maxbytes]);
+        }
+
+        ConflationTable(const ConflationTable &) = delete;
+        ConflationTable &operator=(const ConflationTable &) = delete;
+
+        /**
+         * @brief Stores the latest value of a key.
+         *
+         * @param key The key.
+         * @param header Header of the value.
+         * @param data Payload of the value, truncated to maxbytes.
+         * @param len Payload length.
+         * @param conflated Set to true if an unread value of the key was overwritten.
+         * @return bool False if the key is new and the table already holds capacity keys.
+         */
+        bool write(uint64_t key, const H &header, const char *data, size_t len, bool &conflated){
+            conflated = false;
+            size_t idx;
+            if(!claim(key, idx)){
+                return false;
+            }
+            slot &s = _slots[idx];
+            len = len < _maxbytes ? len : _maxbytes;
+            s.header = header;
+            s.len = len;
+            memcpy(_data.get() + s.row * _maxbytes, data, len);
+            s.seq.fetch_add(1, std::memory_order_release);
+
+            // The first update since the last pop lists the slot; later ones conflate into it.
+            if(s.dirty.exchange(true, std::memory_order_acq_rel)){
+                conflated = true;
+            } else {
+                _updated.push(idx);
+            }
+            return true;
+        }
+
+        /**
+         * @brief Reads the latest value of a key without taking a lock, retrying while a writer updates it.
+         *
+         * @param key The key.
+         * @param header Receives the header.
+         * @param data Receives the payload.
+         * @return bool False if the key has no value.
+         */
+        bool read(uint64_t key, H &header, std::string &data) const{
+            size_t idx;
+            if(!find(key, idx)){
+                return false;
+            }
+            copy(idx, header, data);
+            return true;
+        }
+
+        /**
+         * @brief Removes the next key updated since it was last popped and reads its latest value.
+         *
+         * A write racing with the pop lists the key again, so the same
+         * latest value may be returned twice, but an update is never lost.
+         *
+         * @param key Receives the key.
+         * @param header Receives the header.
+         * @param data Receives the payload.
+         * @return bool False if no key was updated.
+         */
+        bool popUpdated(uint64_t &key, H &header, std::string &data){
+            size_t idx;
+            if(!_updated.pop(idx)){
+                return false;
+            }
+            slot &s = _slots[idx];
+            s.dirty.store(false, std::memory_order_release);
+            key = s.key.load(std::memory_order_relaxed);
+            copy(idx, header, data);
+            return true;
+        }
+
+        /**
+         * @brief Returns the number of keys updated since they were last popped.
+         *
+         * @return size_t The number of keys.
+         */
+        size_t updated(void) const{
+            return _updated.size();
+        }
+
+        /**
+         * @brief Returns the number of distinct keys stored.
+         *
+         * @return size_t The number of keys.
+         */
+        size_t keys(void) const{
+            return _keys.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Returns the maximum number of distinct keys.
+         *
+         * @return size_t The capacity.
+         */
+        size_t capacity(void) const{
+            return _capacity;
+        }
+
+    private:
+        struct slot{
+            std::atomic<uint32_t> seq{0};   // Odd while a writer holds the slot.
+            std::atomic<bool> used{false};  // Set once the key is published.
+            std::atomic<bool> dirty{false}; // Listed in _updated.
+            std::atomic<uint64_t> key{0};
+            size_t row = 0;                 // Payload row in _data, set before the key is published.
+            H header;
+            size_t len = 0;
+        };
+
+        static size_t mix(uint64_t key){
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdULL;
+            key ^= key >> 33;
+            return (size_t)key;
+        }
+
+        void lock(slot &s){
+            uint32_t seq = s.seq.load(std::memory_order_relaxed);
+            for(;;){
+                if(!(seq & 1) && s.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)){
+                    break;
+                }
+                std::this_thread::yield();
+                seq = s.seq.load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        bool find(uint64_t key, size_t &idx) const{
+            for(size_t i = 0, h = mix(key); i <= _mask; i++){
+                const slot &s = _slots[(h + i) & _mask];
+                if(!s.used.load(std::memory_order_acquire)){
+                    return false;
+                }
+                if(s.key.load(std::memory_order_relaxed) == key){
+                    idx = (h + i) & _mask;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Finds the slot of a key, publishing the key in an empty slot if it is new,
+        // and returns with the slot locked so readers never see a key without a value.
+        bool claim(uint64_t key, size_t &idx){
+            for(size_t i = 0, h = mix(key); i <= _mask; i++){
+                idx = (h + i) & _mask;
+                slot &s = _slots[idx];
+                if(!s.used.load(std::memory_order_acquire)){
+                    // Concurrent writers serialise on the slot lock before publishing a key.
+                    lock(s);
+                    if(!s.used.load(std::memory_order_relaxed)){
+                        size_t row = _keys.fetch_add(1, std::memory_order_relaxed);
+                        if(row >= _capacity){
+                            _keys.fetch_sub(1, std::memory_order_relaxed);
+                            s.seq.fetch_add(1, std::memory_order_release);
+                            return false;
+                        }
+                        s.row = row;
+                        s.key.store(key, std::memory_order_relaxed);
+                        s.used.store(true, std::memory_order_release);
+                        return true;
+                    }
+                    if(s.key.load(std::memory_order_relaxed) == key){
+                        return true;
+                    }
+                    s.seq.fetch_add(1, std::memory_order_release);
+                    continue;
+                }
+                if(s.key.load(std::memory_order_relaxed) == key){
+                    lock(s);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Copies a slot under its seqlock, retrying while a writer holds or changed it.
+        void copy(size_t idx, H &header, std::string &data) const{
+            const slot &s = _slots[idx];
+            data.resize(_maxbytes);
+            for(;;){
+                uint32_t before = s.seq.load(std::memory_order_acquire);
+                if(before & 1){
+                    std::this_thread::yield();
+                    continue;
+                }
+                H h = s.header;
+                size_t len = s.len;
+                len = len < _maxbytes ? len : _maxbytes;
+                memcpy(&data[0], _data.get() + s.row * _maxbytes, len);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(s.seq.load(std::memory_order_relaxed) == before){
+                    header = h;
+                    data.resize(len);
+                    return;
+                }
+            }
+        }
+
+        size_t _capacity;
+        size_t _maxbytes;
+        size_t _mask;
+        std::atomic<size_t> _keys;
+        std::unique_ptr<slot[]> _slots;
+        std::unique_ptr<char[]> _data;
+
+        // Indices of the slots updated since they were last popped.
+        RingBuffer<size_t> _updated;
+};
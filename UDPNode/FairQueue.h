@@ -0,0 +1,255 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <utility>
+#include <vector>
+
+// Queue made of per-source sub-queues served by deficit round robin.
+//
+// Sub-queues live in a flat open-addressing table keyed by a 64-bit source
+// key. Every round a backlogged source may dequeue up to `quantum` cost units,
+// so a chatty source cannot starve the others. Each source is capped, and a
+// full queue pushes out the newest element of its longest sub-queue to make
+// room for a shorter one, so a chatty source cannot take the whole capacity
+// either. Not thread-safe; callers lock.
+template <typename T>
+class FairQueue{
+    public:
+        /**
+         * @brief Constructs an empty fair queue.
+         *
+         * @param capacity Maximum number of elements over all sources.
+         * @param sourcecap Maximum number of elements per source.
+         * @param quantum Cost units a source may dequeue per round.
+         */
+        FairQueue(size_t capacity, size_t sourcecap, size_t quantum):
+            _capacity(capacity), _sourcecap(sourcecap), _quantum(quantum), _size(0), _used(0), _pushouts(0){
+            _slots.resize(16);
+        }
+
+        /**
+         * @brief Appends an element to the sub-queue of its source.
+         *
+         * @param key Source key.
+         * @param value The element, moved into the queue on success.
+         * @param cost Cost of the element in the units of the quantum, e.g. bytes.
+         * @return bool False if the source is at its cap, or the queue is full and no sub-queue is longer than the source's.
+         */
+        bool push(uint64_t key, T &&value, size_t cost){
+            // A source at its cap is refused before it can push out anyone else's element.
+            size_t mine = queued(key);
+            if(mine >= _sourcecap || (_size >= _capacity && !pushOut(mine))){
+                return false;
+            }
+            slot &s = _slots[findOrInsert(key)];
+            s.queue.emplace_back(std::move(value), cost);
+            if(!s.active){
+                s.active = true;
+                _active.push_back(&s - _slots.data());
+            }
+            _size++;
+            return true;
+        }
+
+        /**
+         * @brief Removes the next element in deficit round robin order.
+         *
+         * @param value Receives the element on success.
+         * @return bool False if the queue is empty.
+         */
+        bool pop(T &value){
+            while(!_active.empty()){
+                size_t idx = _active.front();
+                slot &s = _slots[idx];
+                // A source earns one quantum each time its turn starts.
+                if(!s.inturn){
+                    s.deficit += _quantum;
+                    s.inturn = true;
+                }
+                if(s.queue.front().second <= s.deficit){
+                    s.deficit -= s.queue.front().second;
+                    value = std::move(s.queue.front().first);
+                    s.queue.pop_front();
+                    _size--;
+                    if(s.queue.empty()){
+                        // An idle source keeps no credit.
+                        s.deficit = 0;
+                        s.inturn = false;
+                        s.active = false;
+                        _active.pop_front();
+                    }
+                    return true;
+                }
+                // Out of credit: end the turn and move to the back of the round.
+                s.inturn = false;
+                _active.pop_front();
+                _active.push_back(idx);
+            }
+            return false;
+        }
+
+        /**
+         * @brief Returns the number of queued elements.
+         *
+         * @return size_t The number of elements.
+         */
+        size_t size(void) const{
+            return _size;
+        }
+
+        /**
+         * @brief Checks whether the queue is empty.
+         *
+         * @return bool True if no element is queued.
+         */
+        bool empty(void) const{
+            return _size == 0;
+        }
+
+        /**
+         * @brief Returns the number of sources with queued elements.
+         *
+         * @return size_t The number of backlogged sources.
+         */
+        size_t activeSources(void) const{
+            return _active.size();
+        }
+
+        /**
+         * @brief Returns the number of elements pushed out of a full queue by another source's push().
+         *
+         * @return uint64_t The number of elements pushed out.
+         */
+        uint64_t pushOuts(void) const{
+            return _pushouts;
+        }
+
+        /**
+         * @brief Updates the per-source cap and the quantum.
+         *
+         * @param sourcecap Maximum number of elements per source.
+         * @param quantum Cost units a source may dequeue per round.
+         */
+        void setLimits(size_t sourcecap, size_t quantum){
+            _sourcecap = sourcecap;
+            _quantum = quantum;
+        }
+
+    private:
+        // Sub-queue of one source.
+        struct slot{
+            uint64_t key = 0;
+            bool used = false;      // Slot holds a source.
+            bool active = false;    // Source is in the round robin.
+            bool inturn = false;    // Source received its quantum for the current turn.
+            size_t deficit = 0;     // Unused credit in cost units.
+            std::deque<std::pair<T, size_t>> queue;
+        };
+
+        // Returns the number of elements queued for a key.
+        size_t queued(uint64_t key) const{
+            size_t mask = _slots.size() - 1;
+            for(size_t idx = mix(key) & mask; _slots[idx].used; idx = (idx + 1) & mask){
+                if(_slots[idx].key == key){
+                    return _slots[idx].queue.size();
+                }
+            }
+            return 0;
+        }
+
+        // Drops the newest element of the longest sub-queue if it is longer than a sub-queue of `mine` elements would become.
+        bool pushOut(size_t mine){
+            // Only backlogged sources hold elements; the scan is paid only while the queue is full.
+            slot *longest = nullptr;
+            for(size_t idx : _active){
+                if(longest == nullptr || _slots[idx].queue.size() > longest->queue.size()){
+                    longest = &_slots[idx];
+                }
+            }
+            if(longest == nullptr || longest->queue.size() <= mine + 1){
+                return false;
+            }
+            longest->queue.pop_back();
+            _size--;
+            _pushouts++;
+            return true;
+        }
+
+        // Returns the slot index of a key, inserting it if needed.
+        size_t findOrInsert(uint64_t key){
+            size_t mask = _slots.size() - 1;
+            size_t idx = mix(key) & mask;
+            while(_slots[idx].used){
+                if(_slots[idx].key == key){
+                    return idx;
+                }
+                idx = (idx + 1) & mask;
+            }
+            // Keep the load factor under one half.
+            if((_used + 1) * 2 > _slots.size()){
+                rehash();
+                return findOrInsert(key);
+            }
+            _slots[idx].used = true;
+            _slots[idx].key = key;
+            _used++;
+            return idx;
+        }
+
+        // Rebuilds the table, dropping idle sources and growing it if still too full.
+        void rehash(void){
+            size_t live = 0;
+            for(const auto &s : _slots){
+                if(s.used && !s.queue.empty()){
+                    live++;
+                }
+            }
+            size_t cap = _slots.size();
+            while((live + 1) * 4 > cap){
+                cap *= 2;
+            }
+
+            std::vector<slot> old;
+            old.swap(_slots);
+            _slots.resize(cap);
+            _used = 0;
+
+            // Re-insert in round-robin order so the active order survives.
+            std::deque<size_t> active;
+            for(size_t oldidx : _active){
+                slot &o = old[oldidx];
+                size_t idx = findOrInsert(o.key);
+                _slots[idx] = std::move(o);
+                active.push_back(idx);
+            }
+            _active.swap(active);
+        }
+
+        // Spreads the bits of a key over the table index.
+        static size_t mix(uint64_t key){
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdULL;
+            key ^= key >> 33;
+            return (size_t)key;
+        }
+
+        // Limits of the queue.
+        size_t _capacity, _sourcecap, _quantum;
+
+        // Number of queued elements and of used slots.
+        size_t _size, _used;
+
+        // Elements pushed out of a full queue.
+        uint64_t _pushouts;
+
+        // Open-addressing table of sources; the size is a power of two.
+        std::vector<slot> _slots;
+
+        // Slot indices of the backlogged sources in round-robin order.
+        std::deque<size_t> _active;
+};
@@ -0,0 +1,365 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Journal.h"
+#include "RecordFormat.h"
+#include "UDPNode.h"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// Number of write buffers; appends drop records once all of them wait for the disk.
+static const size_t JOURNAL_BUFFERS = 4;
+
+static size_t roundUp(size_t n, size_t align){
+    return (n + align - 1) / align * align;
+}
+
+static uint64_t realtimeNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static std::string journalPath(const std::string &dir, const std::string &prefix, uint64_t file, const char *ext){
+    char name[32];
+    snprintf(name, sizeof name, "-%06lu.%s", (unsigned long)file, ext);
+    return dir + "/" + prefix + name;
+}
+
+// Returns the sequence of a journal file name, or -1 if it does not belong to the prefix.
+static long journalSequence(const std::string &name, const std::string &prefix){
+    if(name.size() <= prefix.size() + 5 || name.compare(0, prefix.size(), prefix) != 0 || name[prefix.size()] != '-' ||
+       name.compare(name.size() - 4, 4, ".jnl") != 0){
+        return -1;
+    }
+    std::string digits = name.substr(prefix.size() + 1, name.size() - prefix.size() - 5);
+    if(digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos){
+        return -1;
+    }
+    return atol(digits.c_str());
+}
+
+JournalWriter::JournalWriter(const std::string &dir, const std::string &prefix, size_t filesize, size_t buffersize, unsigned int flushms):
+    _dir(dir), _prefix(prefix), _flushms(flushms), _current(0), _next(0), _nextoffset(0), _nextfile(0), _stop(false),
+    _fd(-1), _idxfd(-1), _openfile(0), _indexedoffset(0), _indexedany(false), _records(0), _drops(0){
+    _buffersize = roundUp(std::max<size_t>(buffersize, JOURNAL_ALIGN), JOURNAL_ALIGN);
+    _filesize = roundUp(std::max(filesize, _buffersize), _buffersize);
+
+    // Continue numbering after the files already in the directory.
+    std::vector<std::string> existing = JournalReader::list(dir, prefix);
+    if(!existing.empty()){
+        std::string last = existing.back().substr(existing.back().rfind('/') + 1);
+        _nextfile = journalSequence(last, prefix) + 1;
+    }
+
+    for(size_t i = 0; i < JOURNAL_BUFFERS; i++){
+        buffer b;
+        void *p = NULL;
+        if(posix_memalign(&p, JOURNAL_ALIGN, _buffersize) != 0){
+            p = NULL;
+        }
+        b.data = static_cast<char *>(p);
+        b.used = 0;
+        b.written = 0;
+        b.file = _nextfile;
+        b.offset = 0;
+        b.timens = 0;
+        b.sealed = false;
+        _buffers.push_back(b);
+    }
+    void *p = NULL;
+    if(posix_memalign(&p, JOURNAL_ALIGN, _buffersize) != 0){
+        p = NULL;
+    }
+    _scratch = static_cast<char *>(p);
+    _thread = std::thread(&JournalWriter::writerLoop, this);
+}
+
+JournalWriter::~JournalWriter(){
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+    }
+    _cv.notify_one();
+    if(_thread.joinable()){
+        _thread.join();
+    }
+    if(_fd != -1){
+        close(_fd);
+    }
+    if(_idxfd != -1){
+        close(_idxfd);
+    }
+    for(auto &b : _buffers){
+        free(b.data);
+    }
+    free(_scratch);
+}
+
+bool JournalWriter::append(const rxDatagram &datagram){
+    size_t size = recordSize(datagram);
+    std::lock_guard<std::mutex> lock(_mtx);
+    buffer *b = &_buffers[_current];
+    if(b->data == NULL || size > _buffersize){
+        _drops.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // A length field never straddles a block boundary; the reader skips the padding.
+    size_t room = JOURNAL_ALIGN - b->used % JOURNAL_ALIGN;
+    size_t pad = room < sizeof(uint32_t) ? room : 0;
+    if(b->used + pad + size > _buffersize){
+        // The full buffer is only sealed once the next one is free: sealed, it could be
+        // written and unsealed while still current, then sealed again behind the writer.
+        size_t n = (_current + 1) % _buffers.size();
+        if(_buffers[n].sealed){
+            _drops.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // The next buffer follows this one's last block, in the next file once this one is full.
+        b->sealed = true;
+        _nextfile = b->file;
+        _nextoffset = b->offset + roundUp(b->used, JOURNAL_ALIGN);
+        if(_nextoffset + _buffersize > _filesize){
+            _nextfile++;
+            _nextoffset = 0;
+        }
+        _cv.notify_one();
+        _current = n;
+        b = &_buffers[n];
+        b->used = 0;
+        b->written = 0;
+        b->file = _nextfile;
+        b->offset = _nextoffset;
+        pad = 0;
+    }
+    if(b->used == 0){
+        b->timens = datagram.arrivalns != 0 ? datagram.arrivalns : realtimeNs();
+    }
+    memset(b->data + b->used, 0, pad);
+    b->used += pad;
+    b->used += encodeRecord(datagram, b->data + b->used);
+    _records.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void JournalWriter::writerLoop(void){
+    std::unique_lock<std::mutex> lock(_mtx);
+    for(;;){
+        _cv.wait_for(lock, std::chrono::milliseconds(_flushms), [this]{ return _stop || _buffers[_next].sealed; });
+
+        // Sealed buffers are written in order; appenders do not touch them.
+        while(_buffers[_next].sealed){
+            buffer &b = _buffers[_next];
+            lock.unlock();
+            memset(b.data + b.used, 0, roundUp(b.used, JOURNAL_ALIGN) - b.used);
+            writeBuffer(b.data, b.used, b.file, b.offset, b.timens);
+            lock.lock();
+            b.sealed = false;
+            _next = (_next + 1) % _buffers.size();
+        }
+
+        // The buffer being filled is written as far as it got, and rewritten once it grows.
+        buffer &c = _buffers[_current];
+        if(!c.sealed && c.used > c.written){
+            size_t used = c.used;
+            uint64_t file = c.file, offset = c.offset, timens = c.timens;
+            memcpy(_scratch, c.data, used);
+            c.written = used;
+            lock.unlock();
+            memset(_scratch + used, 0, roundUp(used, JOURNAL_ALIGN) - used);
+            writeBuffer(_scratch, used, file, offset, timens);
+            lock.lock();
+        }
+
+        if(_stop && !_buffers[_next].sealed){
+            break;
+        }
+    }
+}
+
+void JournalWriter::writeBuffer(const char *data, size_t used, uint64_t file, uint64_t offset, uint64_t timens){
+    if(_fd == -1 || file != _openfile){
+        if(!openFile(file)){
+            return;
+        }
+    }
+    size_t len = roundUp(used, JOURNAL_ALIGN);
+    if(pwrite(_fd, data, len, offset) != (ssize_t)len){
+        std::cerr << "journal: pwrite: " << strerror(errno) << std::endl;
+    }
+
+    // One index entry per buffer; a partially written buffer is indexed the first time.
+    if(!_indexedany || offset > _indexedoffset){
+        journalIndexEntry entry;
+        entry.timens = timens;
+        entry.offset = offset;
+        if(write(_idxfd, &entry, sizeof entry) != sizeof entry){
+            std::cerr << "journal: index write: " << strerror(errno) << std::endl;
+        }
+        _indexedoffset = offset;
+        _indexedany = true;
+    }
+}
+
+bool JournalWriter::openFile(uint64_t file){
+    if(_fd != -1){
+        close(_fd);
+        close(_idxfd);
+        _fd = -1;
+        _idxfd = -1;
+    }
+    std::string path = journalPath(_dir, _prefix, file, "jnl");
+
+    // O_DIRECT bypasses the page cache; filesystems such as tmpfs refuse it.
+    _fd = open(path.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+    if(_fd == -1 && errno == EINVAL){
+        _fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    }
+    if(_fd == -1){
+        std::cerr << "journal: " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if(posix_fallocate(_fd, 0, _filesize) != 0 && ftruncate(_fd, _filesize) == -1){
+        std::cerr << "journal: cannot preallocate " << path << std::endl;
+    }
+    std::string idxpath = journalPath(_dir, _prefix, file, "idx");
+    _idxfd = open(idxpath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(_idxfd == -1){
+        std::cerr << "journal: " << idxpath << ": " << strerror(errno) << std::endl;
+        close(_fd);
+        _fd = -1;
+        return false;
+    }
+    _openfile = file;
+    _indexedoffset = 0;
+    _indexedany = false;
+    return true;
+}
+
+JournalReader::JournalReader():_base(NULL), _size(0), _pos(0){
+}
+
+JournalReader::~JournalReader(){
+    close();
+}
+
+std::vector<std::string> JournalReader::list(const std::string &dir, const std::string &prefix){
+    std::vector<std::pair<long, std::string>> files;
+    DIR *d = opendir(dir.c_str());
+    if(d != NULL){
+        struct dirent *e;
+        while((e = readdir(d)) != NULL){
+            long seq = journalSequence(e->d_name, prefix);
+            if(seq >= 0){
+                files.push_back(std::make_pair(seq, dir + "/" + e->d_name));
+            }
+        }
+        closedir(d);
+    }
+    std::sort(files.begin(), files.end());
+    std::vector<std::string> paths;
+    for(auto &f : files){
+        paths.push_back(f.second);
+    }
+    return paths;
+}
+
+bool JournalReader::open(const std::string &path){
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1){
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size == 0){
+        ::close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(base == MAP_FAILED){
+        return false;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    _base = static_cast<const char *>(base);
+    _size = st.st_size;
+    _pos = 0;
+
+    std::string idxpath = path.substr(0, path.size() - 3) + "idx";
+    int idxfd = ::open(idxpath.c_str(), O_RDONLY);
+    if(idxfd != -1){
+        journalIndexEntry entry;
+        while(read(idxfd, &entry, sizeof entry) == sizeof entry){
+            _index.push_back(entry);
+        }
+        ::close(idxfd);
+    }
+    return true;
+}
+
+void JournalReader::close(void){
+    if(_base != NULL){
+        munmap(const_cast<char *>(_base), _size);
+    }
+    _base = NULL;
+    _size = 0;
+    _pos = 0;
+    _index.clear();
+}
+
+bool JournalReader::next(const char *&data, size_t &len){
+    while(_pos + sizeof(uint32_t) <= _size){
+        size_t inblock = _pos % JOURNAL_ALIGN;
+        if(inblock != 0 && JOURNAL_ALIGN - inblock < sizeof(uint32_t)){
+            _pos = roundUp(_pos, JOURNAL_ALIGN);
+            continue;
+        }
+        uint32_t n;
+        memcpy(&n, _base + _pos, sizeof n);
+        if(n == 0){
+            // Zero padding up to the next block, or the end of the data at a block boundary.
+            if(inblock == 0){
+                return false;
+            }
+            _pos = roundUp(_pos, JOURNAL_ALIGN);
+            continue;
+        }
+        size_t size = n + sizeof(uint32_t);
+        if(_pos + size > _size){
+            return false;
+        }
+        data = _base + _pos;
+        len = size;
+        _pos += size;
+        return true;
+    }
+    return false;
+}
+
+bool JournalReader::next(rxDatagram &datagram){
+    const char *data;
+    size_t len;
+    while(next(data, len)){
+        if(decodeRecord(data, len, datagram) != 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+void JournalReader::seek(uint64_t timens){
+    _pos = 0;
+    for(const auto &entry : _index){
+        if(entry.timens > timens){
+            break;
+        }
+        _pos = entry.offset;
+    }
+}
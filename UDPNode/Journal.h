@@ -0,0 +1,208 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+struct rxDatagram;
+
+// Journal files are named <prefix>-<sequence>.jnl, each with a time index
+// <prefix>-<sequence>.idx next to it. A journal file is preallocated and
+// holds RecordFormat records written in blocks of JOURNAL_ALIGN bytes. The
+// unused tail of a block is zero, and a zero length at a block boundary
+// marks the end of the data. The index holds one journalIndexEntry per
+// written buffer, in file order.
+
+// Block size and alignment of journal writes.
+static const size_t JOURNAL_ALIGN = 4096;
+
+// Entry of a journal time index.
+struct journalIndexEntry{
+    uint64_t timens;        // Arrival time of the first record at offset, ns since the epoch.
+    uint64_t offset;        // Offset of the record in the journal file.
+};
+
+// Append-only journal of received datagrams.
+//
+// append() copies a record into an aligned in-memory buffer under a short
+// lock; a background thread writes filled buffers, and every flush interval
+// the partially filled one, with pwrite() to the preallocated file (opened
+// with O_DIRECT where the filesystem supports it). Files are rotated when
+// full. If every buffer is waiting for the disk, records are dropped and
+// counted rather than stalling the receive thread.
+class JournalWriter{
+    public:
+        /**
+         * @brief Opens the journal and starts the writer thread.
+         *
+         * Existing journal files with the same prefix are kept; numbering
+         * continues after the highest sequence found in the directory.
+         *
+         * @param dir Directory of the journal files.
+         * @param prefix File name prefix.
+         * @param filesize Size of each journal file, rounded up to the buffer size.
+         * @param buffersize Size of each write buffer, rounded up to JOURNAL_ALIGN.
+         * @param flushms Interval at which a partially filled buffer is written.
+         */
+        JournalWriter(const std::string &dir, const std::string &prefix, size_t filesize, size_t buffersize, unsigned int flushms);
+
+        /**
+         * @brief Writes the buffered records and stops the writer thread.
+         */
+        ~JournalWriter();
+
+        JournalWriter(const JournalWriter &) = delete;
+        JournalWriter &operator=(const JournalWriter &) = delete;
+
+        /**
+         * @brief Appends a datagram; safe to call from several threads.
+         *
+         * @param datagram The datagram.
+         * @return bool False if the record was dropped because every buffer was waiting for the disk.
+         */
+        bool append(const rxDatagram &datagram);
+
+        /**
+         * @brief Returns the number of records appended.
+         *
+         * @return uint64_t The number of records.
+         */
+        uint64_t records(void) const{
+            return _records.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Returns the number of records dropped.
+         *
+         * @return uint64_t The number of records.
+         */
+        uint64_t drops(void) const{
+            return _drops.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Structure describing one aligned write buffer.
+        struct buffer{
+            char *data;
+            size_t used;
+            size_t written;         // Bytes already written while the buffer was being filled.
+            uint64_t file;          // Sequence of the journal file the buffer belongs to.
+            uint64_t offset;        // Offset of the buffer in that file.
+            uint64_t timens;        // Arrival time of the first record.
+            bool sealed;            // Full and waiting to be written.
+        };
+
+        // Writer thread: writes sealed buffers and periodically the current one.
+        void writerLoop(void);
+
+        // Writes a buffer to its file, rotating files as needed.
+        void writeBuffer(const char *data, size_t used, uint64_t file, uint64_t offset, uint64_t timens);
+
+        // Opens the journal file and index with the given sequence.
+        bool openFile(uint64_t file);
+
+        std::string _dir;
+        std::string _prefix;
+        size_t _filesize;
+        size_t _buffersize;
+        unsigned int _flushms;
+
+        std::vector<buffer> _buffers;
+        size_t _current;            // Buffer being appended to.
+        size_t _next;               // Oldest sealed buffer not yet written.
+        uint64_t _nextoffset;       // Offset of the next buffer in _nextfile.
+        uint64_t _nextfile;
+
+        // Scratch copy of the current buffer for partial writes.
+        char *_scratch;
+
+        std::mutex _mtx;
+        std::condition_variable _cv;
+        bool _stop;
+        std::thread _thread;
+
+        // Currently open journal file, written by the writer thread only.
+        int _fd;
+        int _idxfd;
+        uint64_t _openfile;
+        uint64_t _indexedoffset;    // Offset of the last indexed buffer in the open file.
+        bool _indexedany;
+
+        std::atomic<uint64_t> _records;
+        std::atomic<uint64_t> _drops;
+};
+
+// Reader of journal files, returning records straight from a read-only mapping.
+class JournalReader{
+    public:
+        JournalReader();
+        ~JournalReader();
+
+        JournalReader(const JournalReader &) = delete;
+        JournalReader &operator=(const JournalReader &) = delete;
+
+        /**
+         * @brief Lists the journal files of a prefix in a directory, oldest first.
+         *
+         * @param dir Directory of the journal files.
+         * @param prefix File name prefix.
+         * @return std::vector<std::string> Paths of the .jnl files.
+         */
+        static std::vector<std::string> list(const std::string &dir, const std::string &prefix);
+
+        /**
+         * @brief Maps a journal file and its index.
+         *
+         * @param path Path of the .jnl file.
+         * @return bool False if the file cannot be opened or mapped.
+         */
+        bool open(const std::string &path);
+
+        /**
+         * @brief Unmaps the current file.
+         */
+        void close(void);
+
+        /**
+         * @brief Returns the next record without copying it.
+         *
+         * The pointer stays valid until the reader is closed or opens
+         * another file; decode it with decodeRecord().
+         *
+         * @param data Receives the start of the record.
+         * @param len Receives the size of the record.
+         * @return bool False at the end of the data.
+         */
+        bool next(const char *&data, size_t &len);
+
+        /**
+         * @brief Decodes the next record.
+         *
+         * @param datagram Receives the datagram.
+         * @return bool False at the end of the data.
+         */
+        bool next(rxDatagram &datagram);
+
+        /**
+         * @brief Positions the reader at the last indexed buffer starting at or before a time.
+         *
+         * Records before the time may still follow; skip them by arrivalns.
+         *
+         * @param timens Time in ns since the epoch.
+         */
+        void seek(uint64_t timens);
+
+    private:
+        const char *_base;
+        size_t _size;
+        size_t _pos;
+        std::vector<journalIndexEntry> _index;
+};
@@ -0,0 +1,159 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "RecordFormat.h"
+#include "UDPNode.h"
+
+// Appends a fixed-size field and advances the cursor.
+template <typename T>
+static void put(char *&p, T value){
+    memcpy(p, &value, sizeof value);
+    p += sizeof value;
+}
+
+// Reads a fixed-size field and advances the cursor.
+template <typename T>
+static T get(const char *&p){
+    T value;
+    memcpy(&value, p, sizeof value);
+    p += sizeof value;
+    return value;
+}
+
+// Capacity of the path of a Unix socket address.
+static const size_t SUN_PATH_LEN = sizeof(((struct sockaddr_un *)0)->sun_path);
+
+// Bytes of sun_path in a Unix source address; abstract names start with a NUL.
+static size_t srcPathLen(const rxDatagram &datagram){
+    if(datagram.srcaddr.ss_family != AF_UNIX || datagram.srcaddrlen <= offsetof(struct sockaddr_un, sun_path)){
+        return 0;
+    }
+    return std::min<size_t>(datagram.srcaddrlen - offsetof(struct sockaddr_un, sun_path), SUN_PATH_LEN);
+}
+
+size_t recordSize(const rxDatagram &datagram){
+    return RECORD_HEADER_LEN + datagram.dstipaddr.size() + srcPathLen(datagram) + datagram.msg.size();
+}
+
+size_t encodeRecord(const rxDatagram &datagram, char *out){
+    char *p = out;
+    size_t size = recordSize(datagram);
+    uint8_t addr[16];
+    memset(addr, 0, sizeof addr);
+    uint8_t family = datagram.srcaddr.ss_family;
+    if(family == AF_INET){
+        memcpy(addr, &((const struct sockaddr_in *)&datagram.srcaddr)->sin_addr, 4);
+    } else if(family == AF_INET6){
+        memcpy(addr, &((const struct sockaddr_in6 *)&datagram.srcaddr)->sin6_addr, 16);
+    }
+
+    put<uint32_t>(p, size - sizeof(uint32_t));
+    put<uint8_t>(p, RECORD_VERSION);
+    put<uint8_t>(p, family);
+    put<uint16_t>(p, datagram.srcport);
+    memcpy(p, addr, sizeof addr);
+    p += sizeof addr;
+    put<uint16_t>(p, datagram.dstport);
+    put<uint16_t>(p, datagram.dstipaddr.size());
+    put<uint16_t>(p, srcPathLen(datagram));
+    put<uint32_t>(p, datagram.priority);
+    put<uint32_t>(p, datagram.crc_checksum);
+    put<uint32_t>(p, datagram.ifindex);
+    put<uint32_t>(p, datagram.kerneldrops);
+    put<int32_t>(p, datagram.rxsockfd);
+    put<int64_t>(p, datagram.time_stamp);
+    put<uint64_t>(p, datagram.arrivalns);
+    put<uint64_t>(p, datagram.deadlinens);
+    put<uint32_t>(p, datagram.msg.size());
+    memcpy(p, datagram.dstipaddr.data(), datagram.dstipaddr.size());
+    p += datagram.dstipaddr.size();
+    memcpy(p, ((const struct sockaddr_un *)&datagram.srcaddr)->sun_path, srcPathLen(datagram));
+    p += srcPathLen(datagram);
+    memcpy(p, datagram.msg.data(), datagram.msg.size());
+    p += datagram.msg.size();
+    return p - out;
+}
+
+size_t decodeRecord(const char *data, size_t avail, rxDatagram &datagram){
+    if(avail < RECORD_V1_HEADER_LEN){
+        return 0;
+    }
+    const char *p = data;
+    size_t size = get<uint32_t>(p) + sizeof(uint32_t);
+    uint8_t version = get<uint8_t>(p);
+    size_t headerlen = version == 1 ? RECORD_V1_HEADER_LEN : RECORD_HEADER_LEN;
+    if(size < headerlen || size > avail || (version != 1 && version != RECORD_VERSION)){
+        return 0;
+    }
+    uint8_t family = get<uint8_t>(p);
+    datagram.srcport = get<uint16_t>(p);
+    uint8_t addr[16];
+    memcpy(addr, p, sizeof addr);
+    p += sizeof addr;
+    datagram.dstport = get<uint16_t>(p);
+    uint16_t dstiplen = get<uint16_t>(p);
+    uint16_t srcpathlen = version == 1 ? 0 : get<uint16_t>(p);
+    datagram.priority = get<uint32_t>(p);
+    datagram.crc_checksum = get<uint32_t>(p);
+    datagram.ifindex = get<uint32_t>(p);
+    datagram.kerneldrops = get<uint32_t>(p);
+    datagram.rxsockfd = get<int32_t>(p);
+    datagram.time_stamp = get<int64_t>(p);
+    datagram.arrivalns = get<uint64_t>(p);
+    datagram.deadlinens = get<uint64_t>(p);
+    uint32_t msglen = get<uint32_t>(p);
+    if(headerlen + (size_t)dstiplen + srcpathlen + msglen != size || srcpathlen > SUN_PATH_LEN){
+        return 0;
+    }
+    datagram.dstipaddr.assign(p, dstiplen);
+    p += dstiplen;
+
+    // Records keep the local address as text; its binary form is parsed once here, not per filter evaluation.
+    memset(&datagram.dstaddr, 0, sizeof datagram.dstaddr);
+    if(inet_pton(AF_INET, datagram.dstipaddr.c_str(), &((struct sockaddr_in *)&datagram.dstaddr)->sin_addr) == 1){
+        datagram.dstaddr.ss_family = AF_INET;
+    } else if(inet_pton(AF_INET6, datagram.dstipaddr.c_str(), &((struct sockaddr_in6 *)&datagram.dstaddr)->sin6_addr) == 1){
+        datagram.dstaddr.ss_family = AF_INET6;
+    }
+    const char *srcpath = p;
+    p += srcpathlen;
+    datagram.msg.assign(p, msglen);
+    datagram.jointhread = false;
+
+    // Rebuild the binary and textual source address.
+    char s[INET6_ADDRSTRLEN];
+    memset(&datagram.srcaddr, 0, sizeof datagram.srcaddr);
+    datagram.srcipaddr.clear();
+    if(family == AF_UNIX){
+        // The path is shown as is, abstract names with a leading '@'.
+        struct sockaddr_un *sun = (struct sockaddr_un *)&datagram.srcaddr;
+        sun->sun_family = AF_UNIX;
+        memcpy(sun->sun_path, srcpath, srcpathlen);
+        datagram.srcaddrlen = offsetof(struct sockaddr_un, sun_path) + srcpathlen;
+        if(srcpathlen > 0 && srcpath[0] == '\0'){
+            datagram.srcipaddr = "@" + std::string(srcpath + 1, strnlen(srcpath + 1, srcpathlen - 1));
+        } else {
+            datagram.srcipaddr.assign(srcpath, strnlen(srcpath, srcpathlen));
+        }
+    } else if(family == AF_INET){
+        struct sockaddr_in *sin = (struct sockaddr_in *)&datagram.srcaddr;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(datagram.srcport);
+        memcpy(&sin->sin_addr, addr, 4);
+        datagram.srcaddrlen = sizeof *sin;
+        if(inet_ntop(AF_INET, &sin->sin_addr, s, sizeof s) != NULL){
+            datagram.srcipaddr = s;
+        }
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&datagram.srcaddr;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(datagram.srcport);
+        memcpy(&sin6->sin6_addr, addr, 16);
+        datagram.srcaddrlen = sizeof *sin6;
+        if(inet_ntop(AF_INET6, &sin6->sin6_addr, s, sizeof s) != NULL){
+            datagram.srcipaddr = s;
+        }
+    }
+    return size;
+}
@@ -0,0 +1,78 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+struct rxDatagram;
+
+// Compact binary encoding of a received datagram, shared by the spill
+// queue and the journal.
+//
+// A record is a 4-byte length of the rest of the record followed by a
+// fixed-size header and the variable-length fields, all in host byte order:
+//
+//     uint32 length       bytes after this field
+//     uint8  version      RECORD_VERSION
+//     uint8  family       AF_INET, AF_INET6 or AF_UNIX of the source address
+//     uint16 srcport
+//     uint8  srcaddr[16]  IPv4 in the first 4 bytes, zero for AF_UNIX
+//     uint16 dstport
+//     uint16 dstiplen
+//     uint16 srcpathlen   bytes of the AF_UNIX source sun_path, 0 otherwise
+//     uint32 priority
+//     uint32 crc_checksum
+//     uint32 ifindex
+//     uint32 kerneldrops
+//     int32  rxsockfd     only meaningful inside the writing process
+//     int64  time_stamp
+//     uint64 arrivalns
+//     uint64 deadlinens
+//     uint32 msglen
+//     char   dstipaddr[dstiplen]
+//     char   srcpath[srcpathlen]
+//     char   msg[msglen]
+//
+// A length of 0 marks the end of the records in a preallocated region.
+// Version 1 records, which lack srcpathlen and srcpath, are still decoded.
+
+// Version written into every record.
+static const uint8_t RECORD_VERSION = 2;
+
+// Size of the length field and the fixed header.
+static const size_t RECORD_HEADER_LEN = 78;
+static const size_t RECORD_V1_HEADER_LEN = 76;
+
+/**
+ * @brief Returns the encoded size of a datagram.
+ *
+ * @param datagram The datagram.
+ * @return size_t Size in bytes, including the length field.
+ */
+size_t recordSize(const rxDatagram &datagram);
+
+/**
+ * @brief Encodes a datagram into a buffer.
+ *
+ * @param datagram The datagram.
+ * @param out Buffer of at least recordSize(datagram) bytes.
+ * @return size_t Bytes written.
+ */
+size_t encodeRecord(const rxDatagram &datagram, char *out);
+
+/**
+ * @brief Decodes the record at the start of a buffer.
+ *
+ * The source address is restored with its port. rxsockfd is the receiving
+ * socket of the writing process, so reply() only works on records read back
+ * by the node that wrote them.
+ *
+ * @param data Start of the record.
+ * @param avail Bytes available from data.
+ * @param datagram Receives the datagram.
+ * @return size_t Size of the record, or 0 if the buffer holds no complete, valid record.
+ */
+size_t decodeRecord(const char *data, size_t avail, rxDatagram &datagram);
@@ -0,0 +1,153 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free multi-producer multi-consumer queue.
+//
+// Each cell carries a sequence number telling producers and consumers whose
+// turn it is, so push() and pop() only contend on a single atomic index each.
+// The cell count is rounded up to a power of two; an exact ring holds no
+// more than the requested capacity, at the cost of reading the consumer
+// index on every push.
+template <typename T>
+class RingBuffer{
+    public:
+        /**
+         * @brief Constructs a ring able to hold at least the given number of elements.
+         *
+         * @param capacity Minimum number of elements.
+         * @param exact Hold at most capacity elements instead of the rounded-up cell count.
+         */
+        explicit RingBuffer(size_t capacity, bool exact = false){
+            size_t cap = 2;
+            while(cap < capacity){
+                cap <<= 1;
+            }
+            _mask = cap - 1;
+            _limit = exact ? std::max<size_t>(1, capacity) : cap;
+            _cells.reset(new cell[cap]);
+            for(size_t i = 0; i < cap; i++){
+                _cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+            _head.store(0, std::memory_order_relaxed);
+            _tail.store(0, std::memory_order_relaxed);
+        }
+
+        RingBuffer(const RingBuffer &) = delete;
+        RingBuffer &operator=(const RingBuffer &) = delete;
+
+        /**
+         * @brief Appends an element.
+         *
+         * @param value The element, moved into the ring on success.
+         * @return bool False if the ring is full.
+         */
+        bool push(T &&value){
+            size_t pos = _tail.load(std::memory_order_relaxed);
+            for(;;){
+                cell &c = _cells[pos & _mask];
+                size_t seq = c.seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if(diff == 0){
+                    // The head only advances, so a slot within the limit now stays within it.
+                    if(_limit <= _mask && pos - _head.load(std::memory_order_acquire) >= _limit){
+                        return false;
+                    }
+                    if(_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                        c.data = std::move(value);
+                        c.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0){
+                    return false;
+                } else {
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * @brief Appends a copy of an element.
+         *
+         * @param value The element.
+         * @return bool False if the ring is full.
+         */
+        bool push(const T &value){
+            T copy(value);
+            return push(std::move(copy));
+        }
+
+        /**
+         * @brief Removes the oldest element.
+         *
+         * @param value Receives the element on success.
+         * @return bool False if the ring is empty.
+         */
+        bool pop(T &value){
+            size_t pos = _head.load(std::memory_order_relaxed);
+            for(;;){
+                cell &c = _cells[pos & _mask];
+                size_t seq = c.seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if(diff == 0){
+                    if(_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                        value = std::move(c.data);
+                        c.seq.store(pos + _mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0){
+                    return false;
+                } else {
+                    pos = _head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * @brief Returns the approximate number of elements.
+         *
+         * @return size_t The number of elements, exact when no push or pop is in progress.
+         */
+        size_t size(void) const{
+            size_t tail = _tail.load(std::memory_order_acquire);
+            size_t head = _head.load(std::memory_order_acquire);
+            return tail > head ? tail - head : 0;
+        }
+
+        /**
+         * @brief Returns the number of elements the ring can hold.
+         *
+         * @return size_t The capacity.
+         */
+        size_t capacity(void) const{
+            return _limit;
+        }
+
+    private:
+        // Slot holding one element and the turn sequence number.
+        struct cell{
+            std::atomic<size_t> seq;
+            T data;
+        };
+
+        // Storage for the elements.
+        std::unique_ptr<cell[]> _cells;
+
+        // Cell count minus one, used to wrap indices.
+        size_t _mask;
+
+        // Most elements held at once.
+        size_t _limit;
+
+        // Consumer and producer positions, kept on separate cache lines.
+        alignas(64) std::atomic<size_t> _head;
+        alignas(64) std::atomic<size_t> _tail;
+};
@@ -0,0 +1,403 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#include "RxFilter.h"
+#include "UDPNode.h"
+
+#include <ctype.h>
+
+namespace{
+
+// Network in the IPv4-mapped IPv6 form, so one comparison serves both families.
+struct network{
+    unsigned char addr[16];
+    int prefix;             // Prefix length in bits of the 16-byte form.
+};
+
+// Converts a textual IPv4 or IPv6 address to the 16-byte form.
+bool toMapped(const std::string &text, unsigned char out[16]){
+    unsigned char bytes[16];
+    if(inet_pton(AF_INET, text.c_str(), bytes) == 1){
+        memset(out, 0, 10);
+        out[10] = out[11] = 0xff;
+        memcpy(out + 12, bytes, 4);
+        return true;
+    }
+    return inet_pton(AF_INET6, text.c_str(), out) == 1;
+}
+
+// Converts a socket address to the 16-byte form.
+bool toMapped(const struct sockaddr_storage &sa, unsigned char out[16]){
+    if(sa.ss_family == AF_INET){
+        memset(out, 0, 10);
+        out[10] = out[11] = 0xff;
+        memcpy(out + 12, &((const struct sockaddr_in *)&sa)->sin_addr, 4);
+        return true;
+    }
+    if(sa.ss_family == AF_INET6){
+        memcpy(out, &((const struct sockaddr_in6 *)&sa)->sin6_addr, 16);
+        return true;
+    }
+    return false;
+}
+
+bool parseNetwork(const std::string &text, network &net){
+    std::string addr = text;
+    int prefix = -1;
+    size_t slash = text.find('/');
+    if(slash != std::string::npos){
+        addr = text.substr(0, slash);
+        // Digits only: strtol() would also take a sign or leading blanks.
+        const char *digits = text.c_str() + slash + 1;
+        if(!isdigit((unsigned char)digits[0])){
+            return false;
+        }
+        char *end = nullptr;
+        long value = strtol(digits, &end, 10);
+        if(*end != '\0' || value > 128){
+            return false;
+        }
+        prefix = (int)value;
+    }
+    if(!toMapped(addr, net.addr)){
+        return false;
+    }
+    bool v4 = addr.find(':') == std::string::npos;
+    int maxprefix = v4 ? 32 : 128;
+    if(prefix > maxprefix){
+        return false;
+    }
+    net.prefix = (prefix < 0 ? maxprefix : prefix) + (v4 ? 96 : 0);
+    return true;
+}
+
+bool inNetwork(const unsigned char addr[16], const network &net){
+    int full = net.prefix / 8;
+    if(memcmp(addr, net.addr, full) != 0){
+        return false;
+    }
+    int rest = net.prefix % 8;
+    if(rest == 0){
+        return true;
+    }
+    unsigned char mask = (unsigned char)(0xff << (8 - rest));
+    return (addr[full] & mask) == (net.addr[full] & mask);
+}
+
+// Recursive-descent parser producing the closure tree.
+class Parser{
+    public:
+        explicit Parser(const std::string &text) : _text(text), _pos(0) { next(); }
+
+        RxFilter::predicate parse(std::string &error){
+            RxFilter::predicate root = parseOr();
+            if(root && _tok.kind != END){
+                fail("unexpected '" + _tok.text + "'");
+            }
+            if(!_error.empty()){
+                error = _error;
+                return nullptr;
+            }
+            return root;
+        }
+
+    private:
+        enum tokenKind{ END, WORD, STRING, OP };
+        struct token{
+            tokenKind kind;
+            std::string text;
+            size_t pos;
+        };
+
+        static bool isWordChar(char c){
+            return isalnum((unsigned char)c) || c == '_' || c == '.' || c == ':' || c == '/';
+        }
+
+        void next(void){
+            while(_pos < _text.size() && isspace((unsigned char)_text[_pos])){
+                _pos++;
+            }
+            _tok.pos = _pos;
+            _tok.text.clear();
+            if(_pos >= _text.size()){
+                _tok.kind = END;
+                return;
+            }
+            char c = _text[_pos];
+            if(c == '"'){
+                _tok.kind = STRING;
+                _pos++;
+                while(_pos < _text.size() && _text[_pos] != '"'){
+                    if(_text[_pos] == '\\' && _pos + 1 < _text.size()){
+                        _pos++;
+                    }
+                    _tok.text += _text[_pos++];
+                }
+                if(_pos >= _text.size()){
+                    fail("unterminated string");
+                    _tok.kind = END;
+                    return;
+                }
+                _pos++;
+                return;
+            }
+            if(isWordChar(c)){
+                _tok.kind = WORD;
+                while(_pos < _text.size() && isWordChar(_text[_pos])){
+                    _tok.text += _text[_pos++];
+                }
+                return;
+            }
+            static const char *ops[] = {"&&", "||", "==", "!=", "<=", ">=", "<", ">", "!", "(", ")", "[", "]", ","};
+            for(const char *op : ops){
+                size_t len = strlen(op);
+                if(_text.compare(_pos, len, op) == 0){
+                    _tok.kind = OP;
+                    _tok.text = op;
+                    _pos += len;
+                    return;
+                }
+            }
+            fail(std::string("unexpected character '") + c + "'");
+            _tok.kind = END;
+        }
+
+        void fail(const std::string &msg){
+            if(_error.empty()){
+                _error = msg + " at offset " + std::to_string(_tok.pos);
+            }
+        }
+
+        bool accept(const char *op){
+            if(_tok.kind == OP && _tok.text == op){
+                next();
+                return true;
+            }
+            return false;
+        }
+
+        RxFilter::predicate parseOr(void){
+            RxFilter::predicate left = parseAnd();
+            while(left && accept("||")){
+                RxFilter::predicate right = parseAnd();
+                if(!right){
+                    return nullptr;
+                }
+                left = [l = std::move(left), r = std::move(right)](const rxDatagram &d){ return l(d) || r(d); };
+            }
+            return left;
+        }
+
+        RxFilter::predicate parseAnd(void){
+            RxFilter::predicate left = parseUnary();
+            while(left && accept("&&")){
+                RxFilter::predicate right = parseUnary();
+                if(!right){
+                    return nullptr;
+                }
+                left = [l = std::move(left), r = std::move(right)](const rxDatagram &d){ return l(d) && r(d); };
+            }
+            return left;
+        }
+
+        RxFilter::predicate parseUnary(void){
+            if(accept("!")){
+                RxFilter::predicate inner = parseUnary();
+                if(!inner){
+                    return nullptr;
+                }
+                return [i = std::move(inner)](const rxDatagram &d){ return !i(d); };
+            }
+            if(accept("(")){
+                RxFilter::predicate inner = parseOr();
+                if(inner && !accept(")")){
+                    fail("expected ')'");
+                    return nullptr;
+                }
+                return inner;
+            }
+            return parsePredicate();
+        }
+
+        RxFilter::predicate parsePredicate(void){
+            if(_tok.kind != WORD){
+                fail("expected a field name");
+                return nullptr;
+            }
+            std::string field = _tok.text;
+            next();
+            if(field == "src" || field == "dst"){
+                return parseAddress(field == "src");
+            }
+            if(field == "msg"){
+                return parseMessage();
+            }
+            std::function<uint64_t(const rxDatagram &)> get;
+            if(field == "srcport"){
+                get = [](const rxDatagram &d) -> uint64_t { return d.srcport; };
+            } else if(field == "dstport"){
+                get = [](const rxDatagram &d) -> uint64_t { return d.dstport; };
+            } else if(field == "prio"){
+                get = [](const rxDatagram &d) -> uint64_t { return d.priority; };
+            } else if(field == "len"){
+                get = [](const rxDatagram &d) -> uint64_t { return d.msg.size(); };
+            } else if(field == "ifindex"){
+                get = [](const rxDatagram &d) -> uint64_t { return d.ifindex; };
+            } else {
+                fail("unknown field '" + field + "'");
+                return nullptr;
+            }
+            return parseNumber(std::move(get));
+        }
+
+        RxFilter::predicate parseAddress(bool source){
+            std::vector<network> nets;
+            bool negate = false;
+            if(_tok.kind == WORD && _tok.text == "in"){
+                next();
+                bool list = accept("[");
+                do{
+                    network net;
+                    if(_tok.kind != WORD || !parseNetwork(_tok.text, net)){
+                        fail("expected a network");
+                        return nullptr;
+                    }
+                    nets.push_back(net);
+                    next();
+                } while(list && accept(","));
+                if(list && !accept("]")){
+                    fail("expected ']'");
+                    return nullptr;
+                }
+            } else if(_tok.kind == OP && (_tok.text == "==" || _tok.text == "!=")){
+                negate = _tok.text == "!=";
+                next();
+                network net;
+                if(_tok.kind != WORD || _tok.text.find('/') != std::string::npos || !parseNetwork(_tok.text, net)){
+                    fail("expected an address");
+                    return nullptr;
+                }
+                nets.push_back(net);
+                next();
+            } else {
+                fail("expected 'in', '==' or '!='");
+                return nullptr;
+            }
+
+            if(source){
+                return [nets, negate](const rxDatagram &d){
+                    unsigned char addr[16];
+                    bool hit = false;
+                    if(toMapped(d.srcaddr, addr)){
+                        for(const auto &net : nets){
+                            if(inNetwork(addr, net)){
+                                hit = true;
+                                break;
+                            }
+                        }
+                    }
+                    return hit != negate;
+                };
+            }
+            return [nets, negate](const rxDatagram &d){
+                unsigned char addr[16];
+                bool hit = false;
+                if(toMapped(d.dstaddr, addr)){
+                    for(const auto &net : nets){
+                        if(inNetwork(addr, net)){
+                            hit = true;
+                            break;
+                        }
+                    }
+                }
+                return hit != negate;
+            };
+        }
+
+        RxFilter::predicate parseMessage(void){
+            std::string op = _tok.text;
+            bool known = (_tok.kind == OP && (op == "==" || op == "!=")) ||
+                         (_tok.kind == WORD && (op == "startswith" || op == "endswith" || op == "contains"));
+            if(!known){
+                fail("expected '==', '!=', 'startswith', 'endswith' or 'contains'");
+                return nullptr;
+            }
+            next();
+            if(_tok.kind != STRING){
+                fail("expected a string");
+                return nullptr;
+            }
+            std::string s = _tok.text;
+            next();
+            if(op == "=="){
+                return [s](const rxDatagram &d){ return d.msg == s; };
+            }
+            if(op == "!="){
+                return [s](const rxDatagram &d){ return d.msg != s; };
+            }
+            if(op == "startswith"){
+                return [s](const rxDatagram &d){ return d.msg.compare(0, s.size(), s) == 0; };
+            }
+            if(op == "endswith"){
+                return [s](const rxDatagram &d){
+                    return d.msg.size() >= s.size() && d.msg.compare(d.msg.size() - s.size(), s.size(), s) == 0;
+                };
+            }
+            return [s](const rxDatagram &d){ return d.msg.find(s) != std::string::npos; };
+        }
+
+        RxFilter::predicate parseNumber(std::function<uint64_t(const rxDatagram &)> get){
+            static const std::string comparisons = " == != < <= > >= ";
+            if(_tok.kind != OP || comparisons.find(" " + _tok.text + " ") == std::string::npos){
+                fail("expected a comparison");
+                return nullptr;
+            }
+            std::string op = _tok.text;
+            next();
+            // Decimal only, so "010" is ten; a value past uint64_t is an error rather than saturated.
+            char *end = nullptr;
+            errno = 0;
+            uint64_t v = _tok.kind == WORD && isdigit((unsigned char)_tok.text[0]) ? strtoull(_tok.text.c_str(), &end, 10) : 0;
+            if(end == nullptr || *end != '\0' || errno == ERANGE){
+                fail("expected a number");
+                return nullptr;
+            }
+            next();
+            if(op == "=="){
+                return [get, v](const rxDatagram &d){ return get(d) == v; };
+            }
+            if(op == "!="){
+                return [get, v](const rxDatagram &d){ return get(d) != v; };
+            }
+            if(op == "<"){
+                return [get, v](const rxDatagram &d){ return get(d) < v; };
+            }
+            if(op == "<="){
+                return [get, v](const rxDatagram &d){ return get(d) <= v; };
+            }
+            if(op == ">"){
+                return [get, v](const rxDatagram &d){ return get(d) > v; };
+            }
+            return [get, v](const rxDatagram &d){ return get(d) >= v; };
+        }
+
+        const std::string &_text;
+        size_t _pos;
+        token _tok;
+        std::string _error;
+};
+
+}
+
+std::shared_ptr<const RxFilter> RxFilter::compile(const std::string &expression, std::string *error){
+    std::string msg;
+    Parser parser(expression);
+    predicate root = parser.parse(msg);
+    if(!root){
+        if(error){
+            *error = msg.empty() ? "empty expression" : msg;
+        }
+        return nullptr;
+    }
+    return std::shared_ptr<const RxFilter>(new RxFilter(expression, std::move(root)));
+}
@@ -0,0 +1,65 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <string>
+#include <memory>
+#include <functional>
+
+struct rxDatagram;
+
+// Subscription filter compiled from an expression such as
+//
+//     src in 10.0.0.0/8 && msg startswith "px."
+//
+// The expression is parsed once into a tree of closures, so evaluating it
+// on a datagram costs a few indirect calls and no string processing.
+//
+// Grammar:
+//     expr       := and ( "||" and )*
+//     and        := unary ( "&&" unary )*
+//     unary      := "!" unary | "(" expr ")" | predicate
+//     predicate  := ("src" | "dst") ( "in" networks | ("==" | "!=") address )
+//                 | "msg" ( "==" | "!=" | "startswith" | "endswith" | "contains" ) string
+//                 | ("srcport" | "dstport" | "prio" | "len" | "ifindex") ( "==" | "!=" | "<" | "<=" | ">" | ">=" ) number
+//     networks   := network | "[" network ( "," network )* "]"
+//
+// Networks are IPv4 or IPv6 CIDRs ("10.0.0.0/8", "fd00::/8") or bare
+// addresses; IPv4-mapped IPv6 sources match IPv4 networks. Strings are
+// double-quoted with backslash escapes. "len" is the message length.
+class RxFilter{
+    public:
+        /**
+         * @brief Compiles a filter expression.
+         *
+         * @param expression The expression.
+         * @param error Receives a description of the first syntax error, if any.
+         * @return std::shared_ptr<const RxFilter> The filter, or null if the expression is invalid.
+         */
+        static std::shared_ptr<const RxFilter> compile(const std::string &expression, std::string *error = nullptr);
+
+        /**
+         * @brief Evaluates the filter on a parsed datagram.
+         *
+         * @param datagram The datagram.
+         * @return bool True if the datagram matches.
+         */
+        bool match(const rxDatagram &datagram) const { return _root(datagram); }
+
+        /**
+         * @brief Returns the expression the filter was compiled from.
+         *
+         * @return const std::string& The expression.
+         */
+        const std::string &expression(void) const { return _expression; }
+
+        // Compiled node of the expression tree.
+        typedef std::function<bool(const rxDatagram &)> predicate;
+
+    private:
+        RxFilter(const std::string &expression, predicate root) : _expression(expression), _root(std::move(root)) {}
+
+        std::string _expression;
+        predicate _root;
+};
@@ -0,0 +1,220 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "ShmRing.h"
+#include "RecordFormat.h"
+#include "UDPNode.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <new>
+
+static const uint32_t SHM_RING_MAGIC = 0x55444e52;     // "RNDU"
+static const size_t SHM_RING_ALIGN = 8;
+static const size_t SHM_RING_MIN = 64 * 1024;
+
+// Stored instead of a record length where the producer wrapped to the start.
+static const uint32_t SHM_RING_WRAP = 0xffffffff;
+
+// Size of the header page in front of the record area.
+static const size_t SHM_HEADER_LEN = 4096;
+
+// Seals a ring's memfd carries, so the producer cannot resize the pages under the consumer's mapping.
+static const int SHM_RING_SEALS = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+// The header shares a page with nothing else; the indices sit on their own cache lines.
+struct ShmRing::ringHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    alignas(64) std::atomic<uint64_t> head;     // Bytes written, advanced by the producer.
+    alignas(64) std::atomic<uint64_t> tail;     // Bytes read, advanced by the consumer.
+    alignas(64) std::atomic<uint32_t> waiting;  // Set by the consumer before it sleeps.
+    std::atomic<uint32_t> closed;               // Set by the consumer when it abandons the ring.
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t) && std::atomic<uint64_t>::is_always_lock_free,
+              "ring indices must be lock-free to be shared between processes");
+
+static size_t roundUp(size_t n, size_t align){
+    return (n + align - 1) / align * align;
+}
+
+ShmRing::ShmRing(ringHeader *header, size_t maplen, int memfd, int eventfd):
+    _header(header), _data(reinterpret_cast<char *>(header) + SHM_HEADER_LEN), _capacity(header->capacity),
+    _maplen(maplen), _memfd(memfd), _eventfd(eventfd){
+}
+
+ShmRing::~ShmRing(){
+    munmap(_header, _maplen);
+    if(_memfd != -1){
+        ::close(_memfd);
+    }
+    if(_eventfd != -1){
+        ::close(_eventfd);
+    }
+}
+
+std::unique_ptr<ShmRing> ShmRing::create(size_t capacity){
+    size_t cap = SHM_RING_MIN;
+    while(cap < capacity){
+        cap *= 2;
+    }
+    size_t maplen = SHM_HEADER_LEN + cap;
+    int memfd = memfd_create("udpnode-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(memfd == -1){
+        std::cerr << "shm: memfd_create: " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    if(ftruncate(memfd, maplen) == -1 || fcntl(memfd, F_ADD_SEALS, SHM_RING_SEALS) == -1){
+        std::cerr << "shm: sizing the memfd: " << strerror(errno) << std::endl;
+        ::close(memfd);
+        return nullptr;
+    }
+    int efd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(efd == -1){
+        ::close(memfd);
+        return nullptr;
+    }
+    void *base = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if(base == MAP_FAILED){
+        std::cerr << "shm: mmap: " << strerror(errno) << std::endl;
+        ::close(memfd);
+        ::close(efd);
+        return nullptr;
+    }
+    ringHeader *header = new (base) ringHeader;
+    header->magic = SHM_RING_MAGIC;
+    header->version = RECORD_VERSION;
+    header->capacity = cap;
+    header->head.store(0, std::memory_order_relaxed);
+    header->tail.store(0, std::memory_order_relaxed);
+    header->waiting.store(0, std::memory_order_relaxed);
+    header->closed.store(0, std::memory_order_relaxed);
+    return std::unique_ptr<ShmRing>(new ShmRing(header, maplen, memfd, efd));
+}
+
+std::unique_ptr<ShmRing> ShmRing::attach(int memfd, int eventfd){
+    // An unsealed memfd could be shrunk after mapping, and the next access would raise SIGBUS.
+    struct stat st;
+    void *base = MAP_FAILED;
+    int seals = fcntl(memfd, F_GET_SEALS);
+    if(seals != -1 && (seals & SHM_RING_SEALS) == SHM_RING_SEALS && fstat(memfd, &st) == 0 && (size_t)st.st_size > SHM_HEADER_LEN){
+        base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    ringHeader *header = static_cast<ringHeader *>(base);
+    if(base == MAP_FAILED || header->magic != SHM_RING_MAGIC || header->version != RECORD_VERSION ||
+       header->capacity != (size_t)st.st_size - SHM_HEADER_LEN || (header->capacity & (header->capacity - 1)) != 0){
+        if(base != MAP_FAILED){
+            munmap(base, st.st_size);
+        }
+        ::close(memfd);
+        ::close(eventfd);
+        return nullptr;
+    }
+
+    // The mapping keeps the pages alive; the memfd is not needed any more.
+    ::close(memfd);
+    return std::unique_ptr<ShmRing>(new ShmRing(header, st.st_size, -1, eventfd));
+}
+
+bool ShmRing::push(const rxDatagram &datagram){
+    size_t need = roundUp(recordSize(datagram), SHM_RING_ALIGN);
+    if(need > _capacity / 2){
+        return false;
+    }
+    uint64_t head = _header->head.load(std::memory_order_relaxed);
+    uint64_t tail = _header->tail.load(std::memory_order_acquire);
+    size_t pos = head & (_capacity - 1);
+    size_t pad = _capacity - pos < need ? _capacity - pos : 0;
+    if(_capacity - (head - tail) < pad + need){
+        return false;
+    }
+    if(pad > 0){
+        memcpy(_data + pos, &SHM_RING_WRAP, sizeof SHM_RING_WRAP);
+        head += pad;
+        pos = 0;
+    }
+    encodeRecord(datagram, _data + pos);
+
+    // Publishing the head and reading the wait flag must not be reordered, or a wake-up is lost.
+    _header->head.store(head + need, std::memory_order_seq_cst);
+    if(_header->waiting.load(std::memory_order_seq_cst) != 0 && _header->waiting.exchange(0) != 0){
+        uint64_t one = 1;
+        if(write(_eventfd, &one, sizeof one) == -1){
+            std::cerr << "shm: eventfd write: " << strerror(errno) << std::endl;
+        }
+    }
+    return true;
+}
+
+bool ShmRing::pop(rxDatagram &datagram){
+    uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+    uint64_t head = _header->head.load(std::memory_order_acquire);
+    while(tail != head){
+        // The producer's framing is not trusted: a record or wrap that overruns head or the ring ends it.
+        size_t pos = tail & (_capacity - 1);
+        uint32_t len;
+        if(head - tail > _capacity || head - tail < sizeof len){
+            break;
+        }
+        memcpy(&len, _data + pos, sizeof len);
+        if(len == SHM_RING_WRAP){
+            if(_capacity - pos > head - tail){
+                break;
+            }
+            tail += _capacity - pos;
+            continue;
+        }
+        size_t size = (size_t)len + sizeof len;
+        if(size > _capacity - pos || roundUp(size, SHM_RING_ALIGN) > head - tail){
+            break;
+        }
+        size_t n = decodeRecord(_data + pos, size, datagram);
+        tail += roundUp(size, SHM_RING_ALIGN);
+        if(n != 0){
+            _header->tail.store(tail, std::memory_order_release);
+            return true;
+        }
+    }
+    if(tail != head && !closed()){
+        std::cerr << "shm: corrupt ring, closing it" << std::endl;
+        close();
+    }
+    _header->tail.store(head, std::memory_order_release);
+    return false;
+}
+
+bool ShmRing::prepareWait(void){
+    _header->waiting.store(1, std::memory_order_seq_cst);
+    if(_header->head.load(std::memory_order_seq_cst) != _header->tail.load(std::memory_order_relaxed)){
+        _header->waiting.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void ShmRing::acknowledge(void){
+    _header->waiting.store(0, std::memory_order_relaxed);
+    uint64_t count;
+    while(read(_eventfd, &count, sizeof count) > 0){
+    }
+}
+
+void ShmRing::close(void){
+    _header->closed.store(1, std::memory_order_release);
+}
+
+bool ShmRing::closed(void) const{
+    return _header->closed.load(std::memory_order_acquire) != 0;
+}
+
+void ShmRing::releaseMemfd(void){
+    if(_memfd != -1){
+        ::close(_memfd);
+        _memfd = -1;
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+struct rxDatagram;
+
+// Single-producer single-consumer ring of datagrams in shared memory.
+//
+// The producer creates the ring in a memfd together with an eventfd and
+// passes both to the consumer process, which maps the same pages.
+// Datagrams are stored as RecordFormat records at 8-byte aligned offsets; a
+// record that would cross the end of the ring is written at the start after
+// a wrap marker. The consumer announces when it is about to sleep, and only
+// then does the producer write the eventfd, so a busy ring costs no system
+// calls. Neither side is thread-safe; callers lock.
+class ShmRing{
+    public:
+        /**
+         * @brief Creates a ring on the producer side.
+         *
+         * @param capacity Size of the record area, rounded up to a power of two.
+         * @return std::unique_ptr<ShmRing> The ring, or nullptr if the memfd, eventfd or mapping cannot be created.
+         */
+        static std::unique_ptr<ShmRing> create(size_t capacity);
+
+        /**
+         * @brief Maps a ring received from a producer; takes ownership of both descriptors.
+         *
+         * @param memfd The memfd holding the ring.
+         * @param eventfd The eventfd the producer signals.
+         * @return std::unique_ptr<ShmRing> The ring, or nullptr if the memfd is not sealed against resizing or does not hold a valid ring.
+         */
+        static std::unique_ptr<ShmRing> attach(int memfd, int eventfd);
+
+        ~ShmRing();
+
+        ShmRing(const ShmRing &) = delete;
+        ShmRing &operator=(const ShmRing &) = delete;
+
+        /**
+         * @brief Appends a datagram and wakes the consumer if it sleeps (producer side).
+         *
+         * @param datagram The datagram.
+         * @return bool False if the ring is full or the datagram larger than half the ring.
+         */
+        bool push(const rxDatagram &datagram);
+
+        /**
+         * @brief Removes the oldest datagram (consumer side); a ring with corrupt framing is emptied and closed.
+         *
+         * @param datagram Receives the datagram.
+         * @return bool False if the ring is empty or corrupt.
+         */
+        bool pop(rxDatagram &datagram);
+
+        /**
+         * @brief Announces that the consumer is about to wait on the eventfd.
+         *
+         * @return bool False if datagrams arrived meanwhile and the consumer must not wait.
+         */
+        bool prepareWait(void);
+
+        /**
+         * @brief Resets the eventfd and the wait announcement after the consumer woke.
+         */
+        void acknowledge(void);
+
+        /**
+         * @brief Marks the ring as abandoned by the consumer.
+         */
+        void close(void);
+
+        /**
+         * @brief Checks whether the consumer abandoned the ring.
+         *
+         * @return bool True once the consumer called close().
+         */
+        bool closed(void) const;
+
+        /**
+         * @brief Closes the producer's copy of the memfd once it has been passed on.
+         */
+        void releaseMemfd(void);
+
+        int memfd(void) const{
+            return _memfd;
+        }
+
+        int eventfd(void) const{
+            return _eventfd;
+        }
+
+    private:
+        struct ringHeader;
+
+        ShmRing(ringHeader *header, size_t maplen, int memfd, int eventfd);
+
+        ringHeader *_header;
+        char *_data;
+        size_t _capacity;
+        size_t _maplen;
+        int _memfd;
+        int _eventfd;
+};
@@ -0,0 +1,277 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "SimNetwork.h"
+
+#include <string.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <algorithm>
+
+// Shape of the Pareto excess delay; above 2 so the variance is finite.
+static const double SIM_PARETO_SHAPE = 2.5;
+
+// Port of a socket address, 0 for other families.
+static int addrPort(const struct sockaddr_storage &addr){
+    if(addr.ss_family == AF_INET){
+        return ntohs(((const struct sockaddr_in *)&addr)->sin_port);
+    }
+    if(addr.ss_family == AF_INET6){
+        return ntohs(((const struct sockaddr_in6 *)&addr)->sin6_port);
+    }
+    return 0;
+}
+
+// Family, port and address bytes, ignoring padding and IPv6 flow labels.
+static std::string addrKey(const struct sockaddr_storage &addr){
+    std::string key(1, (char)addr.ss_family);
+    int port = addrPort(addr);
+    key.append((const char *)&port, sizeof port);
+    if(addr.ss_family == AF_INET){
+        key.append((const char *)&((const struct sockaddr_in *)&addr)->sin_addr, 4);
+    } else if(addr.ss_family == AF_INET6){
+        key.append((const char *)&((const struct sockaddr_in6 *)&addr)->sin6_addr, 16);
+    }
+    return key;
+}
+
+SimNetwork::SimNetwork(uint64_t seed):_rng(seed), _seq(0), _now(0), _realtime(false), _stop(false){
+    memset(&_stats, 0, sizeof _stats);
+}
+
+SimNetwork::~SimNetwork(){
+    stop();
+}
+
+void SimNetwork::setLink(const simLinkOptions &opts){
+    std::lock_guard<std::mutex> lock(_mtx);
+    _defaultlink = opts;
+}
+
+void SimNetwork::setLink(int srcport, int dstport, const simLinkOptions &opts){
+    std::lock_guard<std::mutex> lock(_mtx);
+    _links[std::make_pair(srcport, dstport)] = opts;
+}
+
+void SimNetwork::addHost(const std::string &name, const std::string &address){
+    std::lock_guard<std::mutex> lock(_mtx);
+    _hosts[name] = address;
+}
+
+bool SimNetwork::resolve(const std::string &host, int port, int family, struct sockaddr_storage &addr){
+    std::string address = host;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = _hosts.find(host);
+        if(it != _hosts.end()){
+            address = it->second;
+        }
+    }
+    return Transport::resolve(address, port, family, addr);
+}
+
+uint64_t SimNetwork::now(void){
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(_realtime){
+        _now = std::max(_now, clockNow());
+    }
+    return _now;
+}
+
+uint64_t SimNetwork::clockNow(void) const{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _epoch).count();
+}
+
+double SimNetwork::uniform(void){
+    // Built on the generator's raw output: the std distributions are not
+    // specified bit for bit, and runs must replay on every standard library.
+    return (_rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+uint64_t SimNetwork::sampleDelay(const simLinkOptions &opts){
+    double delay = (double)opts.delayus;
+    double jitter = (double)opts.jitterus;
+    if(jitter > 0){
+        switch(opts.distribution){
+            case SIM_DELAY_UNIFORM:
+                delay += (2.0 * uniform() - 1.0) * jitter;
+                break;
+            case SIM_DELAY_NORMAL:
+                // Box-Muller; 1 - u keeps the logarithm finite.
+                delay += jitter * sqrt(-2.0 * log(1.0 - uniform())) * cos(2.0 * M_PI * uniform());
+                break;
+            case SIM_DELAY_PARETO:
+                // Scaled so the mean excess equals the jitter.
+                delay += jitter * (SIM_PARETO_SHAPE - 1.0) * (pow(1.0 - uniform(), -1.0 / SIM_PARETO_SHAPE) - 1.0);
+                break;
+            default:
+                break;
+        }
+    }
+    return delay > 0 ? (uint64_t)delay : 0;
+}
+
+bool SimNetwork::bind(const struct sockaddr_storage &addr, receiver rx){
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _receivers.emplace(addrKey(addr), std::make_shared<receiver>(std::move(rx))).second;
+}
+
+void SimNetwork::unbind(const struct sockaddr_storage &addr){
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _receivers.erase(addrKey(addr));
+    }
+
+    // Wait out a delivery that picked up the receiver before it was removed.
+    std::lock_guard<std::recursive_mutex> delivery(_deliverymtx);
+}
+
+bool SimNetwork::send(const struct sockaddr_storage &src, const struct sockaddr_storage &dst, const char *data, size_t len){
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(_realtime){
+        _now = std::max(_now, clockNow());
+    }
+    _stats.sent++;
+
+    std::pair<int, int> link(addrPort(src), addrPort(dst));
+    auto it = _links.find(link);
+    const simLinkOptions &opts = it != _links.end() ? it->second : _defaultlink;
+
+    if(opts.loss > 0 && uniform() < opts.loss){
+        _stats.lost++;
+        return true;
+    }
+
+    // A rate-limited link sends one datagram after the other; the delay starts once a datagram is on the wire.
+    uint64_t departure = _now;
+    if(opts.ratebps > 0){
+        uint64_t &busy = _busyuntil[link];
+        uint64_t start = std::max(busy, _now);
+        if(opts.queuebytes > 0 && (double)(start - _now) * opts.ratebps / 8e6 > (double)opts.queuebytes){
+            _stats.queuedrops++;
+            return true;
+        }
+        busy = departure = start + (uint64_t)len * 8000000ULL / opts.ratebps;
+    }
+
+    int copies = 1;
+    if(opts.duplicate > 0 && uniform() < opts.duplicate){
+        copies = 2;
+        _stats.duplicated++;
+    }
+    for(int c = 0; c < copies; c++){
+        flight f;
+        f.due = departure;
+        if(opts.reorder > 0 && uniform() < opts.reorder){
+            _stats.reordered++;
+        } else {
+            f.due += sampleDelay(opts);
+        }
+        f.seq = _seq++;
+        f.src = src;
+        f.dst = dst;
+        f.data.assign(data, len);
+        _flights.push_back(std::move(f));
+        std::push_heap(_flights.begin(), _flights.end(), later);
+    }
+    _cv.notify_one();
+    return true;
+}
+
+bool SimNetwork::deliverNext(uint64_t until){
+    std::lock_guard<std::recursive_mutex> delivery(_deliverymtx);
+    flight f;
+    std::shared_ptr<receiver> rx;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if(_flights.empty() || _flights.front().due > until){
+            return false;
+        }
+        std::pop_heap(_flights.begin(), _flights.end(), later);
+        f = std::move(_flights.back());
+        _flights.pop_back();
+
+        // Receivers see the time the datagram arrived, and reply from there.
+        _now = std::max(_now, f.due);
+        auto it = _receivers.find(addrKey(f.dst));
+        if(it == _receivers.end()){
+            _stats.unreachable++;
+            return true;
+        }
+        rx = it->second;
+        _stats.delivered++;
+    }
+    (*rx)(f.src, f.data.data(), f.data.size());
+    return true;
+}
+
+void SimNetwork::advance(uint64_t us){
+    uint64_t until;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        until = _now + us;
+    }
+    while(deliverNext(until)){
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    _now = std::max(_now, until);
+}
+
+void SimNetwork::start(void){
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(_thread.joinable()){
+        return;
+    }
+
+    // The clock carries on from the current virtual time.
+    _epoch = std::chrono::steady_clock::now() - std::chrono::microseconds(_now);
+    _realtime = true;
+    _stop = false;
+    _thread = std::thread(&SimNetwork::run, this);
+}
+
+void SimNetwork::stop(void){
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if(!_thread.joinable()){
+            return;
+        }
+        _stop = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+    std::lock_guard<std::mutex> lock(_mtx);
+    _now = std::max(_now, clockNow());
+    _realtime = false;
+}
+
+void SimNetwork::run(void){
+    std::unique_lock<std::mutex> lock(_mtx);
+    while(!_stop){
+        _now = std::max(_now, clockNow());
+        if(!_flights.empty() && _flights.front().due <= _now){
+            uint64_t until = _now;
+            lock.unlock();
+            while(deliverNext(until)){
+            }
+            lock.lock();
+            continue;
+        }
+        if(_flights.empty()){
+            _cv.wait(lock);
+        } else {
+            _cv.wait_for(lock, std::chrono::microseconds(_flights.front().due - _now));
+        }
+    }
+}
+
+size_t SimNetwork::inFlight(void){
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _flights.size();
+}
+
+simStats SimNetwork::getStats(void){
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _stats;
+}
@@ -0,0 +1,243 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+
+#include "Transport.h"
+
+// Distribution of the delay added to each datagram on a simulated link.
+enum simDelay{
+    SIM_DELAY_CONSTANT = 0, // Every datagram takes the base delay.
+    SIM_DELAY_UNIFORM,      // Base delay plus or minus up to the jitter.
+    SIM_DELAY_NORMAL,       // Base delay plus a normal deviate with the jitter as standard deviation.
+    SIM_DELAY_PARETO        // Base delay plus a heavy-tailed (Pareto) excess averaging the jitter.
+};
+
+// Impairments of a simulated link.
+struct simLinkOptions{
+    // Probability that a datagram is lost.
+    double loss = 0;
+
+    // Base one-way delay.
+    uint64_t delayus = 0;
+
+    // Spread of the delay around the base, interpreted by the distribution.
+    uint64_t jitterus = 0;
+
+    // Distribution of the delay.
+    simDelay distribution = SIM_DELAY_UNIFORM;
+
+    // Probability that a datagram skips the delay and overtakes those in flight.
+    double reorder = 0;
+
+    // Probability that a datagram is delivered twice, each copy with its own delay.
+    double duplicate = 0;
+
+    // Link rate in bits per second, 0 for unlimited.
+    uint64_t ratebps = 0;
+
+    // Bytes that may wait for a rate-limited link before datagrams are dropped, 0 for no limit.
+    size_t queuebytes = 0;
+};
+
+// Counters of a SimNetwork.
+struct simStats{
+    uint64_t sent;          // Datagrams handed to send().
+    uint64_t delivered;     // Datagrams passed to a receiver, duplicates included.
+    uint64_t lost;          // Datagrams dropped by the loss probability.
+    uint64_t queuedrops;    // Datagrams dropped because a rate-limited link's queue was full.
+    uint64_t duplicated;    // Extra copies created by the duplication probability.
+    uint64_t reordered;     // Datagrams that skipped the delay.
+    uint64_t unreachable;   // Datagrams arriving at an address nobody has bound.
+};
+
+// Deterministic in-process datagram network.
+//
+// Nodes bind addresses on the network through the Transport interface.
+// Each datagram passes through the link between the sender's and the
+// destination's ports, which may lose, delay, reorder, duplicate or
+// rate-limit it, and is then queued for delivery at its due time. Ties are
+// delivered in send order. All random decisions come from one generator
+// seeded at construction, so a single-threaded sequence of sends always
+// meets the same fate.
+//
+// Time is virtual. advance() moves it forward and delivers what falls due
+// on the calling thread, one datagram at a time, which makes a run fully
+// reproducible. start() instead lets a thread follow the steady clock and
+// deliver as datagrams fall due, for benchmarks of live nodes.
+class SimNetwork : public Transport{
+    public:
+        /**
+         * @brief Creates a network whose links are unimpaired until configured.
+         *
+         * @param seed Seed of the generator behind every random decision.
+         */
+        explicit SimNetwork(uint64_t seed = 1);
+
+        /**
+         * @brief Stops the delivery thread; datagrams still in flight are discarded.
+         */
+        ~SimNetwork();
+
+        SimNetwork(const SimNetwork &) = delete;
+        SimNetwork &operator=(const SimNetwork &) = delete;
+
+        /**
+         * @brief Sets the impairments of every link without options of its own.
+         *
+         * @param opts The impairments.
+         */
+        void setLink(const simLinkOptions &opts);
+
+        /**
+         * @brief Sets the impairments of the link from one port to another.
+         *
+         * @param srcport Port of the sender.
+         * @param dstport Port of the destination.
+         * @param opts The impairments.
+         */
+        void setLink(int srcport, int dstport, const simLinkOptions &opts);
+
+        /**
+         * @brief Gives a simulated host a name that UDPNode::tx() accepts.
+         *
+         * @param name The host name.
+         * @param address Numeric IPv4 or IPv6 address of the host.
+         */
+        void addHost(const std::string &name, const std::string &address);
+
+        /**
+         * @brief Returns the current virtual time.
+         *
+         * @return uint64_t Microseconds since the network was created.
+         */
+        uint64_t now(void);
+
+        /**
+         * @brief Moves virtual time forward, delivering every datagram that falls due on the way.
+         *
+         * Datagrams sent by the receivers with no delay are delivered in the
+         * same call. Not to be used while the delivery thread runs.
+         *
+         * @param us Microseconds to advance by; 0 delivers what is due now.
+         */
+        void advance(uint64_t us);
+
+        /**
+         * @brief Starts a thread that moves virtual time with the steady clock and delivers datagrams as they fall due.
+         */
+        void start(void);
+
+        /**
+         * @brief Stops the delivery thread; virtual time stays where it was.
+         */
+        void stop(void);
+
+        /**
+         * @brief Returns the number of datagrams waiting for delivery.
+         *
+         * @return size_t The number of datagrams in flight.
+         */
+        size_t inFlight(void);
+
+        /**
+         * @brief Returns the counters of the network.
+         *
+         * @return simStats The counters.
+         */
+        simStats getStats(void);
+
+        bool resolve(const std::string &host, int port, int family, struct sockaddr_storage &addr) override;
+        bool bind(const struct sockaddr_storage &addr, receiver rx) override;
+        void unbind(const struct sockaddr_storage &addr) override;
+        bool send(const struct sockaddr_storage &src, const struct sockaddr_storage &dst, const char *data, size_t len) override;
+
+    private:
+        // Datagram waiting for its due time.
+        struct flight{
+            uint64_t due;           // Virtual time of delivery.
+            uint64_t seq;           // Send order, breaking ties between equal due times.
+            struct sockaddr_storage src;
+            struct sockaddr_storage dst;
+            std::string data;
+        };
+
+        // Heap order putting the earliest flight first.
+        static bool later(const flight &a, const flight &b){
+            return a.due != b.due ? a.due > b.due : a.seq > b.seq;
+        }
+
+        /**
+         * @brief Returns a uniform deviate in [0, 1).
+         */
+        double uniform(void);
+
+        /**
+         * @brief Draws the delay of one datagram on a link.
+         *
+         * @param opts The link.
+         * @return uint64_t The delay in microseconds.
+         */
+        uint64_t sampleDelay(const simLinkOptions &opts);
+
+        /**
+         * @brief Delivers the earliest datagram if it is due by a given time.
+         *
+         * @param until The virtual time.
+         * @return bool False if no datagram is due.
+         */
+        bool deliverNext(uint64_t until);
+
+        /**
+         * @brief Returns the virtual time the steady clock has reached while the delivery thread runs.
+         */
+        uint64_t clockNow(void) const;
+
+        /**
+         * @brief Delivery loop of start().
+         */
+        void run(void);
+
+        std::mt19937_64 _rng;
+        std::mutex _mtx;
+        std::condition_variable _cv;
+
+        // Held for each delivery, so unbind() can wait for one in progress.
+        std::recursive_mutex _deliverymtx;
+
+        // Heap of flights, ordered by later().
+        std::vector<flight> _flights;
+        uint64_t _seq;
+
+        // Receivers by address, shared so a delivery can finish after an unbind() began.
+        std::map<std::string, std::shared_ptr<receiver>> _receivers;
+
+        // Addresses of the named hosts.
+        std::map<std::string, std::string> _hosts;
+
+        // Impairments of links without options of their own and of those with, by port pair.
+        simLinkOptions _defaultlink;
+        std::map<std::pair<int, int>, simLinkOptions> _links;
+
+        // Virtual time at which each rate-limited link finishes sending what it has been given.
+        std::map<std::pair<int, int>, uint64_t> _busyuntil;
+
+        uint64_t _now;
+        std::chrono::steady_clock::time_point _epoch;
+        bool _realtime;
+        bool _stop;
+        std::thread _thread;
+        simStats _stats;
+};
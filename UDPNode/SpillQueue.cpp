@@ -0,0 +1,125 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "SpillQueue.h"
+#include "RecordFormat.h"
+#include "UDPNode.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+SpillQueue::SpillQueue(const std::string &dir, size_t segmentsize, size_t maxbytes, size_t spares):
+    _dir(dir), _segmentsize(segmentsize), _maxbytes(maxbytes), _spares(spares), _count(0){
+}
+
+SpillQueue::~SpillQueue(){
+    for(auto &seg : _active){
+        munmap(seg.base, _segmentsize);
+        close(seg.fd);
+    }
+    for(auto &seg : _free){
+        munmap(seg.base, _segmentsize);
+        close(seg.fd);
+    }
+}
+
+bool SpillQueue::acquireSegment(segment &seg){
+    if(!_free.empty()){
+        seg = _free.back();
+        _free.pop_back();
+        seg.writeoff = 0;
+        seg.readoff = 0;
+        return true;
+    }
+
+    std::string path = _dir + "/udpnode-spill-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if(fd == -1){
+        std::cerr << "spill: " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    unlink(path.c_str());
+
+    // Reserve the blocks now so a full disk fails here rather than as SIGBUS on a page fault.
+    int rv = posix_fallocate(fd, 0, _segmentsize);
+    if(rv != 0){
+        std::cerr << "spill: posix_fallocate: " << strerror(rv) << std::endl;
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, _segmentsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED){
+        std::cerr << "spill: mmap: " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+    madvise(base, _segmentsize, MADV_SEQUENTIAL);
+    seg.fd = fd;
+    seg.base = static_cast<char *>(base);
+    seg.writeoff = 0;
+    seg.readoff = 0;
+    return true;
+}
+
+void SpillQueue::releaseSegment(segment &seg){
+    if(_free.size() < _spares){
+        _free.push_back(seg);
+        return;
+    }
+    munmap(seg.base, _segmentsize);
+    close(seg.fd);
+}
+
+bool SpillQueue::push(const rxDatagram &datagram){
+    size_t size = recordSize(datagram);
+    if(size > _segmentsize){
+        return false;
+    }
+    if(_active.empty() || _active.back().writeoff + size > _segmentsize){
+        if(_maxbytes > 0 && (_active.size() + 1) * _segmentsize > _maxbytes){
+            return false;
+        }
+        segment seg;
+        if(!acquireSegment(seg)){
+            return false;
+        }
+        _active.push_back(seg);
+    }
+    segment &seg = _active.back();
+    seg.writeoff += encodeRecord(datagram, seg.base + seg.writeoff);
+    _count++;
+    return true;
+}
+
+bool SpillQueue::pop(rxDatagram &datagram){
+    while(!_active.empty()){
+        segment &seg = _active.front();
+        if(seg.readoff < seg.writeoff){
+            size_t n = decodeRecord(seg.base + seg.readoff, seg.writeoff - seg.readoff, datagram);
+            if(n == 0){
+                // Only reachable if the mapping was corrupted; drop the rest of the segment.
+                seg.readoff = seg.writeoff;
+                continue;
+            }
+            seg.readoff += n;
+            _count--;
+
+            // A read segment no longer counts against the size limit.
+            if(seg.readoff == seg.writeoff && _active.size() > 1){
+                releaseSegment(seg);
+                _active.pop_front();
+            }
+            return true;
+        }
+        if(_active.size() == 1){
+            // The only segment is drained; start it over instead of switching files.
+            seg.writeoff = 0;
+            seg.readoff = 0;
+            return false;
+        }
+        releaseSegment(seg);
+        _active.pop_front();
+    }
+    return false;
+}
@@ -0,0 +1,99 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+
+struct rxDatagram;
+
+// First-in first-out queue of datagrams kept in memory-mapped segment files.
+//
+// Datagrams are appended as RecordFormat records to the newest segment and
+// read back from the oldest, so order is preserved. Segments are fixed-size
+// files preallocated in a directory and unlinked as soon as they are mapped,
+// so nothing is left behind after a crash. A segment that has been read
+// completely is kept as a spare and reused instead of creating a new file.
+// Not thread-safe; callers lock.
+class SpillQueue{
+    public:
+        /**
+         * @brief Constructs an empty spill queue; segments are created on demand.
+         *
+         * @param dir Directory holding the segment files.
+         * @param segmentsize Size of each segment file in bytes.
+         * @param maxbytes Maximum size of all segments in use, 0 for no limit.
+         * @param spares Number of read segments kept for reuse.
+         */
+        SpillQueue(const std::string &dir, size_t segmentsize, size_t maxbytes, size_t spares = 2);
+
+        ~SpillQueue();
+
+        SpillQueue(const SpillQueue &) = delete;
+        SpillQueue &operator=(const SpillQueue &) = delete;
+
+        /**
+         * @brief Appends a datagram.
+         *
+         * @param datagram The datagram.
+         * @return bool False if the datagram is larger than a segment, the size limit is reached or a segment cannot be created.
+         */
+        bool push(const rxDatagram &datagram);
+
+        /**
+         * @brief Removes the oldest datagram.
+         *
+         * @param datagram Receives the datagram.
+         * @return bool False if the queue is empty.
+         */
+        bool pop(rxDatagram &datagram);
+
+        /**
+         * @brief Returns the number of datagrams in the queue.
+         *
+         * @return size_t The number of datagrams.
+         */
+        size_t size(void) const{
+            return _count;
+        }
+
+        /**
+         * @brief Checks whether the queue is empty.
+         *
+         * @return bool True if no datagram is queued.
+         */
+        bool empty(void) const{
+            return _count == 0;
+        }
+
+    private:
+        // Structure describing one mapped segment file.
+        struct segment{
+            int fd;
+            char *base;
+            size_t writeoff;    // End of the records written so far.
+            size_t readoff;     // Start of the oldest unread record.
+        };
+
+        // Takes a spare segment or creates a new one.
+        bool acquireSegment(segment &seg);
+
+        // Returns a read segment to the spares, or unmaps it if there are enough.
+        void releaseSegment(segment &seg);
+
+        std::string _dir;
+        size_t _segmentsize;
+        size_t _maxbytes;
+        size_t _spares;
+        size_t _count;
+
+        // Segments holding records, oldest first; the last one is written to.
+        std::deque<segment> _active;
+
+        // Read segments kept for reuse.
+        std::vector<segment> _free;
+};
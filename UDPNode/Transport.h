@@ -0,0 +1,79 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <functional>
+
+// Datagram network a UDPNode can use instead of kernel sockets.
+//
+// A node set up with nodeOptions::transport binds its address on the
+// transport instead of opening a socket, sends its encoded datagrams with
+// send() and receives through the callback given to bind(). Addresses are
+// IPv4 or IPv6 socket addresses; the transport decides what reaches whom,
+// and how host names given to UDPNode::tx() map to addresses.
+class Transport{
+    public:
+        // Called with the sender address and the encoded datagram for each delivery.
+        typedef std::function<void(const struct sockaddr_storage &src, const char *data, size_t len)> receiver;
+
+        virtual ~Transport(){}
+
+        /**
+         * @brief Registers the receiver of the datagrams sent to an address.
+         *
+         * @param addr The address, including the port.
+         * @param rx Called for each datagram delivered to the address, possibly on another thread.
+         * @return bool False if the address is already bound.
+         */
+        virtual bool bind(const struct sockaddr_storage &addr, receiver rx) = 0;
+
+        /**
+         * @brief Removes the receiver of an address; returns once no delivery to it is in progress.
+         *
+         * @param addr The bound address.
+         */
+        virtual void unbind(const struct sockaddr_storage &addr) = 0;
+
+        /**
+         * @brief Maps a destination host to an address on the transport; called by UDPNode::tx() instead of getaddrinfo().
+         *
+         * The default accepts numeric addresses and "localhost".
+         *
+         * @param host The host name or numeric address.
+         * @param port The destination port.
+         * @param family AF_INET or AF_INET6.
+         * @param addr Receives the address.
+         * @return bool False if the host is unknown.
+         */
+        virtual bool resolve(const std::string &host, int port, int family, struct sockaddr_storage &addr){
+            memset(&addr, 0, sizeof addr);
+            addr.ss_family = family;
+            const char *text = host == "localhost" ? (family == AF_INET ? "127.0.0.1" : "::1") : host.c_str();
+            if(family == AF_INET){
+                struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+                sin->sin_port = htons(port);
+                return inet_pton(AF_INET, text, &sin->sin_addr) == 1;
+            }
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+            sin6->sin6_port = htons(port);
+            return family == AF_INET6 && inet_pton(AF_INET6, text, &sin6->sin6_addr) == 1;
+        }
+
+        /**
+         * @brief Sends a datagram.
+         *
+         * @param src Address of the sender, seen by the receiver.
+         * @param dst Destination address.
+         * @param data The encoded datagram.
+         * @param len Length of the datagram.
+         * @return bool False if the datagram could not be sent; loss on the way is not reported.
+         */
+        virtual bool send(const struct sockaddr_storage &src, const struct sockaddr_storage &dst, const char *data, size_t len) = 0;
+};
@@ -4,221 +4,2964 @@
 
 #include "UDPNode.h"
 
-UDPNode::UDPNode(int lport, ipFamily ver, unsigned int maxmsgsize, unsigned int maxqsize, bool debug):_listenport(lport), _listenipver(ver), _maxqueuesize(maxqsize), _maxmessagesize(maxmsgsize), _debug(debug){
+// Space reserved for the ancillary data of one received datagram.
+static const size_t RX_CONTROL_LEN = CMSG_SPACE(sizeof(struct in_pktinfo)) + CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct timespec));
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#ifndef SO_DETACH_REUSEPORT_BPF
+#define SO_DETACH_REUSEPORT_BPF 68
+#endif
+
+// First message of a socket handoff; the sockets travel as SCM_RIGHTS in the same order.
+static const uint32_t HANDOFF_MAGIC = 0x55444e48;     // "HNDU"
+static const size_t HANDOFF_MAX_SOCKETS = 64;
+
+// Sent by the new node once connected, so a connection probe is never mistaken for it.
+static const uint32_t HANDOFF_HELLO = 0x55444e41;     // "ANDU"
+struct handoffHeader{
+    uint32_t magic;
+    uint32_t count;
+    int32_t fds[HANDOFF_MAX_SOCKETS];           // Descriptors in the sending process, for remapping rxsockfd.
+    uint32_t kerneldrops[HANDOFF_MAX_SOCKETS];  // Last SO_RXQ_OVFL count seen on each socket.
+};
+
+// Offenders whose counts topRateLimitedSources() keeps after a sweep drops their buckets.
+static const size_t RATE_OFFENDERS = 64;
+
+// Shared-memory peers of a listening socket connect to a Unix socket in
+// nodeOptions::shmdir named after the socket's family, bound address and port.
+static const char SHM_SOCKET_PREFIX[] = "udpnode-shm-";
+static const uint32_t SHM_HELLO_MAGIC = 0x55444e53;    // "SNDU"
+
+// Time an accepted peer has to send its hello.
+static const int SHM_HELLO_TIMEOUT_MS = 1000;
+
+// Rendezvous path of the listening socket bound to an address, e.g. <dir>/udpnode-shm-4-127.0.0.1-5000.
+static std::string shmSocketPath(const std::string &dir, const struct sockaddr *addr){
+    char s[INET6_ADDRSTRLEN] = "";
+    int port;
+    if(addr->sa_family == AF_INET){
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+        inet_ntop(AF_INET, &sin->sin_addr, s, sizeof s);
+        port = ntohs(sin->sin_port);
+    } else {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+        inet_ntop(AF_INET6, &sin6->sin6_addr, s, sizeof s);
+        port = ntohs(sin6->sin6_port);
+    }
+    return dir + "/" + SHM_SOCKET_PREFIX + (addr->sa_family == AF_INET ? "4-" : "6-") + s + "-" + std::to_string(port);
+}
+
+// Directory only this user can create sockets in, for rendezvous names nobody else can take.
+static std::string privateShmDir(void){
+    const char *xdg = getenv("XDG_RUNTIME_DIR");
+    std::string dir = xdg != NULL && xdg[0] == '/' ? xdg : "/tmp/udpnode-" + std::to_string(geteuid());
+    if(mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST){
+        std::cerr << "shm: " << dir << ": " << strerror(errno) << std::endl;
+        return "";
+    }
+    struct stat st;
+    if(lstat(dir.c_str(), &st) == -1 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0){
+        std::cerr << "shm: " << dir << ": not a private directory of this user" << std::endl;
+        return "";
+    }
+    return dir;
+}
+
+// Checks that the process at the other end of a Unix socket runs as this user.
+static bool peerIsSelf(int fd){
+    struct ucred cred;
+    socklen_t len = sizeof cred;
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+}
+
+// Sets the binary local address of a datagram from an in_addr or in6_addr.
+static void setDstAddr(rxDatagram &datagram, int family, const void *addr){
+    memset(&datagram.dstaddr, 0, sizeof datagram.dstaddr);
+    datagram.dstaddr.ss_family = family;
+    if(family == AF_INET){
+        memcpy(&((struct sockaddr_in *)&datagram.dstaddr)->sin_addr, addr, sizeof(struct in_addr));
+    } else {
+        memcpy(&((struct sockaddr_in6 *)&datagram.dstaddr)->sin6_addr, addr, sizeof(struct in6_addr));
+    }
+}
+
+// The wildcard address of a family with a given port.
+static struct sockaddr_storage anyAddr(int family, int port){
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof addr);
+    addr.ss_family = family;
+    if(family == AF_INET){
+        ((struct sockaddr_in *)&addr)->sin_port = htons(port);
+    } else {
+        ((struct sockaddr_in6 *)&addr)->sin6_port = htons(port);
+        ((struct sockaddr_in6 *)&addr)->sin6_addr = in6addr_any;
+    }
+    return addr;
+}
+
+// Checks whether a bound address is a wildcard.
+static bool isAnyAddr(const struct sockaddr_storage &addr){
+    if(addr.ss_family == AF_INET){
+        return ((const struct sockaddr_in *)&addr)->sin_addr.s_addr == htonl(INADDR_ANY);
+    }
+    return addr.ss_family == AF_INET6 && IN6_IS_ADDR_UNSPECIFIED(&((const struct sockaddr_in6 *)&addr)->sin6_addr);
+}
+
+// Listening sockets of the nodes of this process that accept loopback
+// deliveries, by port, with the address each is bound to. Senders deliver under the shared lock, so a node
+// unregistering under the exclusive lock waits for them.
+struct loopbackEntry{
+    UDPNode *node;
+    struct sockaddr_storage addr;   // Bound address of the socket.
+    int fd;             // The socket, which replies are sent from.
+    bool dualstack;     // An IPv6 socket that also takes IPv4.
+};
+
+// How a socket bound to an address takes a destination of the same port:
+// 2 for the bound address itself, 1 through a wildcard, 0 not at all.
+static int loopbackMatch(const loopbackEntry &e, const struct sockaddr *dst){
+    if(dst->sa_family == AF_INET && e.addr.ss_family == AF_INET){
+        if(isAnyAddr(e.addr)){
+            return 1;
+        }
+        return ((const struct sockaddr_in *)&e.addr)->sin_addr.s_addr == ((const struct sockaddr_in *)dst)->sin_addr.s_addr ? 2 : 0;
+    }
+    if(e.addr.ss_family != AF_INET6){
+        return 0;
+    }
+    const struct in6_addr &bound = ((const struct sockaddr_in6 *)&e.addr)->sin6_addr;
+    if(dst->sa_family == AF_INET6){
+        if(isAnyAddr(e.addr)){
+            return 1;
+        }
+        return memcmp(&bound, &((const struct sockaddr_in6 *)dst)->sin6_addr, sizeof bound) == 0 ? 2 : 0;
+    }
+    if(dst->sa_family != AF_INET || !e.dualstack){
+        return 0;
+    }
+    if(isAnyAddr(e.addr)){
+        return 1;
+    }
+    return IN6_IS_ADDR_V4MAPPED(&bound) && memcmp(bound.s6_addr + 12, &((const struct sockaddr_in *)dst)->sin_addr, 4) == 0 ? 2 : 0;
+}
+static std::shared_mutex loopbackmtx;
+static std::unordered_multimap<int, loopbackEntry> loopbacknodes;
+
+// Text form of a Unix socket address whose unused bytes are zero: the path,
+// '@' and the name for the abstract namespace, empty for an unnamed socket.
+static std::string unixPath(const struct sockaddr_storage &addr){
+    const struct sockaddr_un *sun = (const struct sockaddr_un *)&addr;
+    if(sun->sun_path[0] == '\0'){
+        size_t n = strnlen(sun->sun_path + 1, sizeof sun->sun_path - 1);
+        return n > 0 ? "@" + std::string(sun->sun_path + 1, n) : std::string();
+    }
+    return std::string(sun->sun_path, strnlen(sun->sun_path, sizeof sun->sun_path));
+}
+
+// Writes or reads a whole buffer on a stream socket.
+static bool writeAll(int fd, const void *data, size_t len){
+    const char *p = static_cast<const char *>(data);
+    while(len > 0){
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n == -1 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t len){
+    char *p = static_cast<char *>(data);
+    while(len > 0){
+        ssize_t n = recv(fd, p, len, 0);
+        if(n == -1 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+UDPNode::UDPNode(int lport, ipFamily ver, unsigned int maxmsgsize, unsigned int maxqsize, bool debug, const nodeOptions &opts):_listenport(lport), _listenipver(ver), _maxqueuesize(maxqsize), _maxmessagesize(maxmsgsize), _debug(debug), _options(opts){
    // Initialize the atomic flag to false.
     _stoprecvthread = false;
-    auto rv = createSocketAndBind();
+    _wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    _shmnotifyfd = -1;
+    if(_options.shmtransport && _options.shmdir.empty()){
+        _options.shmdir = privateShmDir();
+        _options.shmtransport = !_options.shmdir.empty();
+    }
+    if(_options.shmtransport){
+        // Watched before any lookup fails, so no listener appearing afterwards is missed.
+        _shmnotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(_shmnotifyfd != -1 && inotify_add_watch(_shmnotifyfd, _options.shmdir.c_str(), IN_CREATE | IN_MOVED_TO) == -1){
+            std::cerr << "shm: cannot watch " << _options.shmdir << ": " << strerror(errno) << std::endl;
+            close(_shmnotifyfd);
+            _shmnotifyfd = -1;
+        }
+    }
+    _shmreceived = 0;
+    _loopbackreceived = 0;
+    if(_options.shmtransport || _options.loopbackshortcut){
+        // Datagrams to these addresses can be delivered over shared memory.
+        struct ifaddrs *ifas;
+        if(getifaddrs(&ifas) == 0){
+            for(struct ifaddrs *ifa = ifas; ifa != NULL; ifa = ifa->ifa_next){
+                if(ifa->ifa_addr != NULL && (ifa->ifa_addr->sa_family == AF_INET || ifa->ifa_addr->sa_family == AF_INET6)){
+                    struct sockaddr_storage ss;
+                    memset(&ss, 0, sizeof ss);
+                    memcpy(&ss, ifa->ifa_addr, ifa->ifa_addr->sa_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+                    _localaddrs.push_back(ss);
+                }
+            }
+            freeifaddrs(ifas);
+        }
+    }
+    _listensockfd = -1;
+    _transportbound = false;
+    _received = 0;
+    _queued = 0;
+    _parsedrops = 0;
+    _crcdrops = 0;
+    _queuefulldrops = 0;
+    _kerneldrops = 0;
+    _pipelinedrops = 0;
+    _ratelimitdrops = 0;
+    _filtering = false;
+    _filterpassed = 0;
+    _filterdrops = 0;
+    _ratecustomsources = 0;
+    _rateused = 0;
+    _ratesweep = 0;
+    _ratelimiting = _options.sourcerate > 0;
+    _stopworkers = false;
+    _nextworker = 0;
+    _nextpartition = 0;
+    _conflated = 0;
+    _spilled = 0;
+    if(!_options.journaldir.empty()){
+        _journal.reset(new JournalWriter(_options.journaldir, _options.journalprefix, _options.journalfilesize, _options.journalbuffersize, _options.journalflushms));
+    }
+    if(_options.rxqueuemode == RXQ_FIFO && !_options.spilldir.empty()){
+        _spill.reset(new SpillQueue(_options.spilldir, _options.spillsegmentsize, _options.spillmaxbytes));
+    }
+    _expireddrops = 0;
+    _deadlines = false;
+    // The receive thread writes the queues, so they are first touched on its NUMA node.
+    runOnCpus(_options.rxcpus, [this]{ allocateRxQueues(); });
+    // A restarted node takes over the sockets of the node it replaces instead of binding.
+    err_code rv = HANDOFF_FAILED;
+    if(_options.transport){
+        rv = bindTransport();
+    } else if(!_options.handoffpath.empty()){
+        rv = adoptListenSockets();
+        if(rv != SUCCESS){
+            std::cerr << errorMsg(rv) << ", binding instead" << std::endl;
+        }
+    }
+    if(rv != SUCCESS && !_options.transport){
+        rv = createSocketAndBind();
+    }
     if (rv != SUCCESS) {
        std::cerr << errorMsg(rv) << std::endl;
        exit(1);
     }
 }
 
-err_code UDPNode::createSocketAndBind(void){
+err_code UDPNode::createSocketAndBind(void){
+
+    err_code error_code = SUCCESS; // Initialize error code to success.
+
+    // Bind the primary listening socket on the wildcard address; a unixdgram node only has its Unix socket.
+    if(_listenipver != unixdgram){
+        error_code = bindListenSockets(NULL, _listenport, _listenipver == ipv4 ? AF_INET: AF_INET6);
+        if(error_code != SUCCESS){
+            return error_code;
+        }
+        std::cout << "listening on port: "<< _listenport << "..."<<std::endl;
+    }
+
+    // A Unix datagram socket is served by the same receive loop.
+    if(!_options.unixpath.empty()){
+        error_code = bindUnixSocket(_options.unixpath);
+        if(error_code != SUCCESS){
+            return error_code;
+        }
+        std::cout << "listening on unix socket: "<< _options.unixpath << "..."<<std::endl;
+    }
+    if(_listensockets.empty()){
+        return BIND_FAILED;
+    }
+    _listensockfd = _listensockets.front().fd;
+
+    // Bind the additional addresses and ports, all served by the same receive loop.
+    for(const auto &ba : _options.bindaddrs){
+        int port = ba.port != 0 ? ba.port : _listenport;
+        // A wildcard is one dual-stack IPv6 socket with dualstack, else one IPv6-only socket per family.
+        int family = ba.host.empty() && _options.dualstack ? AF_INET6 : AF_UNSPEC;
+        error_code = bindListenSockets(ba.host.empty() ? NULL : ba.host.c_str(), port, family);
+        if(error_code != SUCCESS){
+            return error_code;
+        }
+        std::cout << "listening on " << (ba.host.empty() ? "*" : ba.host) << " port: "<< port << "..."<<std::endl;
+    }
+
+    // Join the configured multicast groups.
+    for(const auto &g : _options.mcastgroups){
+        error_code = setMulticastMembership(g.group, g.iface, true);
+        if(error_code != SUCCESS){
+            return error_code;
+        }
+    }
+
+    // The listening socket may also be used for sending (see txfromlistensocket).
+    if(_listenipver != unixdgram){
+        error_code = applyMulticastTxOptions(_listensockfd, _listenipver);
+    }
+    
+    return error_code;
+}
+
+err_code UDPNode::bindListenSockets(const char *host, int port, int family){
+
+    struct addrinfo hints;  // Hints for getaddrinfo.
+    int rv;                 // Return value for getaddrinfo.
+    struct addrinfo *rxservinfo;  // Linked list of results from getaddrinfo.
+    struct addrinfo  *rx_p;       // Pointer to iterate over results.
+    err_code error_code = SUCCESS; // Initialize error code to success.
+    int sockfd;
+    
+     // Zero out the hints structure.
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE; // use my IP
+
+       // Get address info for the local machine.
+    if ((rv = getaddrinfo(host, std::to_string(port).c_str(), &hints, &rxservinfo)) != 0) {
+        std::cerr << "getaddrinfo: " << gai_strerror(rv) << std::endl;
+        return GETADDRINFO_FAILED;
+    }
+
+    // loop through all the results and bind to every one we can
+    for(rx_p = rxservinfo; rx_p != NULL; rx_p = rx_p->ai_next) {
+        if ((sockfd = socket(rx_p->ai_family, rx_p->ai_socktype,rx_p->ai_protocol)) == -1) {
+            if(error_code == SUCCESS){
+                error_code = SOCKET_CONN_FAILED;
+            }
+            continue;
+        }
+
+        configureListenSocket(sockfd, rx_p->ai_family);
+
+        if (bind(sockfd, rx_p->ai_addr, rx_p->ai_addrlen) == -1) {
+            char s[INET6_ADDRSTRLEN] = "";
+            inet_ntop(rx_p->ai_family, getInAddr(rx_p->ai_addr), s, sizeof s);
+            std::cerr << "bind " << s << " port " << port << ": " << strerror(errno) << std::endl;
+            close(sockfd);
+            if(error_code == SUCCESS){
+                error_code = BIND_FAILED;
+            }
+            continue;
+        }
+
+        listenSocket ls;
+        ls.fd = sockfd;
+        ls.family = rx_p->ai_family;
+        ls.port = port;
+        ls.kerneldrops = 0;
+        socklen_t addrlen = sizeof ls.addr;
+        if(getsockname(sockfd, (struct sockaddr *)&ls.addr, &addrlen) == -1){
+            memset(&ls.addr, 0, sizeof ls.addr);
+            memcpy(&ls.addr, rx_p->ai_addr, rx_p->ai_addrlen);
+        }
+        _listensockets.push_back(ls);
+    }
+    
+    // Free the linked list.
+    freeaddrinfo(rxservinfo);
+    rxservinfo = nullptr;
+
+    // Every address must be bound; a family missing from a wildcard would go unnoticed otherwise.
+    return error_code;
+}
+
+err_code UDPNode::bindUnixSocket(const std::string &path){
+    struct sockaddr_un addr;
+    socklen_t addrlen = unixAddress(path, addr);
+    if(addrlen == 0){
+        std::cerr << "unix socket path is empty or too long: " << path << std::endl;
+        return BIND_FAILED;
+    }
+    int sockfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if(sockfd == -1){
+        return SOCKET_CONN_FAILED;
+    }
+    configureListenSocket(sockfd, AF_UNIX);
+
+    // A socket file left behind by a previous run would make bind() fail.
+    if(!removeStaleSocket(path, SOCK_DGRAM)){
+        close(sockfd);
+        return BIND_FAILED;
+    }
+    if(bind(sockfd, (struct sockaddr *)&addr, addrlen) == -1){
+        std::cerr << "bind " << path << ": " << strerror(errno) << std::endl;
+        close(sockfd);
+        return BIND_FAILED;
+    }
+    if(path[0] != '@'){
+        _unixpath = path;
+    }
+
+    listenSocket ls;
+    ls.fd = sockfd;
+    ls.family = AF_UNIX;
+    ls.port = 0;
+    ls.kerneldrops = 0;
+    memset(&ls.addr, 0, sizeof ls.addr);
+    ls.addr.ss_family = AF_UNIX;
+    _listensockets.push_back(ls);
+    return SUCCESS;
+}
+
+err_code UDPNode::bindTransport(void){
+    int family = _listenipver == ipv4 ? AF_INET : AF_INET6;
+    if(_listenipver == unixdgram || _listenport <= 0){
+        std::cerr << "transport: nodes on a transport need an IP family and a port" << std::endl;
+        return BIND_FAILED;
+    }
+    std::string host = _options.transportaddr;
+    if(host.empty()){
+        host = family == AF_INET ? "127.0.0.1" : "::1";
+    }
+
+    memset(&_transportaddr, 0, sizeof _transportaddr);
+    _transportaddr.ss_family = family;
+    void *addr;
+    if(family == AF_INET){
+        struct sockaddr_in *sin = (struct sockaddr_in *)&_transportaddr;
+        sin->sin_port = htons(_listenport);
+        addr = &sin->sin_addr;
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&_transportaddr;
+        sin6->sin6_port = htons(_listenport);
+        addr = &sin6->sin6_addr;
+    }
+    if(inet_pton(family, host.c_str(), addr) != 1){
+        std::cerr << "transport: invalid address " << host << std::endl;
+        return BIND_FAILED;
+    }
+    if(!_options.transport->bind(_transportaddr, [this](const struct sockaddr_storage &src, const char *data, size_t len){
+        receiveFromTransport(src, data, len);
+    })){
+        std::cerr << "transport: " << host << ":" << _listenport << " is already bound" << std::endl;
+        return BIND_FAILED;
+    }
+    _transportbound = true;
+    return SUCCESS;
+}
+
+void UDPNode::receiveFromTransport(const struct sockaddr_storage &src, const char *data, size_t len){
+    _received.fetch_add(1, std::memory_order_relaxed);
+    if(_ratelimiting.load(std::memory_order_relaxed)){
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        if(!admitSource(src, now)){
+            _ratelimitdrops.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    // Longer datagrams are truncated to the receive buffer, as a socket would.
+    thread_local std::vector<char> buf;
+    size_t n = std::min(len, (size_t)_maxmessagesize - 1);
+    buf.resize(n + 1);
+    memcpy(buf.data(), data, n);
+
+    rxDatagram datagram;
+    datagram.srcaddr = src;
+    datagram.srcaddrlen = src.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    datagram.dstport = _listenport;
+    datagram.ifindex = 0;
+    datagram.rxsockfd = -1;
+    char ipstr[INET6_ADDRSTRLEN];
+    const void *dst = _transportaddr.ss_family == AF_INET ? (const void *)&((struct sockaddr_in *)&_transportaddr)->sin_addr : (const void *)&((struct sockaddr_in6 *)&_transportaddr)->sin6_addr;
+    if(inet_ntop(_transportaddr.ss_family, dst, ipstr, sizeof ipstr) != NULL){
+        datagram.dstipaddr = ipstr;
+    }
+    setDstAddr(datagram, _transportaddr.ss_family, dst);
+    if(_options.rxttlms > 0){
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        datagram.arrivalns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    processRxDatagram(buf.data(), n, datagram);
+}
+
+void UDPNode::configureListenSocket(int sockfd, int family){
+    int yes = 1;
+
+    // Let several subscribers on this host share the port of a multicast feed.
+    if(!_options.mcastgroups.empty()){
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+    }
+
+    // Shard a port across nodes; the kernel favours the shard whose
+    // SO_INCOMING_CPU matches the CPU handling the packet.
+    if(_options.reuseport){
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes);
+    }
+    if(_options.incomingcpu >= 0){
+        setsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &_options.incomingcpu, sizeof _options.incomingcpu);
+    }
+
+    // Report the local address each datagram arrived on. A dual-stack IPv6
+    // socket also needs IP_PKTINFO for its IPv4-mapped traffic.
+    // IPV6_V6ONLY is always set explicitly: the in-process matching of shmtransport and
+    // loopbackshortcut assumes a socket without dualstack takes no IPv4, whatever bindv6only says.
+    if(family == AF_INET6){
+        int v6only = _options.dualstack ? 0 : 1;
+        setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof v6only);
+        setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &yes, sizeof yes);
+    }
+    if(family != AF_UNIX){
+        setsockopt(sockfd, IPPROTO_IP, IP_PKTINFO, &yes, sizeof yes);
+    }
+
+    // Have each receive report the cumulative number of datagrams the kernel dropped.
+    setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof yes);
+
+    // Have each receive report its kernel arrival time, from which the receive TTL is measured.
+    if(_options.rxttlms > 0){
+        setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof yes);
+    }
+
+    // Let the kernel poll the device queue from recvmmsg() instead of waiting for an interrupt.
+    if(_options.busypollus > 0){
+        if(setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &_options.busypollus, sizeof _options.busypollus) == -1 && _debug){
+            std::cerr << "SO_BUSY_POLL: " << strerror(errno) << std::endl;
+        }
+        if(_options.preferbusypoll){
+            setsockopt(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &yes, sizeof yes);
+            if(_options.busypollbudget > 0){
+                setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &_options.busypollbudget, sizeof _options.busypollbudget);
+            }
+        }
+    }
+
+    if(_options.rcvbuf > 0){
+        setSocketBufferSize(sockfd, SO_RCVBUF, _options.rcvbuf);
+    }
+    if(_options.sndbuf > 0){
+        setSocketBufferSize(sockfd, SO_SNDBUF, _options.sndbuf);
+    }
+}
+
+err_code UDPNode::setSocketBufferSize(int sockfd, int optname, int size){
+    // The FORCE variants ignore rmem_max/wmem_max but need CAP_NET_ADMIN.
+    if(_options.forcebuffers){
+        int forceopt = optname == SO_RCVBUF ? SO_RCVBUFFORCE : SO_SNDBUFFORCE;
+        if(setsockopt(sockfd, SOL_SOCKET, forceopt, &size, sizeof size) == 0){
+            return SUCCESS;
+        }
+    }
+    if(setsockopt(sockfd, SOL_SOCKET, optname, &size, sizeof size) == -1){
+        std::cerr << "setsockopt: " << strerror(errno) << std::endl;
+        return SETSOCKOPT_FAILED;
+    }
+    return SUCCESS;
+}
+
+void UDPNode::growRxBuffer(size_t sockidx){
+    int cur = 0;
+    socklen_t len = sizeof cur;
+    if(getsockopt(_listensockets[sockidx].fd, SOL_SOCKET, SO_RCVBUF, &cur, &len) == -1){
+        return;
+    }
+    // The kernel reports twice the requested size to account for bookkeeping.
+    int requested = cur / 2;
+    if(requested >= _options.rcvbufmax){
+        return;
+    }
+    int grown = std::min(requested * 2, _options.rcvbufmax);
+    if(setSocketBufferSize(_listensockets[sockidx].fd, SO_RCVBUF, grown) == SUCCESS && _debug){
+        std::cout << "rxloop: kernel drops observed, receive buffer grown to " << grown << " bytes" << std::endl;
+    }
+}
+
+void UDPNode::closeListenSockets(void){
+    for(auto &ls : _listensockets){
+        if(ls.fd != -1){
+            close(ls.fd);
+            ls.fd = -1;
+        }
+    }
+    _listensockets.clear();
+    _listensockfd = -1;
+    if(_transportbound){
+        _options.transport->unbind(_transportaddr);
+        _transportbound = false;
+    }
+    if(!_unixpath.empty()){
+        unlink(_unixpath.c_str());
+        _unixpath.clear();
+    }
+}
+
+UDPNode::~UDPNode(void){
+
+    endRxLoop(); // Ensure the receive loop is stopped
+    if(_rxthread.joinable()){
+        _rxthread.join();
+    }
+    std::cout << "closing listening socket and exiting..." << std::endl;
+    
+    // Close the listening sockets.
+    closeListenSockets();
+    if(_wakefd != -1){
+        close(_wakefd);
+        _wakefd = -1;
+    }
+    if(_shmnotifyfd != -1){
+        close(_shmnotifyfd);
+        _shmnotifyfd = -1;
+    }
+
+    // Closing the handshake connections tells the peers this node is gone.
+    _shmpeers.clear();
+}
+
+void UDPNode::allocateRxQueues(void){
+    if(_options.rxqueuemode == RXQ_PRIORITY){
+        for(unsigned int l = 0; l < std::max(1u, _options.prioritylanes); l++){
+            size_t cap = l < _options.lanecapacity.size() ? _options.lanecapacity[l] : _maxqueuesize;
+            cap = std::max<size_t>(1, cap);
+            std::unique_ptr<priorityLane> lane(new priorityLane(cap));
+            lane->capacity = cap;
+            lane->policy = l < _options.lanedroppolicy.size() ? _options.lanedroppolicy[l] : DROP_NEWEST;
+            lane->enqueued = 0;
+            lane->drops = 0;
+            _lanes.push_back(std::move(lane));
+        }
+    }
+    if(_options.rxqueuemode == RXQ_CONFLATED){
+        size_t keys = _options.conflationkeys > 0 ? _options.conflationkeys : _maxqueuesize;
+        _conflation.reset(new ConflationTable<conflatedHeader>(std::max<size_t>(1, keys), _maxmessagesize));
+    }
+    if(_options.rxqueuemode == RXQ_FAIR){
+        size_t sourcecap = _options.fairsourcecap > 0 ? _options.fairsourcecap : _maxqueuesize;
+        size_t quantum = _options.fairquantum > 0 ? _options.fairquantum : _maxmessagesize;
+        _fairqueue.reset(new FairQueue<rxDatagram>(_maxqueuesize, sourcecap, quantum));
+    }
+    if(_options.rxqueuemode == RXQ_PARTITIONED){
+        for(unsigned int p = 0; p < std::max(1u, _options.partitions); p++){
+            _partitions.push_back(std::unique_ptr<rxPartition>(new rxPartition));
+        }
+    }
+}
+
+void UDPNode::runOnCpus(const std::vector<int> &cpus, const std::function<void()> &fn){
+    if(cpus.empty()){
+        fn();
+        return;
+    }
+    std::thread t([&]{
+        err_code pin_code = pinCurrentThread(cpus);
+        if(pin_code != SUCCESS){
+            std::cerr << "rxqueues: " << errorMsg(pin_code) << std::endl;
+        }
+        fn();
+    });
+    t.join();
+}
+
+void UDPNode::startRxLoop(void){
+    // A transport delivers on its own thread, and there are no sockets to read.
+    if(_options.transport){
+        return;
+    }
+
+     // Start the parse workers, then the receive loop in a separate thread.
+    _stoprecvthread = false;
+    startParseWorkers();
+    _rxthread = std::thread(&UDPNode::rxLoop, this);
+    if(_options.shmtransport){
+        startShmTransport();
+    }
+    if(_options.loopbackshortcut){
+        registerLoopback(true);
+    }
+}
+
+void UDPNode::endRxLoop(void){
+    stopRxLoop();
+    closeShmTransport();
+    closeListenSockets();
+}
+
+void UDPNode::stopRxLoop(void){
+    // From here on datagrams for this node wait in its sockets, to be read or handed over.
+    if(_options.loopbackshortcut){
+        registerLoopback(false);
+    }
+    if(_rxthread.joinable()){
+        // Set the atomic flag to true to stop the receive loop, and wake it if it is blocked in poll().
+        _stoprecvthread = true;
+        uint64_t one = 1;
+        if(write(_wakefd, &one, sizeof one) == -1 && _debug){
+            std::cerr << "rxloop: eventfd write: " << strerror(errno) << std::endl;
+        }
+        _rxthread.join();
+        if(_shmthread.joinable()){
+            _shmthread.join();
+        }
+
+        // Reset the eventfd so a restarted loop does not wake at once.
+        uint64_t count;
+        while(read(_wakefd, &count, sizeof count) > 0){
+        }
+    }
+    stopParseWorkers();
+}
+
+socklen_t UDPNode::unixAddress(const std::string &path, struct sockaddr_un &addr){
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof addr.sun_path){
+        return 0;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+
+    // An abstract name has no file to clean up; its length, not a terminator, ends it.
+    if(path[0] == '@'){
+        addr.sun_path[0] = '\0';
+        return offsetof(struct sockaddr_un, sun_path) + path.size();
+    }
+    return offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+}
+
+bool UDPNode::removeStaleSocket(const std::string &path, int type){
+    if(path.empty() || path[0] == '@'){
+        return true;
+    }
+    struct stat st;
+    if(lstat(path.c_str(), &st) == -1){
+        return errno == ENOENT;
+    }
+    if(!S_ISSOCK(st.st_mode)){
+        std::cerr << path << ": exists and is not a socket" << std::endl;
+        return false;
+    }
+
+    // A socket file nobody has bound refuses connections.
+    struct sockaddr_un addr;
+    socklen_t addrlen = unixAddress(path, addr);
+    int probe = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    bool live = probe != -1 && connect(probe, (struct sockaddr *)&addr, addrlen) == 0;
+    if(probe != -1){
+        close(probe);
+    }
+    if(live){
+        std::cerr << path << ": in use by another process" << std::endl;
+        return false;
+    }
+    return unlink(path.c_str()) == 0 || errno == ENOENT;
+}
+
+err_code UDPNode::handoff(const std::string &path, unsigned int timeoutms){
+    struct sockaddr_un addr;
+    socklen_t addrlen = unixAddress(path, addr);
+    if(addrlen == 0 || _listensockets.empty() || _listensockets.size() > HANDOFF_MAX_SOCKETS){
+        return HANDOFF_FAILED;
+    }
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(lfd == -1){
+        std::cerr << "handoff: socket: " << strerror(errno) << std::endl;
+        return HANDOFF_FAILED;
+    }
+    // Another handoff in progress on the path keeps it.
+    if(!removeStaleSocket(path, SOCK_STREAM)){
+        close(lfd);
+        return HANDOFF_FAILED;
+    }
+    struct stat own;
+    if(bind(lfd, (struct sockaddr *)&addr, addrlen) == -1 || listen(lfd, 1) == -1 || (path[0] != '@' && stat(path.c_str(), &own) == -1)){
+        std::cerr << "handoff: " << path << ": " << strerror(errno) << std::endl;
+        close(lfd);
+        return HANDOFF_FAILED;
+    }
+
+    // Keep receiving until the new node connects and says hello; other connections are dropped.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutms);
+    int cfd = -1;
+    while(cfd == -1){
+        int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(remaining <= 0){
+            break;
+        }
+        struct pollfd pfd;
+        pfd.fd = lfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if(poll(&pfd, 1, remaining) != 1 || (cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) == -1){
+            continue;
+        }
+        pfd.fd = cfd;
+        uint32_t hello = 0;
+        if(poll(&pfd, 1, std::min(remaining, 1000)) != 1 || recv(cfd, &hello, sizeof hello, MSG_WAITALL) != sizeof hello || hello != HANDOFF_HELLO){
+            close(cfd);
+            cfd = -1;
+        }
+    }
+    close(lfd);
+
+    // The path is removed only while it is still this socket.
+    struct stat st;
+    if(path[0] != '@' && lstat(path.c_str(), &st) == 0 && st.st_dev == own.st_dev && st.st_ino == own.st_ino){
+        unlink(path.c_str());
+    }
+    if(cfd == -1){
+        std::cerr << "handoff: no node connected to " << path << std::endl;
+        return HANDOFF_FAILED;
+    }
+
+    // Stop receiving; what arrives from now on waits in the socket buffers for the new node.
+    bool running = _rxthread.joinable();
+    stopRxLoop();
+
+    handoffHeader header;
+    memset(&header, 0, sizeof header);
+    header.magic = HANDOFF_MAGIC;
+    header.count = _listensockets.size();
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKETS)];
+    memset(control, 0, sizeof control);
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof header;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof mh);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * header.count);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * header.count);
+    for(size_t i = 0; i < header.count; i++){
+        int fd = _listensockets[i].fd;
+        header.fds[i] = fd;
+        header.kerneldrops[i] = _listensockets[i].kerneldrops;
+        memcpy(CMSG_DATA(cmsg) + i * sizeof(int), &fd, sizeof(int));
+    }
+    ssize_t sent;
+    do{
+        sent = sendmsg(cfd, &mh, MSG_NOSIGNAL);
+    } while(sent == -1 && errno == EINTR);
+    if(sent == -1){
+        std::cerr << "handoff: sendmsg: " << strerror(errno) << std::endl;
+        close(cfd);
+        if(running){
+            startRxLoop();
+        }
+        return HANDOFF_FAILED;
+    }
+
+    // Shared-memory peers reconnect to the new node; what their rings hold is handed over with the queue.
+    closeShmTransport();
+
+    // The rest of the header, then the queued datagrams as records ended by a zero length.
+    bool ok = writeAll(cfd, reinterpret_cast<char *>(&header) + sent, sizeof header - sent);
+    std::vector<char> record;
+    size_t handed = 0;
+    while(ok && rxDataAvailable()){
+        rxDatagram datagram = readRxDatagramFromQueue();
+        if(datagram.rxsockfd == -1){
+            continue;
+        }
+        record.resize(recordSize(datagram));
+        encodeRecord(datagram, record.data());
+        ok = writeAll(cfd, record.data(), record.size());
+        handed++;
+    }
+    uint32_t end = 0;
+    ok = ok && writeAll(cfd, &end, sizeof end);
+    close(cfd);
+
+    // The new node holds its own references, so closing ours keeps the ports bound, and the socket file is its now.
+    _unixpath.clear();
+    closeListenSockets();
+    if(!ok){
+        std::cerr << "handoff: connection lost, queued datagrams were not all handed over" << std::endl;
+        return HANDOFF_FAILED;
+    }
+    std::cout << "handed " << header.count << " listening sockets and " << handed << " queued datagrams over to " << path << std::endl;
+    return SUCCESS;
+}
+
+err_code UDPNode::adoptListenSockets(void){
+    struct sockaddr_un addr;
+    socklen_t addrlen = unixAddress(_options.handoffpath, addr);
+    if(addrlen == 0){
+        return HANDOFF_FAILED;
+    }
+
+    // The old node may not be listening yet.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_options.handofftimeoutms);
+    int fd;
+    for(;;){
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd == -1){
+            return HANDOFF_FAILED;
+        }
+        uint32_t hello = HANDOFF_HELLO;
+        if(connect(fd, (struct sockaddr *)&addr, addrlen) == 0 && writeAll(fd, &hello, sizeof hello)){
+            break;
+        }
+        close(fd);
+        if(std::chrono::steady_clock::now() >= deadline){
+            return HANDOFF_FAILED;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    struct timeval tv;
+    tv.tv_sec = _options.handofftimeoutms / 1000;
+    tv.tv_usec = (_options.handofftimeoutms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    handoffHeader header;
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKETS)];
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof header;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof mh);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof control;
+    ssize_t n;
+    do{
+        n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+    } while(n == -1 && errno == EINTR);
+
+    std::vector<int> fds;
+    for(struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&mh) : NULL; cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            for(size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++){
+                int rxfd;
+                memcpy(&rxfd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.push_back(rxfd);
+            }
+        }
+    }
+    if(n <= 0 || !readAll(fd, reinterpret_cast<char *>(&header) + n, sizeof header - n) ||
+       header.magic != HANDOFF_MAGIC || header.count == 0 || header.count != fds.size()){
+        for(int rxfd : fds){
+            close(rxfd);
+        }
+        close(fd);
+        return HANDOFF_FAILED;
+    }
+
+    for(size_t i = 0; i < fds.size(); i++){
+        struct sockaddr_storage local;
+        socklen_t locallen = sizeof local;
+        getsockname(fds[i], (struct sockaddr *)&local, &locallen);
+        configureListenSocket(fds[i], local.ss_family);
+        listenSocket ls;
+        ls.fd = fds[i];
+        ls.family = local.ss_family;
+        ls.port = 0;
+        if(local.ss_family == AF_UNIX){
+            const struct sockaddr_un *sun = (const struct sockaddr_un *)&local;
+            if(locallen > offsetof(struct sockaddr_un, sun_path) && sun->sun_path[0] != '\0'){
+                _unixpath = sun->sun_path;
+            }
+        } else {
+            ls.port = ntohs(getInPort((struct sockaddr *)&local));
+        }
+        ls.kerneldrops = header.kerneldrops[i];
+        ls.addr = local;
+        _listensockets.push_back(ls);
+    }
+    _listensockfd = _listensockets.front().fd;
+    std::cout << "adopted " << fds.size() << " listening sockets on port: " << _listenport << "..." << std::endl;
+
+    // Queued datagrams are taken in their original order; their socket is renumbered for reply().
+    std::vector<char> record;
+    size_t adopted = 0;
+    uint32_t len;
+    while(readAll(fd, &len, sizeof len) && len != 0){
+        record.resize(sizeof len + len);
+        memcpy(record.data(), &len, sizeof len);
+        if(!readAll(fd, record.data() + sizeof len, len)){
+            break;
+        }
+        rxDatagram datagram;
+        if(decodeRecord(record.data(), record.size(), datagram) == 0){
+            continue;
+        }
+        for(size_t i = 0; i < fds.size(); i++){
+            if(datagram.rxsockfd == header.fds[i]){
+                datagram.rxsockfd = fds[i];
+                break;
+            }
+        }
+        if(writeRxDatagramToQueue(std::move(datagram))){
+            _queued.fetch_add(1, std::memory_order_relaxed);
+            adopted++;
+        } else {
+            _queuefulldrops.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    close(fd);
+    if(adopted > 0){
+        std::cout << "adopted " << adopted << " queued datagrams" << std::endl;
+    }
+
+    // The listening socket may also be used for sending (see txfromlistensocket).
+    return applyMulticastTxOptions(_listensockfd, _listenipver);
+}
+
+void UDPNode::startShmTransport(void){
+    if(_shmlisteners.empty()){
+        // One rendezvous socket per listening socket; a dual-stack wildcard also stands for the IPv4 wildcard.
+        std::vector<std::pair<struct sockaddr_storage, int>> binds;
+        for(const auto &ls : _listensockets){
+            if(ls.family != AF_INET && ls.family != AF_INET6){
+                continue;
+            }
+            binds.push_back(std::make_pair(ls.addr, ls.fd));
+            if(ls.family == AF_INET6 && _options.dualstack && isAnyAddr(ls.addr)){
+                binds.push_back(std::make_pair(anyAddr(AF_INET, ls.port), ls.fd));
+            }
+        }
+        for(const auto &bind : binds){
+            shmListener l;
+            l.path = shmSocketPath(_options.shmdir, (const struct sockaddr *)&bind.first);
+            l.rxsockfd = bind.second;
+            std::string tmppath = l.path + "." + std::to_string(getpid());
+            struct sockaddr_un addr, tmpaddr;
+            socklen_t addrlen = unixAddress(l.path, addr);
+            socklen_t tmpaddrlen = unixAddress(tmppath, tmpaddr);
+            if(addrlen == 0 || tmpaddrlen == 0){
+                continue;
+            }
+
+            // A live listener belongs to another node on the address, e.g. a reuseport shard,
+            // and is left alone; a socket file refusing connections was left by a node that died.
+            int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            bool taken = probe != -1 && connect(probe, (struct sockaddr *)&addr, addrlen) == 0;
+            if(taken && !peerIsSelf(probe)){
+                std::cerr << "shm: " << l.path << " is held by another user" << std::endl;
+            }
+            if(probe != -1){
+                close(probe);
+            }
+            if(taken){
+                continue;
+            }
+
+            // Renamed into place once listening, so senders woken by the name can connect.
+            l.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            if(l.fd == -1){
+                continue;
+            }
+            unlink(tmppath.c_str());
+            if(::bind(l.fd, (struct sockaddr *)&tmpaddr, tmpaddrlen) == -1 || listen(l.fd, SOMAXCONN) == -1 || rename(tmppath.c_str(), l.path.c_str()) == -1){
+                if(_debug){
+                    std::cerr << "shm: not accepting peers at " << l.path << ": " << strerror(errno) << std::endl;
+                }
+                close(l.fd);
+                unlink(tmppath.c_str());
+                continue;
+            }
+            _shmlisteners.push_back(l);
+        }
+    }
+    if(!_shmlisteners.empty() || !_shminbound.empty()){
+        _shmthread = std::thread(&UDPNode::shmLoop, this);
+    }
+}
+
+void UDPNode::closeShmTransport(void){
+    for(auto &l : _shmlisteners){
+        close(l.fd);
+        unlink(l.path.c_str());
+    }
+    _shmlisteners.clear();
+    for(const auto &p : _shmpending){
+        close(p.fd);
+    }
+    _shmpending.clear();
+
+    // Producers stop using a closed ring, so it is drained once more before it is unmapped.
+    for(auto &in : _shminbound){
+        in.ring->close();
+    }
+    drainShmRings();
+    for(auto &in : _shminbound){
+        close(in.connfd);
+    }
+    _shminbound.clear();
+}
+
+void UDPNode::shmLoop(void){
+    std::vector<struct pollfd> pfds;
+    while(!_stoprecvthread){
+        if(drainShmRings()){
+            continue;
+        }
+
+        // Sleep only once every ring knows it must signal its eventfd.
+        bool idle = true;
+        for(auto &in : _shminbound){
+            idle = in.ring->prepareWait() && idle;
+        }
+        if(!idle){
+            continue;
+        }
+
+        // The stop eventfd, the listeners, the peers yet to say hello, then each ring's eventfd and handshake connection.
+        pfds.clear();
+        struct pollfd wake;
+        wake.fd = _wakefd;
+        wake.events = POLLIN;
+        wake.revents = 0;
+        pfds.push_back(wake);
+        for(const auto &l : _shmlisteners){
+            struct pollfd pfd;
+            pfd.fd = l.fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            pfds.push_back(pfd);
+        }
+        int timeoutms = -1;
+        auto now = std::chrono::steady_clock::now();
+        for(const auto &p : _shmpending){
+            struct pollfd pfd;
+            pfd.fd = p.fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            pfds.push_back(pfd);
+            int left = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(p.deadline - now).count() + 1);
+            timeoutms = timeoutms == -1 ? left : std::min(timeoutms, left);
+        }
+        const size_t pending = 1 + _shmlisteners.size();
+        const size_t rings = pending + _shmpending.size();
+        for(auto &in : _shminbound){
+            struct pollfd pfd;
+            pfd.fd = in.ring->eventfd();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            pfds.push_back(pfd);
+            pfd.fd = in.connfd;
+            pfds.push_back(pfd);
+        }
+        if(poll(pfds.data(), pfds.size(), timeoutms) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            std::cerr << "shm: poll: " << strerror(errno) << std::endl;
+            break;
+        }
+        for(auto &in : _shminbound){
+            in.ring->acknowledge();
+        }
+
+        // A peer that closed its connection is gone; its ring is dropped once drained.
+        bool gone = false;
+        for(size_t i = 0; i < _shminbound.size(); i++){
+            gone = gone || pfds[rings + 2 * i + 1].revents != 0;
+        }
+        if(gone){
+            drainShmRings();
+            for(size_t i = _shminbound.size(); i-- > 0;){
+                if(pfds[rings + 2 * i + 1].revents != 0){
+                    _shminbound[i].ring->close();
+                    close(_shminbound[i].connfd);
+                    _shminbound.erase(_shminbound.begin() + i);
+                }
+            }
+        }
+
+        // Peers that said hello become rings; those silent past their deadline are dropped.
+        now = std::chrono::steady_clock::now();
+        for(size_t i = _shmpending.size(); i-- > 0;){
+            bool done;
+            if(pfds[pending + i].revents != 0){
+                done = readShmHello(i);
+            } else if((done = now >= _shmpending[i].deadline)){
+                close(_shmpending[i].fd);
+            }
+            if(done){
+                _shmpending.erase(_shmpending.begin() + i);
+            }
+        }
+        for(size_t i = 0; i < _shmlisteners.size(); i++){
+            if(pfds[1 + i].revents & POLLIN){
+                acceptShmPeers(i);
+            }
+        }
+    }
+}
+
+void UDPNode::acceptShmPeers(size_t idx){
+    // Hellos are read from the poll loop, so a peer that connects and stays silent delays no ring.
+    int fd;
+    while((fd = accept4(_shmlisteners[idx].fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1){
+        // Only processes of this user may hand over rings.
+        if(!peerIsSelf(fd)){
+            close(fd);
+            continue;
+        }
+        shmPending p;
+        p.fd = fd;
+        p.listener = idx;
+        p.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHM_HELLO_TIMEOUT_MS);
+        _shmpending.push_back(p);
+    }
+}
+
+bool UDPNode::readShmHello(size_t idx){
+    // The peer sends the ring right after connecting.
+    int fd = _shmpending[idx].fd;
+    uint32_t magic = 0;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov;
+    iov.iov_base = &magic;
+    iov.iov_len = sizeof magic;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof mh);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof control;
+    ssize_t n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+    if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+        return false;
+    }
+
+    std::vector<int> fds;
+    for(struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&mh) : NULL; cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            for(size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++){
+                int rxfd;
+                memcpy(&rxfd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.push_back(rxfd);
+            }
+        }
+    }
+    std::unique_ptr<ShmRing> ring;
+    if(n == sizeof magic && magic == SHM_HELLO_MAGIC && fds.size() == 2){
+        ring = ShmRing::attach(fds[0], fds[1]);
+    } else {
+        for(int rxfd : fds){
+            close(rxfd);
+        }
+    }
+    if(!ring){
+        close(fd);
+        return true;
+    }
+    const shmListener &l = _shmlisteners[_shmpending[idx].listener];
+    if(_debug){
+        std::cout << "shm: accepted a peer at " << l.path << std::endl;
+    }
+    shmInbound in;
+    in.ring = std::move(ring);
+    in.connfd = fd;
+    in.rxsockfd = l.rxsockfd;
+    _shminbound.push_back(std::move(in));
+    return true;
+}
+
+bool UDPNode::drainShmRings(void){
+    bool moved = false;
+    rxDatagram datagram;
+    for(auto &in : _shminbound){
+        while(in.ring->pop(datagram)){
+            // Replies go back over UDP from the listening socket the peer addressed.
+            datagram.rxsockfd = in.rxsockfd;
+            _shmreceived.fetch_add(1, std::memory_order_relaxed);
+            receiveLocalDatagram(datagram);
+            moved = true;
+        }
+    }
+    return moved;
+}
+
+void UDPNode::prepareLocalDatagram(const struct sockaddr_storage &src, int destport, const struct sockaddr *addr, const std::string &msg, unsigned int priority, rxDatagram &datagram){
+    // The datagram carries what the envelope would, and the address of the sender's listening socket to reply to.
+    char s[INET6_ADDRSTRLEN];
+    datagram.srcaddr = src;
+    datagram.srcaddrlen = src.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    datagram.srcport = ntohs(getInPort((struct sockaddr *)&datagram.srcaddr));
+    datagram.srcipaddr.clear();
+    if(inet_ntop(src.ss_family, getInAddr((struct sockaddr *)&datagram.srcaddr), s, sizeof s) != NULL){
+        datagram.srcipaddr = s;
+    }
+    if(inet_ntop(addr->sa_family, getInAddr((struct sockaddr *)addr), s, sizeof s) != NULL){
+        datagram.dstipaddr = s;
+    }
+    setDstAddr(datagram, addr->sa_family, getInAddr((struct sockaddr *)addr));
+    datagram.dstport = destport;
+    datagram.ifindex = 0;
+    datagram.time_stamp = time(0);
+    datagram.priority = priority;
+    datagram.jointhread = false;
+    unsigned char crc_checksum = 0;
+    for(char c : msg){
+        crc_checksum ^= c;
+    }
+    datagram.crc_checksum = crc_checksum;
+    if(_options.txttlms > 0){
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        datagram.deadlinens = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec + (uint64_t)_options.txttlms * 1000000ULL;
+    }
+}
+
+bool UDPNode::localSourceAddr(const struct sockaddr *dst, struct sockaddr_storage &src){
+    const listenSocket *from = nullptr;
+    for(const auto &ls : _listensockets){
+        if(ls.family == dst->sa_family){
+            from = &ls;
+            break;
+        }
+        if(from == nullptr && ls.family == AF_INET6 && dst->sa_family == AF_INET && _options.dualstack){
+            from = &ls;
+        }
+    }
+    if(from == nullptr){
+        return false;
+    }
+
+    // The kernel sends to a local address from that same address unless the socket is bound to another one.
+    int port = ntohs(getInPort((struct sockaddr *)&from->addr));
+    memset(&src, 0, sizeof src);
+    if(dst->sa_family == AF_INET){
+        struct sockaddr_in *sin = (struct sockaddr_in *)&src;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sin->sin_addr = ((const struct sockaddr_in *)dst)->sin_addr;
+        if(from->family == AF_INET && !isAnyAddr(from->addr)){
+            sin->sin_addr = ((const struct sockaddr_in *)&from->addr)->sin_addr;
+        } else if(from->family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&((const struct sockaddr_in6 *)&from->addr)->sin6_addr)){
+            memcpy(&sin->sin_addr, ((const struct sockaddr_in6 *)&from->addr)->sin6_addr.s6_addr + 12, 4);
+        }
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&src;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        sin6->sin6_addr = isAnyAddr(from->addr) ? ((const struct sockaddr_in6 *)dst)->sin6_addr : ((const struct sockaddr_in6 *)&from->addr)->sin6_addr;
+    }
+    return true;
+}
+
+void UDPNode::receiveLocalDatagram(rxDatagram &datagram){
+    _received.fetch_add(1, std::memory_order_relaxed);
+    if(_ratelimiting.load(std::memory_order_relaxed)){
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        if(!admitSource(datagram.srcaddr, now)){
+            _ratelimitdrops.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    if(!isDatagramValid(datagram)){
+        std::cerr << "rxloop: CRC Checksum invalid. Discarding... " << std::endl;
+        _crcdrops.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if(_options.rxttlms > 0){
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        datagram.arrivalns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    queueRxDatagram(datagram);
+}
+
+err_code UDPNode::txLoopback(int destport, const struct sockaddr *addr, std::string &msg, unsigned int priority){
+    std::shared_lock<std::shared_mutex> lock(loopbackmtx);
+
+    // As in the kernel, a socket bound to the destination address wins over a wildcard one.
+    // Several nodes sharing the best match through SO_REUSEPORT are left to the kernel's choice.
+    const loopbackEntry *target = nullptr;
+    int best = 0;
+    auto range = loopbacknodes.equal_range(destport);
+    for(auto it = range.first; it != range.second; ++it){
+        int match = loopbackMatch(it->second, addr);
+        if(match > best){
+            target = &it->second;
+            best = match;
+        } else if(match > 0 && match == best && it->second.node != target->node){
+            return SOCKET_CONN_FAILED;
+        }
+    }
+    if(target == nullptr){
+        return SOCKET_CONN_FAILED;
+    }
+
+    struct sockaddr_storage src;
+    if(!localSourceAddr(addr, src)){
+        return SOCKET_CONN_FAILED;
+    }
+    rxDatagram datagram;
+    prepareLocalDatagram(src, destport, addr, msg, priority, datagram);
+    datagram.msg = std::move(msg);
+    datagram.rxsockfd = target->fd;
+    if(_debug){
+        std::cout << "tx: handing "<< datagram.msg.size() <<" bytes to the node on port " << destport << std::endl;
+    }
+    target->node->_loopbackreceived.fetch_add(1, std::memory_order_relaxed);
+    target->node->receiveLocalDatagram(datagram);
+    return SUCCESS;
+}
+
+void UDPNode::registerLoopback(bool accept){
+    std::unique_lock<std::shared_mutex> lock(loopbackmtx);
+    for(auto it = loopbacknodes.begin(); it != loopbacknodes.end();){
+        it = it->second.node == this ? loopbacknodes.erase(it) : std::next(it);
+    }
+    if(!accept){
+        return;
+    }
+    for(const auto &ls : _listensockets){
+        if(ls.family == AF_INET || ls.family == AF_INET6){
+            loopbacknodes.emplace(ls.port, loopbackEntry{this, ls.addr, ls.fd, ls.family == AF_INET6 && _options.dualstack});
+        }
+    }
+}
+
+bool UDPNode::isLocalAddr(const struct sockaddr *sa){
+    if(sa->sa_family == AF_INET){
+        const struct in_addr &a = ((const struct sockaddr_in *)sa)->sin_addr;
+        if((ntohl(a.s_addr) >> 24) == 127){
+            return true;
+        }
+        for(const auto &l : _localaddrs){
+            if(l.ss_family == AF_INET && ((const struct sockaddr_in *)&l)->sin_addr.s_addr == a.s_addr){
+                return true;
+            }
+        }
+    } else if(sa->sa_family == AF_INET6){
+        const struct in6_addr &a = ((const struct sockaddr_in6 *)sa)->sin6_addr;
+        if(IN6_IS_ADDR_LOOPBACK(&a)){
+            return true;
+        }
+        for(const auto &l : _localaddrs){
+            if(l.ss_family == AF_INET6 && memcmp(&((const struct sockaddr_in6 *)&l)->sin6_addr, &a, sizeof a) == 0){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool UDPNode::connectShmPeer(const std::string &path){
+    struct sockaddr_un addr;
+    socklen_t addrlen = unixAddress(path, addr);
+    int fd = addrlen == 0 ? -1 : socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1){
+        return false;
+    }
+    // A listener of another user could have taken the name; it gets no ring.
+    if(connect(fd, (struct sockaddr *)&addr, addrlen) == -1 || !peerIsSelf(fd)){
+        close(fd);
+        return false;
+    }
+    std::unique_ptr<ShmRing> ring = ShmRing::create(_options.shmringsize);
+    if(!ring){
+        close(fd);
+        return false;
+    }
+
+    // Hand the memfd and the eventfd over; the peer maps the ring and polls the eventfd.
+    uint32_t magic = SHM_HELLO_MAGIC;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    memset(control, 0, sizeof control);
+    struct iovec iov;
+    iov.iov_base = &magic;
+    iov.iov_len = sizeof magic;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof mh);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof control;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int fds[2] = {ring->memfd(), ring->eventfd()};
+    memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+    if(sendmsg(fd, &mh, MSG_NOSIGNAL) != sizeof magic){
+        close(fd);
+        return false;
+    }
+    ring->releaseMemfd();
+
+    std::shared_ptr<shmPeer> peer = std::make_shared<shmPeer>();
+    peer->ring = std::move(ring);
+    peer->connfd = fd;
+    _shmpeers[path] = peer;
+    if(_debug){
+        std::cout << "shm: sending to " << path << " over shared memory" << std::endl;
+    }
+    return true;
+}
+
+void UDPNode::refreshShmAbsent(void){
+    // Without a watch a path stays absent for the life of the node.
+    if(_shmnotifyfd == -1){
+        return;
+    }
+
+    // Listeners are renamed into place, or bound there, once they accept peers.
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t len;
+    while((len = read(_shmnotifyfd, buf, sizeof buf)) > 0){
+        for(char *p = buf; p < buf + len; ){
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if(ev->mask & IN_Q_OVERFLOW){
+                _shmabsent.clear();
+            } else if(ev->len > 0){
+                _shmabsent.erase(_options.shmdir + "/" + ev->name);
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+err_code UDPNode::txShm(int destport, const struct sockaddr *addr, std::string &msg, unsigned int priority){
+    // The listener bound to the destination address, else the one bound to the wildcard of its family.
+    struct sockaddr_storage any = anyAddr(addr->sa_family, destport);
+    std::string paths[2] = {shmSocketPath(_options.shmdir, addr), shmSocketPath(_options.shmdir, (struct sockaddr *)&any)};
+    std::shared_ptr<shmPeer> peer;
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(_shmmtx);
+        for(const auto &p : paths){
+            auto it = _shmpeers.find(p);
+            if(it != _shmpeers.end() && it->second->ring->closed()){
+                _shmpeers.erase(it);
+                it = _shmpeers.end();
+            }
+            if(it != _shmpeers.end()){
+                peer = it->second;
+                path = p;
+                break;
+            }
+        }
+        if(!peer){
+            refreshShmAbsent();
+            for(const auto &p : paths){
+                if(_shmabsent.count(p) != 0){
+                    continue;
+                }
+                if(connectShmPeer(p)){
+                    peer = _shmpeers[p];
+                    path = p;
+                    break;
+                }
+                _shmabsent.insert(p);
+            }
+            if(!peer){
+                return SOCKET_CONN_FAILED;
+            }
+        }
+    }
+
+    // Replies to the source address reach the sender's listening socket over UDP.
+    struct sockaddr_storage src;
+    if(!localSourceAddr(addr, src)){
+        return SOCKET_CONN_FAILED;
+    }
+    rxDatagram datagram;
+    prepareLocalDatagram(src, destport, addr, msg, priority, datagram);
+
+    // Borrow the message for the record instead of copying it.
+    bool pushed;
+    datagram.msg.swap(msg);
+    {
+        std::lock_guard<std::mutex> lock(peer->mtx);
+        pushed = peer->ring->push(datagram);
+    }
+    datagram.msg.swap(msg);
+    if(pushed){
+        return SUCCESS;
+    }
+
+    // A full ring whose consumer died without closing it is forgotten, and UDP is used instead.
+    char c;
+    if(recv(peer->connfd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0){
+        std::lock_guard<std::mutex> lock(_shmmtx);
+        auto it = _shmpeers.find(path);
+        if(it != _shmpeers.end() && it->second == peer){
+            _shmpeers.erase(it);
+        }
+        return SOCKET_CONN_FAILED;
+    }
+    return SENDTO_FAILED;
+}
+
+void UDPNode::startParseWorkers(void){
+    if(_options.parseworkers == 0 || !_workers.empty()){
+        return;
+    }
+
+    // Raw buffers circulate between the receive thread, which fills them
+    // straight from recvmmsg(), and the workers, which hand them back.
+    // They and the workers' rings are allocated and prefaulted on the
+    // receive thread's CPUs, since that thread writes both.
+    size_t poolsize = (size_t)_options.parseworkers * std::max(1u, _options.workerqueuesize);
+    runOnCpus(_options.rxcpus, [this, poolsize]{
+        _freeraw.reset(new RingBuffer<rawDatagram *>(poolsize));
+        _rawpool.clear();
+        for(size_t i = 0; i < poolsize; i++){
+            std::unique_ptr<rawDatagram> raw(new rawDatagram);
+            raw->buf.reset(new char[_maxmessagesize]);
+            memset(raw->buf.get(), 0, _maxmessagesize);
+            raw->numbytes = 0;
+            _freeraw->push(raw.get());
+            _rawpool.push_back(std::move(raw));
+        }
+        for(unsigned int i = 0; i < _options.parseworkers; i++){
+            std::unique_ptr<parseWorker> w(new parseWorker(poolsize));
+            w->signal = 0;
+            _workers.push_back(std::move(w));
+        }
+    });
+
+    _stopworkers = false;
+    for(unsigned int i = 0; i < _options.parseworkers; i++){
+        _workers[i]->thread = std::thread(&UDPNode::parseWorkerLoop, this, i);
+    }
+}
+
+void UDPNode::stopParseWorkers(void){
+    _stopworkers = true;
+    for(auto &w : _workers){
+        w->signal.fetch_add(1, std::memory_order_release);
+        w->signal.notify_one();
+    }
+    for(auto &w : _workers){
+        if(w->thread.joinable()){
+            w->thread.join();
+        }
+    }
+    _workers.clear();
+}
+
+void UDPNode::parseWorkerLoop(unsigned int index){
+    parseWorker &w = *_workers[index];
+    if(!_options.workercpus.empty()){
+        std::vector<int> cpu(1, _options.workercpus[index % _options.workercpus.size()]);
+        err_code pin_code = pinCurrentThread(cpu, _options.workerschedpriority);
+        if(pin_code != SUCCESS){
+            std::cerr << "parse worker: " << errorMsg(pin_code) << std::endl;
+        }
+    }
+
+    rawDatagram *raw;
+    for(;;){
+        // Read the signal before checking the ring so a push in between is not missed.
+        uint32_t seen = w.signal.load(std::memory_order_acquire);
+        bool worked = false;
+        while(w.work.pop(raw)){
+            processRxDatagram(raw->buf.get(), raw->numbytes, raw->datagram);
+            _freeraw->push(raw);
+            worked = true;
+        }
+        if(_stopworkers && !worked){
+            break;
+        }
+        if(!worked){
+            w.signal.wait(seen, std::memory_order_acquire);
+        }
+    }
+}
+
+size_t UDPNode::parseWorkerFor(const rxDatagram &datagram){
+    // Hashing the source keeps each sender's datagrams on one worker, in order.
+    if(_options.preservesourceorder){
+        return sourceHash(datagram.srcaddr) % _workers.size();
+    }
+    return _nextworker++ % _workers.size();
+}
+
+uint64_t UDPNode::sourceHash(const struct sockaddr_storage &addr){
+    // FNV-1a over the address and port bytes.
+    const unsigned char *p;
+    size_t len;
+    if(addr.ss_family == AF_INET){
+        p = (const unsigned char *)&((const struct sockaddr_in *)&addr)->sin_port;
+        len = sizeof(in_port_t) + sizeof(struct in_addr);
+    } else if(addr.ss_family == AF_INET6){
+        const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6 *)&addr;
+        uint64_t h = 1469598103934665603ULL;
+        for(size_t i = 0; i < sizeof sa6->sin6_addr; i++){
+            h = (h ^ ((const unsigned char *)&sa6->sin6_addr)[i]) * 1099511628211ULL;
+        }
+        h = (h ^ (sa6->sin6_port & 0xff)) * 1099511628211ULL;
+        h = (h ^ (sa6->sin6_port >> 8)) * 1099511628211ULL;
+        return h;
+    } else if(addr.ss_family == AF_UNIX){
+        p = (const unsigned char *)((const struct sockaddr_un *)&addr)->sun_path;
+        len = sizeof(((const struct sockaddr_un *)&addr)->sun_path);
+    } else {
+        p = (const unsigned char *)&addr;
+        len = sizeof addr.ss_family;
+    }
+    uint64_t h = 1469598103934665603ULL;
+    for(size_t i = 0; i < len; i++){
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+err_code UDPNode::attachFilter(const BpfProgram &program){
+    std::vector<struct sock_filter> code = program.build();
+    if(code.empty()){
+        std::cerr << "attachFilter: invalid filter program" << std::endl;
+        return FILTER_FAILED;
+    }
+    return attachFilter(code);
+}
+
+err_code UDPNode::attachFilter(const std::vector<struct sock_filter> &code){
+    struct sock_fprog prog;
+    prog.len = code.size();
+    prog.filter = const_cast<struct sock_filter *>(code.data());
+
+    // The programs inspect IP and UDP headers, which Unix datagrams do not have.
+    for(const auto &ls : _listensockets){
+        if(ls.family == AF_UNIX){
+            continue;
+        }
+        if(setsockopt(ls.fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof prog) == -1){
+            std::cerr << "attachFilter: " << strerror(errno) << std::endl;
+            return FILTER_FAILED;
+        }
+    }
+    return SUCCESS;
+}
+
+err_code UDPNode::detachFilter(void){
+    int dummy = 0;
+    for(const auto &ls : _listensockets){
+        if(ls.family == AF_UNIX){
+            continue;
+        }
+        if(setsockopt(ls.fd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof dummy) == -1 && errno != ENOENT){
+            return FILTER_FAILED;
+        }
+    }
+    return SUCCESS;
+}
+
+err_code UDPNode::attachReuseportSteering(steerRule rule, unsigned int shards, unsigned int keyoffset, unsigned int keylen){
+    if(!_options.reuseport){
+        std::cerr << "attachReuseportSteering: node was not created with reuseport" << std::endl;
+        return FILTER_FAILED;
+    }
+    std::vector<struct sock_filter> code = BpfProgram::reuseportSteering(rule, shards, keyoffset, keylen);
+    if(code.empty()){
+        std::cerr << "attachReuseportSteering: invalid steering rule" << std::endl;
+        return FILTER_FAILED;
+    }
+    struct sock_fprog prog;
+    prog.len = code.size();
+    prog.filter = code.data();
+
+    // The program belongs to the reuseport group, so attaching it through
+    // any member steers for every shard bound to that port and family.
+    for(const auto &ls : _listensockets){
+        if(ls.family == AF_UNIX){
+            continue;
+        }
+        if(setsockopt(ls.fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) == -1){
+            std::cerr << "attachReuseportSteering: " << strerror(errno) << std::endl;
+            return FILTER_FAILED;
+        }
+    }
+    return SUCCESS;
+}
+
+err_code UDPNode::detachReuseportSteering(void){
+    int dummy = 0;
+    for(const auto &ls : _listensockets){
+        if(ls.family == AF_UNIX){
+            continue;
+        }
+        if(setsockopt(ls.fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF, &dummy, sizeof dummy) == -1 && errno != ENOENT){
+            return FILTER_FAILED;
+        }
+    }
+    return SUCCESS;
+}
+
+err_code UDPNode::pinCurrentThread(const std::vector<int> &cpus, int schedpriority){
+    if(!cpus.empty()){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : cpus){
+            CPU_SET(cpu, &set);
+        }
+        if(pthread_setaffinity_np(pthread_self(), sizeof set, &set) != 0){
+            return THREAD_AFFINITY_FAILED;
+        }
+    }
+
+    // SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance.
+    if(schedpriority > 0){
+        struct sched_param sp;
+        memset(&sp, 0, sizeof sp);
+        sp.sched_priority = schedpriority;
+        if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0){
+            return THREAD_SCHED_FAILED;
+        }
+    }
+    return SUCCESS;
+}
+
+int UDPNode::rxIncomingCpu(void){
+    int cpu = -1;
+    socklen_t len = sizeof cpu;
+    if(_listensockfd == -1 || getsockopt(_listensockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1){
+        return -1;
+    }
+    return cpu;
+}
+
+void UDPNode::rxLoop(void){
+    err_code error_code = SUCCESS;
+    const unsigned int batch = std::max(1u, _options.rxbatch);  // Datagrams read per recvmmsg() call.
+
+    // Place the thread before allocating, so the buffers below (and the queue
+    // nodes this thread pushes) are first touched on the pinned CPUs' NUMA node.
+    err_code pin_code = pinCurrentThread(_options.rxcpus, _options.rxschedpriority);
+    if(pin_code != SUCCESS){
+        std::cerr << "rxloop: " << errorMsg(pin_code) << std::endl;
+    }
+
+    // Per-datagram buffers for one recvmmsg() batch, prefaulted by this thread.
+    std::unique_ptr<char[]> bufs(new char[batch * _maxmessagesize]);
+    std::unique_ptr<char[]> cbufs(new char[batch * RX_CONTROL_LEN]);
+    memset(bufs.get(), 0, batch * _maxmessagesize);
+    std::vector<struct sockaddr_storage> addrs(batch);
+    std::vector<struct iovec> iovs(batch);
+    std::vector<struct mmsghdr> msgs(batch);
+    std::vector<rxDatagram> datagrams(batch);
+
+    // In pipelined mode datagrams are received straight into pooled raw
+    // buffers that are handed to the parse workers.
+    const bool pipelined = !_workers.empty();
+    std::vector<rawDatagram *> slots(batch, nullptr);
+    std::vector<bool> signalworker(_workers.size(), false);
+
+    // Every bound socket is multiplexed onto this loop, followed by the shutdown eventfd.
+    const size_t nsockets = _listensockets.size();
+    std::vector<struct pollfd> pfds;
+    for(const auto &ls : _listensockets){
+        struct pollfd pfd;
+        pfd.fd = ls.fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        pfds.push_back(pfd);
+    }
+    struct pollfd wake;
+    wake.fd = _wakefd;
+    wake.events = POLLIN;
+    wake.revents = 0;
+    pfds.push_back(wake);
+
+    // Spinning strategies poll the sockets without blocking; WAIT_SPIN_BLOCK
+    // falls back to blocking once the sockets have been idle long enough.
+    const bool spinning = _options.rxwait != WAIT_BLOCK;
+    const unsigned int spinbudget = std::max(1u, _options.spinbudget);
+    bool blocking = !spinning;
+    unsigned int emptypolls = 0;
+    auto idlesince = std::chrono::steady_clock::now();
+
+    while(!_stoprecvthread && error_code == SUCCESS){
+        
+        if(_debug){
+            std::cout << "rxloop: In loop" << std::endl;
+        }
+
+        // Wait for any socket, or for endRxLoop() to signal the eventfd. Spinning
+        // strategies never block, so they only need to check the flag.
+        if(blocking && poll(pfds.data(), pfds.size(), -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            error_code = RECVFROM_FAILED;
+            break;
+        }
+
+        int received = 0;
+        for(size_t i = 0; i < nsockets && !_stoprecvthread; i++){
+            if(blocking && !(pfds[i].revents & POLLIN)){
+                continue;
+            }
+
+            for(unsigned int k = 0; k < batch; k++){
+                // A slot without a pooled buffer (workers behind) receives into scratch space and is dropped.
+                if(pipelined && slots[k] == nullptr){
+                    _freeraw->pop(slots[k]);
+                }
+                iovs[k].iov_base = slots[k] != nullptr ? slots[k]->buf.get() : bufs.get() + k * _maxmessagesize;
+                iovs[k].iov_len = _maxmessagesize - 1;
+                memset(&msgs[k], 0, sizeof msgs[k]);
+                msgs[k].msg_hdr.msg_name = &addrs[k];
+                msgs[k].msg_hdr.msg_namelen = sizeof addrs[k];
+                msgs[k].msg_hdr.msg_iov = &iovs[k];
+                msgs[k].msg_hdr.msg_iovlen = 1;
+                msgs[k].msg_hdr.msg_control = cbufs.get() + k * RX_CONTROL_LEN;
+                msgs[k].msg_hdr.msg_controllen = RX_CONTROL_LEN;
+            }
+
+            // Drain what is already queued; poll() did the waiting, so the receive never blocks.
+            int n = recvmmsg(pfds[i].fd, msgs.data(), batch, MSG_DONTWAIT, NULL);
+            if (n == -1) {
+                if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+                    continue;
+                }
+                error_code = RECVFROM_FAILED;
+                break;
+            }
+
+            // One clock read per batch for the token buckets.
+            const bool ratelimiting = _ratelimiting.load(std::memory_order_relaxed);
+            int64_t now = ratelimiting ? std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() : 0;
+
+            for(int k = 0; k < n; k++){
+                if(msgs[k].msg_len == 0){
+                    continue;
+                }
+                rxDatagram &datagram = slots[k] != nullptr ? slots[k]->datagram : datagrams[k];
+                prepareRxDatagram(i, msgs[k].msg_hdr, datagram);
+
+                // Over-limit sources are rejected before any parsing.
+                if(ratelimiting && !admitSource(datagram.srcaddr, now)){
+                    _ratelimitdrops.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                if(!pipelined){
+                    processRxDatagram((char *)iovs[k].iov_base, msgs[k].msg_len, datagram);
+                } else if(slots[k] == nullptr){
+                    _pipelinedrops.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    rawDatagram *raw = slots[k];
+                    slots[k] = nullptr;
+                    raw->numbytes = msgs[k].msg_len;
+                    size_t w = parseWorkerFor(raw->datagram);
+                    _workers[w]->work.push(std::move(raw));
+                    signalworker[w] = true;
+                }
+            }
+            received += n;
+        }
+
+        // Wake each worker once per batch rather than once per datagram.
+        for(size_t w = 0; w < signalworker.size(); w++){
+            if(signalworker[w]){
+                _workers[w]->signal.fetch_add(1, std::memory_order_release);
+                _workers[w]->signal.notify_one();
+                signalworker[w] = false;
+            }
+        }
+
+        if(!spinning){
+            continue;
+        }
+
+        if(received > 0){
+            emptypolls = 0;
+            blocking = false;
+            idlesince = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        emptypolls++;
+        if(_options.rxwait == WAIT_SPIN_YIELD && emptypolls % spinbudget == 0){
+            sched_yield();
+        } else if(_options.rxwait == WAIT_SPIN_BLOCK && emptypolls % spinbudget == 0){
+            auto idle = std::chrono::steady_clock::now() - idlesince;
+            blocking = idle >= std::chrono::microseconds(_options.idlethresholdus);
+        }
+    }
+
+    // Return the unused pooled buffers.
+    for(rawDatagram *raw : slots){
+        if(raw != nullptr){
+            _freeraw->push(std::move(raw));
+        }
+    }
+
+    if(_debug){
+        std::cout << "rxloop: Exiting recv thread..." << std::endl;
+    }
+
+    if(error_code != SUCCESS){
+        std::cerr << errorMsg(error_code) << std::endl;
+    }
+    
+}
+
+void UDPNode::prepareRxDatagram(size_t sockidx, const struct msghdr &mh, rxDatagram &datagram){
+    _received.fetch_add(1, std::memory_order_relaxed);
+
+    memcpy(&datagram.srcaddr, mh.msg_name, mh.msg_namelen);
+    datagram.srcaddrlen = mh.msg_namelen;
+    datagram.rxsockfd = _listensockets[sockidx].fd;
+    datagram.dstport = _listensockets[sockidx].port;
+    readAncillaryData(sockidx, mh, datagram);
+
+    // Unix addresses are shorter than the storage; the rest is zeroed so the path can be read and hashed.
+    // An unbound sender has an empty address.
+    if(_listensockets[sockidx].family == AF_UNIX){
+        memset((char *)&datagram.srcaddr + mh.msg_namelen, 0, sizeof datagram.srcaddr - mh.msg_namelen);
+        datagram.srcaddr.ss_family = AF_UNIX;
+        datagram.dstipaddr = _options.unixpath;
+    }
+}
+
+void UDPNode::processRxDatagram(char *buf, int numbytes, rxDatagram &datagram){
+    buf[numbytes] = '\0';
+    if(_debug){
+        inspectRxBuffer(datagram.srcaddr, buf,  numbytes); 
+    }
+
+    // A malformed datagram is counted and dropped; it does not stop the receive loop.
+    err_code error_code = parseDatagram(datagram.srcaddr, buf, numbytes, datagram);
+    if(error_code != SUCCESS){
+        std::cerr << errorMsg(error_code) << std::endl;
+        _parsedrops.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    
+    // Validate the CRC checksum.
+    if(!isDatagramValid(datagram)){
+        std::cerr << "rxloop: CRC Checksum invalid. Discarding... " << std::endl;
+        _crcdrops.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    /*
+
+    if(datagram.jointhread){
+        std::cerr << "Need to exit thread, breaking while " << std::endl;
+        break;
+    } 
+    
+    */
+   
+   // Write the datagram to the receive queue.
+    if(datagram.jointhread == false){
+        queueRxDatagram(datagram);
+    }
+}
+
+void UDPNode::queueRxDatagram(rxDatagram &datagram){
+    // The earlier of the envelope deadline and the receive TTL applies.
+    if(_options.rxttlms > 0 && datagram.arrivalns != 0){
+        uint64_t deadline = datagram.arrivalns + (uint64_t)_options.rxttlms * 1000000ULL;
+        if(datagram.deadlinens == 0 || deadline < datagram.deadlinens){
+            datagram.deadlinens = deadline;
+        }
+    }
+    if(datagram.deadlinens != 0 && !_deadlines.load(std::memory_order_relaxed)){
+        _deadlines.store(true, std::memory_order_relaxed);
+    }
+
+    // Every valid datagram is journaled, including those the subscription filter drops.
+    if(_journal){
+        _journal->append(datagram);
+    }
+    if(_filtering.load(std::memory_order_acquire)){
+        std::shared_ptr<const RxFilter> filter = _rxfilter.load(std::memory_order_acquire);
+        if(filter && !filter->match(datagram)){
+            _filterdrops.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        _filterpassed.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(writeRxDatagramToQueue(std::move(datagram))){
+        _queued.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        std::cerr << "rxloop: Datagram Receive queue is full. Discarding incoming datagrams..." << std::endl;
+        _queuefulldrops.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void UDPNode::readAncillaryData(size_t sockidx, const struct msghdr &mh, rxDatagram &datagram){
+    char s[INET6_ADDRSTRLEN];
+    datagram.dstipaddr.clear();
+    datagram.dstaddr.ss_family = AF_UNSPEC;
+    datagram.ifindex = 0;
+    datagram.arrivalns = 0;
+
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(const_cast<struct msghdr *>(&mh)); cmsg != NULL; cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(&mh), cmsg)){
+        if(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO){
+            struct in_pktinfo pi;
+            memcpy(&pi, CMSG_DATA(cmsg), sizeof pi);
+            datagram.ifindex = pi.ipi_ifindex;
+            if(inet_ntop(AF_INET, &pi.ipi_addr, s, sizeof s) != NULL){
+                datagram.dstipaddr = s;
+            }
+            setDstAddr(datagram, AF_INET, &pi.ipi_addr);
+        } else if(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO){
+            struct in6_pktinfo pi;
+            memcpy(&pi, CMSG_DATA(cmsg), sizeof pi);
+            datagram.ifindex = pi.ipi6_ifindex;
+            if(inet_ntop(AF_INET6, &pi.ipi6_addr, s, sizeof s) != NULL){
+                datagram.dstipaddr = s;
+            }
+            setDstAddr(datagram, AF_INET6, &pi.ipi6_addr);
+        } else if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL){
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof drops);
+            datagram.kerneldrops = drops;
+
+            // The count is cumulative per socket; fold the increase into the node total.
+            listenSocket &ls = _listensockets[sockidx];
+            if(drops != ls.kerneldrops){
+                _kerneldrops.fetch_add(static_cast<uint32_t>(drops - ls.kerneldrops), std::memory_order_relaxed);
+                ls.kerneldrops = drops;
+                if(_options.autotunercvbuf){
+                    growRxBuffer(sockidx);
+                }
+            }
+        } else if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS){
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+            datagram.arrivalns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        }
+    }
+}
+
+bool UDPNode::writeRxDatagramToQueue(rxDatagram &&datagram){
+    if(_options.rxqueuemode == RXQ_PRIORITY){
+        return writeRxDatagramToLane(std::move(datagram));
+    }
+    if(_options.rxqueuemode == RXQ_PARTITIONED){
+        return writeRxDatagramToPartition(std::move(datagram));
+    }
+    if(_options.rxqueuemode == RXQ_CONFLATED){
+        return writeRxDatagramToConflation(datagram);
+    }
+
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(_options.rxqueuemode == RXQ_FAIR){
+        // Each source competes for dequeue turns by message size, within its own cap.
+        // A datagram pushed out of a full queue for a quieter source counts as a queue-full drop.
+        uint64_t key = sourceHash(datagram.srcaddr);
+        size_t cost = std::max<size_t>(1, datagram.msg.size());
+        uint64_t pushouts = _fairqueue->pushOuts();
+        bool queued = _fairqueue->push(key, std::move(datagram), cost);
+        _queuefulldrops.fetch_add(_fairqueue->pushOuts() - pushouts, std::memory_order_relaxed);
+        return queued;
+    }
+    if(_spill && (_rxqueue.size() >= _maxqueuesize || !_spill->empty())){
+        if(!_spill->push(datagram)){
+            return false;
+        }
+        _spilled.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if(_rxqueue.size() >= _maxqueuesize){
+        return false;
+    }
+    _rxqueue.push(std::move(datagram));
+    return true;
+}
+
+bool UDPNode::writeRxDatagramToConflation(const rxDatagram &datagram){
+    conflatedHeader header;
+    memset(&header, 0, sizeof header);
+    header.srcport = datagram.srcport;
+    header.time_stamp = datagram.time_stamp;
+    header.crc_checksum = datagram.crc_checksum;
+    header.priority = datagram.priority;
+    header.srcaddr = datagram.srcaddr;
+    header.srcaddrlen = datagram.srcaddrlen;
+    strncpy(header.srcipaddr, datagram.srcipaddr.c_str(), sizeof header.srcipaddr - 1);
+    strncpy(header.dstipaddr, datagram.dstipaddr.c_str(), sizeof header.dstipaddr - 1);
+    header.dstaddr = datagram.dstaddr;
+    header.dstport = datagram.dstport;
+    header.ifindex = datagram.ifindex;
+    header.rxsockfd = datagram.rxsockfd;
+    header.kerneldrops = datagram.kerneldrops;
+    header.arrivalns = datagram.arrivalns;
+    header.deadlinens = datagram.deadlinens;
+
+    uint64_t key = _options.keyextractor ? _options.keyextractor(datagram) : sourceHash(datagram.srcaddr);
+    bool conflated = false;
+    if(!_conflation->write(key, header, datagram.msg.data(), datagram.msg.size(), conflated)){
+        return false;
+    }
+    if(conflated){
+        _conflated.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void UDPNode::fromConflated(const conflatedHeader &header, std::string &&msg, rxDatagram &datagram){
+    datagram.srcport = header.srcport;
+    datagram.srcipaddr = header.srcipaddr;
+    datagram.time_stamp = header.time_stamp;
+    datagram.msg = std::move(msg);
+    datagram.crc_checksum = header.crc_checksum;
+    datagram.jointhread = false;
+    datagram.priority = header.priority;
+    datagram.srcaddr = header.srcaddr;
+    datagram.srcaddrlen = header.srcaddrlen;
+    datagram.dstipaddr = header.dstipaddr;
+    datagram.dstaddr = header.dstaddr;
+    datagram.dstport = header.dstport;
+    datagram.ifindex = header.ifindex;
+    datagram.rxsockfd = header.rxsockfd;
+    datagram.kerneldrops = header.kerneldrops;
+    datagram.arrivalns = header.arrivalns;
+    datagram.deadlinens = header.deadlinens;
+}
+
+uint64_t UDPNode::expiryClock(void){
+    if(!_deadlines.load(std::memory_order_relaxed)){
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool UDPNode::readLatest(uint64_t key, rxDatagram &datagram){
+    if(!_conflation){
+        return false;
+    }
+    conflatedHeader header;
+    std::string msg;
+    if(!_conflation->read(key, header, msg)){
+        return false;
+    }
+    fromConflated(header, std::move(msg), datagram);
+    return true;
+}
+
+bool UDPNode::writeRxDatagramToLane(rxDatagram &&datagram){
+    priorityLane &lane = *_lanes[std::min<size_t>(datagram.priority, _lanes.size() - 1)];
+
+    // The ring holds exactly the lane capacity, so a failed push means the lane is full.
+    for(int attempt = 0; attempt < 4; attempt++){
+        if(lane.ring.push(std::move(datagram))){
+            lane.enqueued.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        if(lane.policy != DROP_OLDEST){
+            break;
+        }
+        // Make room by discarding the stalest datagram of the lane.
+        rxDatagram stale;
+        if(lane.ring.pop(stale)){
+            lane.drops.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    lane.drops.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+std::vector<laneStats> UDPNode::getLaneStats(void){
+    std::vector<laneStats> stats;
+    for(auto &lane : _lanes){
+        laneStats ls;
+        ls.depth = lane->ring.size();
+        ls.capacity = lane->capacity;
+        ls.enqueued = lane->enqueued.load(std::memory_order_relaxed);
+        ls.drops = lane->drops.load(std::memory_order_relaxed);
+        stats.push_back(ls);
+    }
+    return stats;
+}
+
+bool UDPNode::writeRxDatagramToPartition(rxDatagram &&datagram){
+    // Equal keys always map to the same partition, which keeps their order.
+    uint64_t key = _options.keyextractor ? _options.keyextractor(datagram) : sourceHash(datagram.srcaddr);
+    rxPartition &part = *_partitions[key % _partitions.size()];
+
+    std::lock_guard<std::mutex> lock(part.mtx);
+    if(part.queue.size() >= _maxqueuesize){
+        part.drops++;
+        return false;
+    }
+    part.queue.push(std::move(datagram));
+    part.enqueued++;
+    part.highwatermark = std::max(part.highwatermark, part.queue.size());
+    return true;
+}
+
+// get sockaddr, IPv4 or IPv6:
+void * UDPNode::getInAddr(struct sockaddr *sa){
+    if (sa->sa_family == AF_INET) {
+        return &(((struct sockaddr_in*)sa)->sin_addr);
+    }
+    
+    return &(((struct sockaddr_in6*)sa)->sin6_addr);
+}
+
+uint16_t UDPNode::getInPort(struct sockaddr *sa){
+    if (sa->sa_family == AF_INET) {
+        return (((struct sockaddr_in*)sa)->sin_port);
+    }
+    
+    return (((struct sockaddr_in6*)sa)->sin6_port);
+}
+
+bool UDPNode::isMulticastAddr(const struct sockaddr *sa){
+    if (sa->sa_family == AF_INET) {
+        return IN_MULTICAST(ntohl(((const struct sockaddr_in*)sa)->sin_addr.s_addr));
+    }
+    
+    return IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6*)sa)->sin6_addr);
+}
+
+err_code UDPNode::joinMulticastGroup(std::string group, std::string iface){
+    return setMulticastMembership(group, iface, true);
+}
+
+err_code UDPNode::leaveMulticastGroup(std::string group, std::string iface){
+    return setMulticastMembership(group, iface, false);
+}
+
+err_code UDPNode::setMulticastMembership(const std::string &group, const std::string &iface, bool join){
+    err_code fail_code = join ? MCAST_JOIN_FAILED : MCAST_LEAVE_FAILED;
+    if(_listensockfd == -1){
+        return fail_code;
+    }
+
+    if(_listenipver == ipv4){
+        struct ip_mreqn mreq;
+        memset(&mreq, 0, sizeof mreq);
+        if(inet_pton(AF_INET, group.c_str(), &mreq.imr_multiaddr) != 1){
+            std::cerr << "multicast: invalid IPv4 group " << group << std::endl;
+            return fail_code;
+        }
+        // The interface may be given by name or by one of its addresses.
+        if(!iface.empty() && inet_pton(AF_INET, iface.c_str(), &mreq.imr_address) != 1){
+            mreq.imr_ifindex = if_nametoindex(iface.c_str());
+            if(mreq.imr_ifindex == 0){
+                std::cerr << "multicast: unknown interface " << iface << std::endl;
+                return fail_code;
+            }
+        }
+        if(setsockopt(_listensockfd, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &mreq, sizeof mreq) == -1){
+            std::cerr << "multicast: " << strerror(errno) << std::endl;
+            return fail_code;
+        }
+    } else {
+        struct ipv6_mreq mreq;
+        memset(&mreq, 0, sizeof mreq);
+        if(inet_pton(AF_INET6, group.c_str(), &mreq.ipv6mr_multiaddr) != 1){
+            std::cerr << "multicast: invalid IPv6 group " << group << std::endl;
+            return fail_code;
+        }
+        if(!iface.empty()){
+            mreq.ipv6mr_interface = if_nametoindex(iface.c_str());
+            if(mreq.ipv6mr_interface == 0){
+                std::cerr << "multicast: unknown interface " << iface << std::endl;
+                return fail_code;
+            }
+        }
+        if(setsockopt(_listensockfd, IPPROTO_IPV6, join ? IPV6_JOIN_GROUP : IPV6_LEAVE_GROUP, &mreq, sizeof mreq) == -1){
+            std::cerr << "multicast: " << strerror(errno) << std::endl;
+            return fail_code;
+        }
+    }
+
+    if(_debug){
+        std::cout << (join ? "joined" : "left") << " multicast group " << group << std::endl;
+    }
+    return SUCCESS;
+}
+
+err_code UDPNode::applyMulticastTxOptions(int sockfd, int family){
+    int ttl = _options.mcastttl;
+    int loop = _options.mcastloop ? 1 : 0;
+
+    if(family == AF_INET){
+        unsigned char cttl = static_cast<unsigned char>(ttl);
+        unsigned char cloop = static_cast<unsigned char>(loop);
+        if(setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &cttl, sizeof cttl) == -1 ||
+           setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &cloop, sizeof cloop) == -1){
+            return SETSOCKOPT_FAILED;
+        }
+        if(!_options.mcastiface.empty()){
+            struct ip_mreqn mreq;
+            memset(&mreq, 0, sizeof mreq);
+            if(inet_pton(AF_INET, _options.mcastiface.c_str(), &mreq.imr_address) != 1){
+                mreq.imr_ifindex = if_nametoindex(_options.mcastiface.c_str());
+            }
+            if(setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof mreq) == -1){
+                return SETSOCKOPT_FAILED;
+            }
+        }
+    } else {
+        if(setsockopt(sockfd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof ttl) == -1 ||
+           setsockopt(sockfd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof loop) == -1){
+            return SETSOCKOPT_FAILED;
+        }
+        if(!_options.mcastiface.empty()){
+            unsigned int ifindex = if_nametoindex(_options.mcastiface.c_str());
+            if(setsockopt(sockfd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof ifindex) == -1){
+                return SETSOCKOPT_FAILED;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+bool  UDPNode::rxDataAvailable(){
+    if(_options.rxqueuemode == RXQ_PRIORITY){
+        for(auto &lane : _lanes){
+            if(lane->ring.size() > 0){
+                return true;
+            }
+        }
+        return false;
+    }
+    if(_options.rxqueuemode == RXQ_CONFLATED){
+        return _conflation->updated() > 0;
+    }
+    if(_options.rxqueuemode == RXQ_FAIR){
+        std::lock_guard<std::mutex> lock(_mtx);
+        return !_fairqueue->empty();
+    }
+    if(_options.rxqueuemode == RXQ_PARTITIONED){
+        for(unsigned int p = 0; p < _partitions.size(); p++){
+            if(rxPartitionDataAvailable(p)){
+                return true;
+            }
+        }
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    return !_rxqueue.empty() || (_spill && !_spill->empty());
+}
+
+int  UDPNode::rxDataQueueSize(){
+    if(_options.rxqueuemode == RXQ_PRIORITY){
+        size_t total = 0;
+        for(auto &lane : _lanes){
+            total += lane->ring.size();
+        }
+        return total;
+    }
+    if(_options.rxqueuemode == RXQ_CONFLATED){
+        return _conflation->updated();
+    }
+    if(_options.rxqueuemode == RXQ_FAIR){
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _fairqueue->size();
+    }
+    if(_options.rxqueuemode == RXQ_PARTITIONED){
+        int total = 0;
+        for(unsigned int p = 0; p < _partitions.size(); p++){
+            total += rxPartitionQueueSize(p);
+        }
+        return total;
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _rxqueue.size() + (_spill ? _spill->size() : 0);
+}
+
+unsigned int UDPNode::rxPartitionCount(void){
+    return _partitions.size();
+}
+
+bool UDPNode::rxPartitionDataAvailable(unsigned int partition){
+    if(partition >= _partitions.size()){
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_partitions[partition]->mtx);
+    return !_partitions[partition]->queue.empty();
+}
+
+int UDPNode::rxPartitionQueueSize(unsigned int partition){
+    if(partition >= _partitions.size()){
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(_partitions[partition]->mtx);
+    return _partitions[partition]->queue.size();
+}
+
+rxDatagram UDPNode::readRxDatagramFromPartition(unsigned int partition){
+    rxDatagram retval;
+    if(partition >= _partitions.size()){
+        return retval;
+    }
+    rxPartition &part = *_partitions[partition];
+    uint64_t now = expiryClock();
+    std::lock_guard<std::mutex> lock(part.mtx);
+    while(!part.queue.empty()){
+        bool expired = isExpired(part.queue.front(), now);
+        if(!expired){
+            retval = std::move(part.queue.front());
+        }
+        part.queue.pop();
+        if(!expired){
+            break;
+        }
+    }
+    return retval;
+}
+
+std::vector<partitionStats> UDPNode::getPartitionStats(void){
+    std::vector<partitionStats> stats;
+    for(auto &part : _partitions){
+        std::lock_guard<std::mutex> lock(part->mtx);
+        partitionStats ps;
+        ps.depth = part->queue.size();
+        ps.highwatermark = part->highwatermark;
+        ps.enqueued = part->enqueued;
+        ps.drops = part->drops;
+        stats.push_back(ps);
+    }
+    return stats;
+}
+
+void UDPNode::setFairQueueLimits(unsigned int sourcecap, unsigned int quantum){
+    std::lock_guard<std::mutex> lock(_mtx);
+    _options.fairsourcecap = sourcecap;
+    _options.fairquantum = quantum;
+    if(_fairqueue){
+        _fairqueue->setLimits(sourcecap > 0 ? sourcecap : _maxqueuesize, quantum > 0 ? quantum : _maxmessagesize);
+    }
+}
+
+void UDPNode::setSourceRateLimit(double rate, double burst){
+    std::lock_guard<std::mutex> lock(_ratemtx);
+    _options.sourcerate = rate;
+    _options.sourceburst = burst;
+    _ratelimiting = rate > 0 || _ratecustomsources > 0;
+}
+
+err_code UDPNode::setSourceRateLimit(std::string ipaddr, double rate, double burst){
+    uint8_t addr[16];
+    if(!parseRateKey(ipaddr, addr)){
+        return GETADDRINFO_FAILED;
+    }
+    std::lock_guard<std::mutex> lock(_ratemtx);
+    rateBucket *b = findRateBucket(addr, true);
+    if(b == nullptr && _options.sourcerate > 0){
+        // Idle default buckets make room, as for a new source in admitSource().
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        sweepRateTable(now, true);
+        b = findRateBucket(addr, true);
+    }
+    if(b == nullptr){
+        return RATE_TABLE_FULL;
+    }
+    if(!b->custom){
+        _ratecustomsources++;
+    }
+    b->custom = true;
+    b->rate = rate;
+    b->burst = burst > 0 ? burst : rate;
+    b->tokens = b->burst;
+    _ratelimiting = true;
+    return SUCCESS;
+}
+
+err_code UDPNode::clearSourceRateLimit(std::string ipaddr){
+    uint8_t addr[16];
+    if(!parseRateKey(ipaddr, addr)){
+        return GETADDRINFO_FAILED;
+    }
+    std::lock_guard<std::mutex> lock(_ratemtx);
+    rateBucket *b = findRateBucket(addr, false);
+    if(b != nullptr && b->custom){
+        b->custom = false;
+        _ratecustomsources--;
+    }
+    _ratelimiting = _options.sourcerate > 0 || _ratecustomsources > 0;
+    return SUCCESS;
+}
+
+std::vector<sourceRateStats> UDPNode::topRateLimitedSources(size_t count){
+    std::vector<sourceRateStats> top;
+    std::lock_guard<std::mutex> lock(_ratemtx);
+
+    // A source swept out and tracked again has counts in both places.
+    std::unordered_map<std::string, size_t> index;
+    auto add = [&](const rateBucket &b, const std::string &ipaddr){
+        auto it = index.find(ipaddr);
+        if(it == index.end()){
+            it = index.emplace(ipaddr, top.size()).first;
+            sourceRateStats st;
+            st.ipaddr = ipaddr;
+            st.admitted = 0;
+            st.rejected = 0;
+            top.push_back(st);
+        }
+        top[it->second].admitted += b.admitted;
+        top[it->second].rejected += b.rejected;
+    };
+    auto name = [](const uint8_t *addr){
+        char s[INET6_ADDRSTRLEN];
+        if(IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)addr)){
+            inet_ntop(AF_INET, addr + 12, s, sizeof s);
+        } else {
+            inet_ntop(AF_INET6, addr, s, sizeof s);
+        }
+        return std::string(s);
+    };
+    for(const auto &b : _ratetable){
+        if(b.used && b.rejected > 0){
+            add(b, name(b.addr));
+        }
+    }
+    for(const auto &b : _rateoffenders){
+        add(b, name(b.addr));
+    }
+    if(_rateoverflow.rejected > 0){
+        add(_rateoverflow, "*");
+    }
+    size_t n = std::min(count, top.size());
+    std::partial_sort(top.begin(), top.begin() + n, top.end(), [](const sourceRateStats &a, const sourceRateStats &b){
+        return a.rejected > b.rejected;
+    });
+    top.resize(n);
+    return top;
+}
+
+bool UDPNode::admitSource(const struct sockaddr_storage &srcaddr, int64_t now){
+    uint8_t addr[16];
+    if(srcaddr.ss_family == AF_INET){
+        // IPv4 sources are keyed as IPv4-mapped addresses so dual-stack peers share one bucket.
+        memset(addr, 0, 10);
+        addr[10] = addr[11] = 0xff;
+        memcpy(addr + 12, &((const struct sockaddr_in *)&srcaddr)->sin_addr, 4);
+    } else if(srcaddr.ss_family == AF_INET6){
+        memcpy(addr, &((const struct sockaddr_in6 *)&srcaddr)->sin6_addr, 16);
+    } else {
+        return true;
+    }
 
-    struct addrinfo hints;  // Hints for getaddrinfo.
-    int rv;                 // Return value for getaddrinfo.
-    struct addrinfo *rxservinfo;  // Linked list of results from getaddrinfo.
-    struct addrinfo  *rx_p;       // Pointer to iterate over results.
-    err_code error_code = SUCCESS; // Initialize error code to success.
-    
-     // Zero out the hints structure.
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family =  _listenipver == ipv4 ? AF_INET: AF_INET6; // set to AF_INET to use IPv4
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_flags = AI_PASSIVE; // use my IP
+    std::lock_guard<std::mutex> lock(_ratemtx);
+    rateBucket *b = findRateBucket(addr, _options.sourcerate > 0);
+    if(b == nullptr){
+        if(_options.sourcerate <= 0){
+            return true;
+        }
 
-       // Get address info for the local machine.
-    if ((rv = getaddrinfo(NULL, std::to_string(_listenport).c_str(), &hints, &rxservinfo)) != 0) {
-        std::cerr << "getaddrinfo: " << gai_strerror(rv) << std::endl;
-        error_code = GETADDRINFO_FAILED;
+        // A full table makes room from idle sources; new sources it still cannot track share one bucket,
+        // so a flood of spoofed addresses is limited as a whole instead of admitted.
+        sweepRateTable(now);
+        b = findRateBucket(addr, true);
+        if(b == nullptr){
+            b = &_rateoverflow;
+        }
+    }
+    double rate = b->custom ? b->rate : _options.sourcerate;
+    double burst = b->custom ? b->burst : (_options.sourceburst > 0 ? _options.sourceburst : _options.sourcerate);
+    if(rate <= 0){
+        b->admitted++;
+        return true;
     }
 
-    // loop through all the results and bind to the first we can
-    for(rx_p = rxservinfo; rx_p != NULL; rx_p = rx_p->ai_next) {
-        if ((_listensockfd = socket(rx_p->ai_family, rx_p->ai_socktype,rx_p->ai_protocol)) == -1) {
-            error_code = SOCKET_CONN_FAILED;
-            continue;
+    // Refill for the time elapsed since the last datagram of this source.
+    if(b->last != 0){
+        b->tokens = std::min(burst, b->tokens + (now - b->last) * 1e-9 * rate);
+    } else {
+        b->tokens = burst;
+    }
+    b->last = now;
+    if(b->tokens >= 1.0){
+        b->tokens -= 1.0;
+        b->admitted++;
+        return true;
+    }
+    b->rejected++;
+    return false;
+}
+
+UDPNode::rateBucket *UDPNode::findRateBucket(const uint8_t *addr, bool insert){
+    if(_ratetable.empty()){
+        if(!insert){
+            return nullptr;
+        }
+        _ratetable.resize(1024);
+    }
+    size_t mask = _ratetable.size() - 1;
+    uint64_t h = 1469598103934665603ULL;
+    for(int i = 0; i < 16; i++){
+        h = (h ^ addr[i]) * 1099511628211ULL;
+    }
+    size_t idx = h & mask;
+    while(_ratetable[idx].used){
+        if(memcmp(_ratetable[idx].addr, addr, 16) == 0){
+            return &_ratetable[idx];
         }
+        idx = (idx + 1) & mask;
+    }
+    if(!insert){
+        return nullptr;
+    }
 
-        if (bind(_listensockfd, rx_p->ai_addr, rx_p->ai_addrlen) == -1) {
-            close(_listensockfd);
-            _listensockfd = -1;
-            //std::cerr <<"Rx: Failed to bind socket" << std::endl;
-            error_code = BIND_FAILED ;
-            continue;
+    // Keep the load factor under one half; past the size limit new sources go untracked.
+    if(_rateused >= _options.ratelimitsources){
+        return nullptr;
+    }
+    if((_rateused + 1) * 2 > _ratetable.size()){
+        if(_ratetable.size() * 2 > std::max<size_t>(1024, _options.ratelimitsources * 2)){
+            return nullptr;
         }
-        
-        break;
+        std::vector<rateBucket> old;
+        old.swap(_ratetable);
+        _ratetable.resize(old.size() * 2);
+        _rateused = 0;
+        for(const auto &b : old){
+            if(b.used){
+                *findRateBucket(b.addr, true) = b;
+            }
+        }
+        return findRateBucket(addr, true);
     }
+    rateBucket &b = _ratetable[idx];
+    b.used = true;
+    memcpy(b.addr, addr, 16);
+    _rateused++;
+    return &b;
+}
 
-    // If no socket was bound, return the last error encountered.
-    if (rx_p == NULL) {
-        return error_code;
+void UDPNode::sweepRateTable(int64_t now, bool force){
+    double rate = _options.sourcerate;
+    double burst = _options.sourceburst > 0 ? _options.sourceburst : rate;
+    int64_t refill = (int64_t)(burst / rate * 1e9);
+    if(!force && _ratesweep != 0 && now - _ratesweep < refill){
+        return;
     }
+    _ratesweep = now;
 
-    std::cout << "listening on port: "<< _listenport << "..."<<std::endl;
-    
-    // Free the linked list.
-    freeaddrinfo(rxservinfo);
-    rxservinfo = nullptr;
-    
-    rx_p = nullptr;
-    return error_code;
+    std::vector<rateBucket> old;
+    old.swap(_ratetable);
+    _ratetable.resize(old.size());
+    _rateused = 0;
+    for(const auto &b : old){
+        if(b.used && (b.custom || (b.last != 0 && now - b.last < refill))){
+            *findRateBucket(b.addr, true) = b;
+        } else if(b.used && b.rejected > 0){
+            recordRateOffender(b);
+        }
+    }
 }
 
-UDPNode::~UDPNode(void){
-
-    endRxLoop(); // Ensure the receive loop is stopped
-    if(_rxthread.joinable()){
-        _rxthread.join();
+void UDPNode::recordRateOffender(const rateBucket &b){
+    // Sweeps run when the table is full, during an incident; its offenders must outlive their buckets.
+    rateBucket *least = nullptr;
+    for(auto &o : _rateoffenders){
+        if(memcmp(o.addr, b.addr, 16) == 0){
+            o.admitted += b.admitted;
+            o.rejected += b.rejected;
+            return;
+        }
+        if(least == nullptr || o.rejected < least->rejected){
+            least = &o;
+        }
     }
-    std::cout << "closing listening socket and exiting..." << std::endl;
-    
-    // Close the listening and sending sockets.
-    if (_listensockfd != -1){
-        close(_listensockfd);
-        _listensockfd = -1;
+    if(_rateoffenders.size() < RATE_OFFENDERS){
+        _rateoffenders.push_back(b);
+    } else if(least->rejected < b.rejected){
+        *least = b;
     }
-    if (_sendsockfd != -1){
-        close(_sendsockfd);
-        _sendsockfd = -1;
+}
+
+bool UDPNode::parseRateKey(const std::string &ipaddr, uint8_t *addr){
+    struct in_addr a4;
+    if(inet_pton(AF_INET, ipaddr.c_str(), &a4) == 1){
+        memset(addr, 0, 10);
+        addr[10] = addr[11] = 0xff;
+        memcpy(addr + 12, &a4, 4);
+        return true;
     }
+    return inet_pton(AF_INET6, ipaddr.c_str(), addr) == 1;
 }
 
-void UDPNode::startRxLoop(void){
-     // Start the receive loop in a separate thread.
-    _stoprecvthread = false;
-    _rxthread = std::thread(&UDPNode::rxLoop, this);
+err_code UDPNode::setRxFilter(const std::string &expression){
+    std::string error;
+    std::shared_ptr<const RxFilter> filter = RxFilter::compile(expression, &error);
+    if(!filter){
+        std::cerr << "setRxFilter: " << error << std::endl;
+        return FILTER_EXPR_INVALID;
+    }
+    _rxfilter.store(std::move(filter), std::memory_order_release);
+    _filtering.store(true, std::memory_order_release);
+    return SUCCESS;
 }
 
-void UDPNode::endRxLoop(void){
-    // Set the atomic flag to true to stop the receive loop.
-    _stoprecvthread = true;
-    //send a datagram to the listening thread to unblock recvfrom
-    tx(_listenport, _listenipver, "localhost","Goodbye",true);   
-    
-    // If the receive thread is joinable, join it.
-    if(_rxthread.joinable()){
-        _rxthread.join();
+void UDPNode::clearRxFilter(void){
+    _filtering.store(false, std::memory_order_release);
+    _rxfilter.store(nullptr, std::memory_order_release);
+}
+
+rxStats UDPNode::getRxStats(){
+    rxStats stats;
+    stats.received = _received.load(std::memory_order_relaxed);
+    stats.queued = _queued.load(std::memory_order_relaxed);
+    stats.parsedrops = _parsedrops.load(std::memory_order_relaxed);
+    stats.crcdrops = _crcdrops.load(std::memory_order_relaxed);
+    stats.queuefulldrops = _queuefulldrops.load(std::memory_order_relaxed);
+    stats.kerneldrops = _kerneldrops.load(std::memory_order_relaxed);
+    stats.pipelinedrops = _pipelinedrops.load(std::memory_order_relaxed);
+    stats.ratelimitdrops = _ratelimitdrops.load(std::memory_order_relaxed);
+    stats.filterpassed = _filterpassed.load(std::memory_order_relaxed);
+    stats.filterdrops = _filterdrops.load(std::memory_order_relaxed);
+    stats.conflated = _conflated.load(std::memory_order_relaxed);
+    stats.expireddrops = _expireddrops.load(std::memory_order_relaxed);
+    stats.spilled = _spilled.load(std::memory_order_relaxed);
+    stats.journaled = _journal ? _journal->records() : 0;
+    stats.journaldrops = _journal ? _journal->drops() : 0;
+    stats.shmreceived = _shmreceived.load(std::memory_order_relaxed);
+    stats.loopbackreceived = _loopbackreceived.load(std::memory_order_relaxed);
+    stats.activesources = 0;
+    if(_fairqueue){
+        std::lock_guard<std::mutex> lock(_mtx);
+        stats.activesources = _fairqueue->activeSources();
+    }
+    stats.rcvbuf = 0;
+    if(_listensockfd != -1){
+        socklen_t len = sizeof stats.rcvbuf;
+        getsockopt(_listensockfd, SOL_SOCKET, SO_RCVBUF, &stats.rcvbuf, &len);
     }
 
-    if (_listensockfd != -1){
-        close(_listensockfd);
-        _listensockfd = -1;
+    // The receive thread's own CPU clock, so callers can weigh a wait strategy apart from their own threads.
+    stats.rxcpuns = 0;
+    clockid_t cid;
+    struct timespec ts;
+    if(_rxthread.joinable() && pthread_getcpuclockid(_rxthread.native_handle(), &cid) == 0 && clock_gettime(cid, &ts) == 0){
+        stats.rxcpuns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
     }
+    return stats;
 }
 
-void UDPNode::rxLoop(void){
-    int numbytes;       // Number of bytes received.
-    err_code error_code = SUCCESS;
-    struct sockaddr_storage their_addr; // Address of the sender.
-    std::unique_ptr<char[]> buf(new char[_maxmessagesize]);
-    socklen_t addr_len;
-    addr_len = sizeof their_addr;
-    while(!_stoprecvthread){
-        
-        if(_debug){
-            std::cout << "rxloop: In loop" << std::endl;
-        }
-
-        memset(buf.get(),0,_maxmessagesize);
-        numbytes = recvfrom(_listensockfd, buf.get(), _maxmessagesize-1 , 0,(struct sockaddr *)&their_addr, &addr_len);
-        if (numbytes == -1) {
-            error_code = RECVFROM_FAILED;
-            break;
-        } else if ( numbytes > 0){   
+rxDatagram  UDPNode::readRxDatagramFromQueue(){
+    // Expired datagrams are skipped in the same pass, under the lock the dequeue takes anyway.
+    uint64_t now = expiryClock();
 
-            buf[numbytes] = '\0';
-            if(_debug){
-                inspectRxBuffer(their_addr, buf.get(),  numbytes); 
+    // Higher lanes are always drained first; no lock is taken.
+    if(_options.rxqueuemode == RXQ_PRIORITY){
+        rxDatagram retval;
+        for(size_t l = _lanes.size(); l-- > 0;){
+            while(_lanes[l]->ring.pop(retval)){
+                if(!isExpired(retval, now)){
+                    return retval;
+                }
             }
+        }
+        return rxDatagram();
+    }
 
-            // Create a new datagram structure to store the received data.
-            rxDatagram datagram;
-            error_code = parseDatagram(their_addr, buf.get(), numbytes, datagram);
-            if(error_code != SUCCESS){
-                std::cerr << errorMsg(error_code) << std::endl;
-                break;
-            }
-            
-            // Validate the CRC checksum.
-            if(!isDatagramValid(datagram)){
-                std::cerr << "rxloop: CRC Checksum invalid. Discarding... " << std::endl;
+    // Partitioned consumers that do not care about the partition take from the next non-empty one.
+    if(_options.rxqueuemode == RXQ_PARTITIONED){
+        for(size_t i = 0; i < _partitions.size(); i++){
+            unsigned int p = _nextpartition.fetch_add(1, std::memory_order_relaxed) % _partitions.size();
+            if(rxPartitionDataAvailable(p)){
+                return readRxDatagramFromPartition(p);
             }
+        }
+        return rxDatagram();
+    }
 
-            if( rxDataQueueSize() >=  _maxqueuesize){
-                std::cerr << "rxloop: Datagram Receive queue is full. Discarding incoming datagrams..." << std::endl;
+    // Conflated consumers get the latest datagram of the next updated key, without a lock.
+    if(_options.rxqueuemode == RXQ_CONFLATED){
+        rxDatagram retval;
+        conflatedHeader header;
+        std::string msg;
+        uint64_t key;
+        while(_conflation->popUpdated(key, header, msg)){
+            fromConflated(header, std::move(msg), retval);
+            if(!isExpired(retval, now)){
+                return retval;
             }
+        }
+        return rxDatagram();
+    }
 
-            /*
-
-            if(datagram.jointhread){
-                std::cerr << "Need to exit thread, breaking while " << std::endl;
-                break;
-            } 
-            
-            */
-           
-           // Write the datagram to the receive queue.
-            if(datagram.jointhread == false && _rxqueue.size() < _maxqueuesize && isDatagramValid(datagram) ){
-                writeRxDatagramToQueue(datagram);
+    std::lock_guard<std::mutex> lock(_mtx);
+    rxDatagram retval;
+    if(_options.rxqueuemode == RXQ_FAIR){
+        while(_fairqueue->pop(retval)){
+            if(!isExpired(retval, now)){
+                return retval;
             }
         }
+        return rxDatagram();
     }
-    if(_debug){
-        std::cout << "rxloop: Exiting recv thread..." << std::endl;
+    while(!_rxqueue.empty()){
+        retval = std::move(_rxqueue.front());
+        _rxqueue.pop();
+        if(!isExpired(retval, now)){
+            return retval;
+        }
     }
 
-    if(error_code != SUCCESS){
-        std::cerr << errorMsg(error_code) << std::endl;
+    // Everything in memory is older than what was spilled, so the spill is read next.
+    while(_spill && _spill->pop(retval)){
+        if(!isExpired(retval, now)){
+            return retval;
+        }
     }
-    
-}
-
-void UDPNode::writeRxDatagramToQueue(const rxDatagram &datagram){
-    std::lock_guard<std::mutex> lock(_mtx);
-    _rxqueue.push(datagram);
+    return rxDatagram();
 }
 
-// get sockaddr, IPv4 or IPv6:
-void * UDPNode::getInAddr(struct sockaddr *sa){
-    if (sa->sa_family == AF_INET) {
-        return &(((struct sockaddr_in*)sa)->sin_addr);
+err_code UDPNode::tx(int destport, ipFamily ver, std::string host, std::string msg, bool jointhread, unsigned int priority){
+    // Unix destinations are socket paths and need no resolution.
+    if(ver == unixdgram){
+        return txUnix(host, msg, jointhread, priority);
     }
-    
-    return &(((struct sockaddr_in6*)sa)->sin6_addr);
-}
 
-uint16_t UDPNode::getInPort(struct sockaddr *sa){
-    if (sa->sa_family == AF_INET) {
-        return (((struct sockaddr_in*)sa)->sin_port);
+    // A node on a transport sends through it, and the transport resolves the host instead of DNS.
+    if(_options.transport){
+        struct sockaddr_storage dst;
+        if(!_options.transport->resolve(host, destport, ver == ipv4 ? AF_INET : AF_INET6, dst)){
+            std::cerr << "tx: unknown host on the transport: " << host << std::endl;
+            return GETADDRINFO_FAILED;
+        }
+        rapidjson::StringBuffer s = serialize(msg, jointhread, priority);
+        if(!_options.transport->send(_transportaddr, dst, s.GetString(), s.GetSize())){
+            return SENDTO_FAILED;
+        }
+        if(_debug){
+            std::cout << "tx: sent "<< s.GetSize() <<" bytes to " << host << ":" << destport << " over the transport" << std::endl;
+        }
+        return SUCCESS;
     }
-    
-    return (((struct sockaddr_in6*)sa)->sin6_port);
-}
-
-bool  UDPNode::rxDataAvailable(){
-    std::lock_guard<std::mutex> lock(_mtx);
-    return !_rxqueue.empty();
-}
-
-int  UDPNode::rxDataQueueSize(){
-    std::lock_guard<std::mutex> lock(_mtx);
-    return _rxqueue.size();
-}
-
-rxDatagram  UDPNode::readRxDatagramFromQueue(){
-    std::lock_guard<std::mutex> lock(_mtx);
-    rxDatagram retval = _rxqueue.front();
-    _rxqueue.pop();
-    return retval;
-}
 
-err_code UDPNode::tx(int destport, ipFamily ver, std::string host, std::string msg, bool jointhread){
-    int numbytes;
+    int numbytes = -1;
     struct addrinfo hints;
     int rv;
+    // The temporary send socket is local, so concurrent tx() calls never share or close each other's.
+    int sockfd = -1, sendfd = -1;
     err_code error_code = SUCCESS;
     struct addrinfo *txservinfo, *tx_p;
     memset(&hints, 0, sizeof hints);
@@ -227,27 +2970,63 @@ err_code UDPNode::tx(int destport, ipFamily ver, std::string host, std::string m
 
 	if ((rv = getaddrinfo(host.c_str(), std::to_string(destport).c_str(), &hints, &txservinfo)) != 0) {
 		std::cerr << "tx: getaddrinfo: " << gai_strerror(rv) << std::endl;
-		error_code = GETADDRINFO_FAILED;
+		return GETADDRINFO_FAILED;
 	}
 
-	// loop through all the results and make a socket
-	for(tx_p = txservinfo; tx_p != NULL; tx_p = tx_p->ai_next) {
-		if ((_sendsockfd = socket(tx_p->ai_family, tx_p->ai_socktype,tx_p->ai_protocol)) == -1) {
-			continue;
-		}
+    // Nodes of this process get the message moved into their queue.
+    if(_options.loopbackshortcut && !jointhread && isLocalAddr(txservinfo->ai_addr)){
+        error_code = txLoopback(destport, txservinfo->ai_addr, msg, priority);
+        if(error_code != SOCKET_CONN_FAILED){
+            freeaddrinfo(txservinfo);
+            return error_code;
+        }
+        error_code = SUCCESS;
+    }
 
-		break;
-	}
+    // Same-host nodes accepting shared-memory peers get the datagram without the kernel or the JSON envelope.
+    if(_options.shmtransport && !jointhread && isLocalAddr(txservinfo->ai_addr)){
+        error_code = txShm(destport, txservinfo->ai_addr, msg, priority);
+        if(error_code != SOCKET_CONN_FAILED){
+            freeaddrinfo(txservinfo);
+            return error_code;
+        }
+        error_code = SUCCESS;
+    }
+
+    // Send from the listening socket when asked to and the families match,
+    // so the receiver can reply to our listening port.
+    if(_options.txfromlistensocket && _listensockfd != -1 && txservinfo->ai_family == _listenipver){
+        tx_p = txservinfo;
+        sockfd = _listensockfd;
+    } else {
+	    // loop through all the results and make a socket
+	    for(tx_p = txservinfo; tx_p != NULL; tx_p = tx_p->ai_next) {
+		    if ((sendfd = socket(tx_p->ai_family, tx_p->ai_socktype,tx_p->ai_protocol)) == -1) {
+			    continue;
+		    }
+
+		    break;
+	    }
 
-	if (tx_p == NULL) {
-		std::cerr << "tx: failed to create socket" << std::endl;
-        error_code = SOCKET_CONN_FAILED;
- 	}
+	    if (tx_p == NULL) {
+		    std::cerr << "tx: failed to create socket" << std::endl;
+            freeaddrinfo(txservinfo);
+            return SOCKET_CONN_FAILED;
+ 	    }
+        sockfd = sendfd;
+        if(_options.sndbuf > 0){
+            setSocketBufferSize(sockfd, SO_SNDBUF, _options.sndbuf);
+        }
+
+        if(isMulticastAddr(tx_p->ai_addr)){
+            error_code = applyMulticastTxOptions(sockfd, tx_p->ai_family);
+        }
+    }
     
-    rapidjson::StringBuffer s = serialize(msg, jointhread);
+    rapidjson::StringBuffer s = serialize(msg, jointhread, priority);
    
 	
-    if ((numbytes = sendto(_sendsockfd, s.GetString(), strlen(s.GetString()), 0, tx_p->ai_addr, tx_p->ai_addrlen)) == -1) {
+    if ((numbytes = sendto(sockfd, s.GetString(), s.GetSize(), 0, tx_p->ai_addr, tx_p->ai_addrlen)) == -1) {
 		error_code = SENDTO_FAILED;
 	}
 
@@ -259,14 +3038,252 @@ err_code UDPNode::tx(int destport, ipFamily ver, std::string host, std::string m
 	    std::cout << "tx: sent "<< numbytes <<" bytes to " << host << ":" << destport << std::endl;
     }
 
-    if(_sendsockfd != -1){
-        close(_sendsockfd);
-        _sendsockfd = -1;
+    if(sendfd != -1){
+        close(sendfd);
     }
     
     return error_code;
 }
 
+err_code UDPNode::txUnix(const std::string &path, const std::string &msg, bool jointhread, unsigned int priority){
+    struct sockaddr_un addr;
+    socklen_t addrlen = unixAddress(path, addr);
+    if(addrlen == 0){
+        return GETADDRINFO_FAILED;
+    }
+
+    // Send from the node's own Unix socket when it has one, so the receiver can reply to it.
+    int sockfd = -1;
+    for(const auto &ls : _listensockets){
+        if(ls.family == AF_UNIX){
+            sockfd = ls.fd;
+            break;
+        }
+    }
+    bool throwaway = sockfd == -1;
+    if(throwaway && (sockfd = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1){
+        std::cerr << "tx: failed to create socket" << std::endl;
+        return SOCKET_CONN_FAILED;
+    }
+
+    // A full receiver blocks Unix senders; fail instead, as a full UDP receiver would drop.
+    err_code error_code = SUCCESS;
+    rapidjson::StringBuffer s = serialize(msg, jointhread, priority);
+    int numbytes = sendto(sockfd, s.GetString(), s.GetSize(), MSG_DONTWAIT, (struct sockaddr *)&addr, addrlen);
+    if(numbytes == -1){
+        error_code = SENDTO_FAILED;
+    }
+    if(throwaway){
+        close(sockfd);
+    }
+    if(_debug){
+        std::cout << "tx: sent "<< numbytes <<" bytes to " << path << std::endl;
+    }
+    return error_code;
+}
+
+err_code UDPNode::reply(const rxDatagram &datagram, std::string msg, unsigned int priority){
+    if(_options.transport){
+        rapidjson::StringBuffer s = serialize(msg, false, priority);
+        return _options.transport->send(_transportaddr, datagram.srcaddr, s.GetString(), s.GetSize()) ? SUCCESS : SENDTO_FAILED;
+    }
+
+    // Answer from the socket the datagram arrived on.
+    int sockfd = datagram.rxsockfd != -1 ? datagram.rxsockfd : _listensockfd;
+    if(sockfd == -1){
+        return SOCKET_CONN_FAILED;
+    }
+
+    rapidjson::StringBuffer s = serialize(msg, false, priority);
+    if (sendto(sockfd, s.GetString(), s.GetSize(), 0, (const struct sockaddr *)&datagram.srcaddr, datagram.srcaddrlen) == -1) {
+        return SENDTO_FAILED;
+    }
+
+    if(_debug){
+        std::cout << "reply: sent "<< s.GetSize() <<" bytes to " << datagram.srcipaddr << ":" << datagram.srcport << std::endl;
+    }
+    return SUCCESS;
+}
+
+err_code UDPNode::txGroup(DestinationGroup &group, std::string msg, bool jointhread, unsigned int priority){
+    err_code error_code = SUCCESS;
+    if(group._members.empty()){
+        return error_code;
+    }
+
+    // Serialize once; every message header shares the same iovec.
+    rapidjson::StringBuffer s = serialize(msg, jointhread, priority);
+    if(_options.transport){
+        for(auto &ep : group._members){
+            ep.lasterror = _options.transport->send(_transportaddr, ep.addr, s.GetString(), s.GetSize()) ? SUCCESS : SENDTO_FAILED;
+            if(ep.lasterror != SUCCESS){
+                error_code = SENDTO_FAILED;
+            }
+        }
+        return error_code;
+    }
+    struct iovec iov;
+    iov.iov_base = const_cast<char *>(s.GetString());
+    iov.iov_len = s.GetSize();
+
+    std::vector<struct mmsghdr> msgs;
+    std::vector<size_t> memberidx;
+    msgs.reserve(group._members.size());
+    memberidx.reserve(group._members.size());
+
+    // One batch per address family, as a socket can only send to its own family.
+    for(int family : {AF_INET, AF_INET6, AF_UNIX}){
+        msgs.clear();
+        memberidx.clear();
+        bool multicast = false;
+        for(size_t i = 0; i < group._members.size(); i++){
+            txEndpoint &ep = group._members[i];
+            if(ep.addr.ss_family != family){
+                continue;
+            }
+            struct mmsghdr m;
+            memset(&m, 0, sizeof m);
+            m.msg_hdr.msg_name = &ep.addr;
+            m.msg_hdr.msg_namelen = ep.addrlen;
+            m.msg_hdr.msg_iov = &iov;
+            m.msg_hdr.msg_iovlen = 1;
+            msgs.push_back(m);
+            memberidx.push_back(i);
+            multicast = multicast || isMulticastAddr((struct sockaddr *)&ep.addr);
+        }
+        if(msgs.empty()){
+            continue;
+        }
+
+        // Unix members are sent from the node's own Unix socket when it has one, so they can reply, as in txUnix().
+        int sockfd = -1;
+        bool ownsocket = false;
+        if(family == AF_UNIX){
+            for(const auto &ls : _listensockets){
+                if(ls.family == AF_UNIX){
+                    sockfd = ls.fd;
+                    break;
+                }
+            }
+        } else if(_options.txfromlistensocket && _listensockfd != -1 && family == _listenipver){
+            sockfd = _listensockfd;
+        }
+        if(sockfd == -1){
+            if((sockfd = socket(family, SOCK_DGRAM, 0)) == -1){
+                for(size_t i : memberidx){
+                    group._members[i].lasterror = SOCKET_CONN_FAILED;
+                }
+                error_code = SOCKET_CONN_FAILED;
+                continue;
+            }
+            ownsocket = true;
+            if(_options.sndbuf > 0){
+                setSocketBufferSize(sockfd, SO_SNDBUF, _options.sndbuf);
+            }
+            if(multicast){
+                applyMulticastTxOptions(sockfd, family);
+            }
+        }
+
+        // sendmmsg() stops at the first failing message; record it and carry on with the rest.
+        // A full Unix receiver would block the sender; it fails instead, as a full UDP receiver would drop.
+        int flags = family == AF_UNIX ? MSG_DONTWAIT : 0;
+        size_t off = 0;
+        while(off < msgs.size()){
+            int sent = sendmmsg(sockfd, &msgs[off], msgs.size() - off, flags);
+            if(sent <= 0){
+                group._members[memberidx[off]].lasterror = SENDTO_FAILED;
+                error_code = SENDTO_FAILED;
+                off++;
+                continue;
+            }
+            for(int k = 0; k < sent; k++){
+                group._members[memberidx[off + k]].lasterror = SUCCESS;
+            }
+            off += sent;
+        }
+
+        if(ownsocket){
+            close(sockfd);
+        }
+    }
+
+    if(_debug){
+        std::cout << "txGroup: sent "<< s.GetSize() <<" bytes to " << group._members.size() - group.failedCount() << " of " << group._members.size() << " members" << std::endl;
+    }
+    return error_code;
+}
+
+err_code DestinationGroup::add(int destport, ipFamily ver, std::string host){
+    txEndpoint ep;
+    ep.host = host;
+    ep.port = destport;
+    memset(&ep.addr, 0, sizeof ep.addr);
+    ep.lasterror = SUCCESS;
+
+    // A Unix member needs no resolution; its address is the socket path.
+    if(ver == unixdgram){
+        ep.addrlen = UDPNode::unixAddress(host, *(struct sockaddr_un *)&ep.addr);
+        if(ep.addrlen == 0){
+            std::cerr << "DestinationGroup: invalid socket path: " << host << std::endl;
+            return GETADDRINFO_FAILED;
+        }
+        _members.push_back(ep);
+        return SUCCESS;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *servinfo;
+    int rv;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = ver == ipv4 ? AF_INET : AF_INET6;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if ((rv = getaddrinfo(host.c_str(), std::to_string(destport).c_str(), &hints, &servinfo)) != 0) {
+        std::cerr << "DestinationGroup: getaddrinfo: " << gai_strerror(rv) << std::endl;
+        return GETADDRINFO_FAILED;
+    }
+
+    memcpy(&ep.addr, servinfo->ai_addr, servinfo->ai_addrlen);
+    ep.addrlen = servinfo->ai_addrlen;
+    _members.push_back(ep);
+
+    freeaddrinfo(servinfo);
+    return SUCCESS;
+}
+
+void DestinationGroup::remove(int destport, std::string host){
+    for(auto it = _members.begin(); it != _members.end();){
+        if(it->port == destport && it->host == host){
+            it = _members.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void DestinationGroup::clear(void){
+    _members.clear();
+}
+
+size_t DestinationGroup::size(void) const{
+    return _members.size();
+}
+
+const std::vector<txEndpoint> &DestinationGroup::members(void) const{
+    return _members;
+}
+
+size_t DestinationGroup::failedCount(void) const{
+    size_t failed = 0;
+    for(const auto &ep : _members){
+        if(ep.lasterror != SUCCESS){
+            failed++;
+        }
+    }
+    return failed;
+}
+
 
 void UDPNode::printDatagram(const rxDatagram &datagram){
             std::cout << "Source Port: " << datagram.srcport << std::endl;
@@ -283,7 +3300,7 @@ void UDPNode::printDatagram(const rxDatagram &datagram){
 err_code UDPNode::parseDatagram(const sockaddr_storage &their_addr, char *buf, int numbytes, rxDatagram &datagram){
             err_code error_code = SUCCESS;
             rapidjson::Document d;
-            char s[32]; // should 16 bytes + 1
+            char s[INET6_ADDRSTRLEN];
             
             if(_debug){
                 std::cout << "Parsing datagram..." << std::endl;
@@ -291,32 +3308,56 @@ err_code UDPNode::parseDatagram(const sockaddr_storage &their_addr, char *buf, i
             
             d.Parse(buf);
             
-            datagram.srcport = getInPort((struct sockaddr *)&their_addr); 
-            datagram.srcipaddr = std::string(inet_ntop(their_addr.ss_family, getInAddr((struct sockaddr *)&their_addr),s, sizeof s));
+            datagram.srcaddr = their_addr;
+            if(their_addr.ss_family == AF_UNIX){
+                datagram.srcport = 0;
+                datagram.srcipaddr = unixPath(their_addr);
+            } else {
+                datagram.srcport = ntohs(getInPort((struct sockaddr *)&their_addr)); 
+                datagram.srcipaddr = std::string(inet_ntop(their_addr.ss_family, getInAddr((struct sockaddr *)&their_addr),s, sizeof s));
+            }
             
-            if(d.HasMember("Time")){
+            // Anything but a JSON object is rejected before a member is touched,
+            // and members of the wrong type count as missing.
+            if(d.HasParseError() || !d.IsObject()){
+                return PARSE_FAILED;
+            }
+
+            if(d.HasMember("Time") && d["Time"].IsUint64()){
                 datagram.time_stamp = static_cast<time_t>(d["Time"].GetUint64());
             } else {
                 error_code = PARSE_TIME_FAILED;
             }
             
-            if(d.HasMember("Msg")){
-                datagram.msg = std::string(d["Msg"].GetString());
+            if(d.HasMember("Msg") && d["Msg"].IsString()){
+                datagram.msg = std::string(d["Msg"].GetString(), d["Msg"].GetStringLength());
             }else{
                 error_code = PARSE_MSG_FAILED;
             }
             
-            if(d.HasMember("CRC")){
+            if(d.HasMember("CRC") && d["CRC"].IsUint()){
                 datagram.crc_checksum = static_cast<unsigned int>(d["CRC"].GetUint());
             }else{
                error_code = PARSE_CRC_FAILED; 
             }
 
-            if(d.HasMember("Join_thr")){
+            if(d.HasMember("Join_thr") && d["Join_thr"].IsBool()){
                 datagram.jointhread = d["Join_thr"].GetBool() ;
             }else {
                 datagram.jointhread = false ;
             }
+
+            if(d.HasMember("Prio") && d["Prio"].IsUint()){
+                datagram.priority = d["Prio"].GetUint();
+            }else {
+                datagram.priority = 0;
+            }
+
+            if(d.HasMember("Deadline") && d["Deadline"].IsUint64()){
+                datagram.deadlinens = d["Deadline"].GetUint64();
+            }else {
+                datagram.deadlinens = 0;
+            }
             return error_code;
 }
 
@@ -360,6 +3401,36 @@ std::string UDPNode::errorMsg(const err_code &error_code){
         case PARSE_CRC_FAILED:
             error_message = "Parsing CRC from buffer (to JSON) failed";
             break;      
+        case SETSOCKOPT_FAILED:
+            error_message = "Setsockopt function failed";
+            break;
+        case MCAST_JOIN_FAILED:
+            error_message = "Joining multicast group failed";
+            break;
+        case MCAST_LEAVE_FAILED:
+            error_message = "Leaving multicast group failed";
+            break;
+        case THREAD_AFFINITY_FAILED:
+            error_message = "Setting thread CPU affinity failed";
+            break;
+        case THREAD_SCHED_FAILED:
+            error_message = "Setting thread scheduling policy failed";
+            break;
+        case FILTER_FAILED:
+            error_message = "Attaching socket filter failed";
+            break;
+        case FILTER_EXPR_INVALID:
+            error_message = "Filter expression is invalid";
+            break;
+        case HANDOFF_FAILED:
+            error_message = "Socket handoff failed";
+            break;
+        case PARSE_FAILED:
+            error_message = "Datagram is not a JSON object";
+            break;
+        case RATE_TABLE_FULL:
+            error_message = "Rate limiter table is full";
+            break;
         default:
             error_message = "Invalid error code";
             break;    
@@ -368,7 +3439,7 @@ std::string UDPNode::errorMsg(const err_code &error_code){
 }
 
 
-rapidjson::StringBuffer UDPNode::serialize(std::string msg, bool jointhread){
+rapidjson::StringBuffer UDPNode::serialize(std::string msg, bool jointhread, unsigned int priority){
      // serialize
     rapidjson::StringBuffer s;
     rapidjson::Writer<rapidjson::StringBuffer> writer(s);
@@ -390,13 +3461,30 @@ rapidjson::StringBuffer UDPNode::serialize(std::string msg, bool jointhread){
        writer.Bool(true); 
     }
 
+    // Bulk traffic (priority 0) keeps the original envelope.
+    if(priority > 0){
+       writer.Key("Prio");
+       writer.Uint(priority);
+    }
+
+    if(_options.txttlms > 0){
+       struct timespec ts;
+       clock_gettime(CLOCK_REALTIME, &ts);
+       writer.Key("Deadline");
+       writer.Uint64((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec + (uint64_t)_options.txttlms * 1000000ULL);
+    }
+
     writer.EndObject();
     return s;
 }
 
 void UDPNode::inspectRxBuffer(struct sockaddr_storage their_addr, char * buf,  int numbytes){
-    char s[32]; 
-    std::cout << "Got datagram from: " << inet_ntop(their_addr.ss_family, getInAddr((struct sockaddr *)&their_addr),s, sizeof s)<< std::endl;
+    char s[INET6_ADDRSTRLEN]; 
+    if(their_addr.ss_family == AF_UNIX){
+        std::cout << "Got datagram from: " << unixPath(their_addr) << std::endl;
+    } else {
+        std::cout << "Got datagram from: " << inet_ntop(their_addr.ss_family, getInAddr((struct sockaddr *)&their_addr),s, sizeof s)<< std::endl;
+    }
     std::cout << "Datagram is " << numbytes << " bytes long"  << std::endl;
     std::cout << "Datagram contents: " << buf << std::endl;
     std::cout << std::endl;
@@ -12,7 +12,15 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <stddef.h>
 #include <arpa/inet.h>
+#include <net/if.h>
+#include <ifaddrs.h>
 #include <time.h>
 #include <string>
 #include <iostream>
@@ -20,6 +28,28 @@
 #include <thread>
 #include <queue>
 #include <mutex>
+#include <shared_mutex>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <sched.h>
+#include <pthread.h>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "RingBuffer.h"
+#include "FairQueue.h"
+#include "ConflationTable.h"
+#include "SpillQueue.h"
+#include "RecordFormat.h"
+#include "Journal.h"
+#include "ShmRing.h"
+#include "SimNetwork.h"
+#include "BpfFilter.h"
+#include "RxFilter.h"
 
 #include "../rapidjson/include/rapidjson/writer.h"
 #include "../rapidjson/include/rapidjson/stringbuffer.h"
@@ -35,13 +65,24 @@ enum err_code{
     GETADDRINFO_FAILED = -5,
     PARSE_TIME_FAILED = -6,
     PARSE_MSG_FAILED = -7,
-    PARSE_CRC_FAILED = -8
+    PARSE_CRC_FAILED = -8,
+    SETSOCKOPT_FAILED = -9,
+    MCAST_JOIN_FAILED = -10,
+    MCAST_LEAVE_FAILED = -11,
+    THREAD_AFFINITY_FAILED = -12,
+    THREAD_SCHED_FAILED = -13,
+    FILTER_FAILED = -14,
+    FILTER_EXPR_INVALID = -15,
+    HANDOFF_FAILED = -16,
+    PARSE_FAILED = -17,
+    RATE_TABLE_FULL = -18
 };
 
 // Enumeration for IP family versions.
 enum ipFamily{
     ipv4 = AF_INET,
-    ipv6 = AF_INET6
+    ipv6 = AF_INET6,
+    unixdgram = AF_UNIX     // Unix datagram sockets; the host is a socket path, '@' for the abstract namespace.
 };
 
 // Structure representing a received datagram.
@@ -52,6 +93,334 @@ struct rxDatagram{
     std::string msg;        // Message content.
     unsigned int crc_checksum;  // CRC checksum of the message.
     bool jointhread;        // Flag to indicate if the thread should join.
+    unsigned int priority = 0;  // Envelope priority, 0 for bulk traffic.
+    struct sockaddr_storage srcaddr; // Binary address of the sender, used by reply().
+    socklen_t srcaddrlen;   // Length of the sender address.
+    std::string dstipaddr;  // Local address the datagram arrived on (IP_PKTINFO/IPV6_PKTINFO).
+    struct sockaddr_storage dstaddr = {};  // Binary form of dstipaddr without a port, AF_UNSPEC when unknown; matched by RxFilter.
+    unsigned int dstport;   // Local port the datagram arrived on.
+    unsigned int ifindex;   // Index of the interface the datagram arrived on.
+    int rxsockfd = -1;      // Listening socket the datagram arrived on, used by reply(); -1 on a transport node, which replies through the transport.
+    uint32_t kerneldrops = 0;   // Cumulative kernel drop count of the receiving socket (SO_RXQ_OVFL).
+    uint64_t arrivalns = 0; // Kernel arrival time in ns since the epoch (SO_TIMESTAMPNS), 0 when rxttlms is not set.
+    uint64_t deadlinens = 0;    // Time in ns since the epoch after which the datagram is stale, 0 for none.
+};
+
+// Structure holding receive statistics of a UDPNode.
+struct rxStats{
+    uint64_t received;      // Datagrams read from the listening sockets or handed over by same-host nodes.
+    uint64_t queued;        // Datagrams written to the receive queue.
+    uint64_t parsedrops;    // Datagrams dropped because they could not be parsed.
+    uint64_t crcdrops;      // Datagrams dropped because of an invalid CRC checksum.
+    uint64_t queuefulldrops;    // Datagrams dropped because the receive queue was full.
+    uint64_t kerneldrops;   // Datagrams dropped by the kernel before they could be read (SO_RXQ_OVFL).
+    uint64_t pipelinedrops; // Datagrams dropped because every parse worker buffer was in use.
+    uint64_t ratelimitdrops;    // Datagrams rejected by the per-source token buckets.
+    uint64_t filterpassed;  // Datagrams matching the subscription filter.
+    uint64_t filterdrops;   // Datagrams dropped because they did not match the subscription filter.
+    uint64_t conflated;     // Unread datagrams replaced by a newer one with the same key (RXQ_CONFLATED mode).
+    uint64_t expireddrops;  // Queued datagrams skipped at dequeue because their deadline had passed.
+    uint64_t spilled;       // Datagrams written to the spill segments because the queue was full.
+    uint64_t journaled;     // Datagrams appended to the journal.
+    uint64_t journaldrops;  // Datagrams not journaled because every journal buffer was waiting for the disk.
+    uint64_t shmreceived;   // Datagrams received from same-host nodes over shared memory.
+    uint64_t loopbackreceived;  // Datagrams handed over directly by nodes of this process.
+    size_t activesources;   // Sources with queued datagrams (RXQ_FAIR mode).
+    int rcvbuf;             // Current receive buffer size of the primary listening socket.
+    uint64_t rxcpuns;       // CPU time used by the receive thread while it runs, in ns; 0 without one.
+};
+
+// Structure describing an additional local address to listen on.
+struct bindAddress{
+    std::string host;       // Local address to bind, empty for the wildcard address.
+    int port;               // Local port to bind, 0 for the node's listening port.
+};
+
+// Enumeration for the ways the receive loop waits for datagrams.
+enum waitStrategy{
+    WAIT_BLOCK = 0,         // Block in the kernel until a datagram arrives.
+    WAIT_SPIN,              // Poll the sockets without blocking, never yielding the CPU.
+    WAIT_SPIN_YIELD,        // Poll without blocking, yielding the CPU after each spin budget.
+    WAIT_SPIN_BLOCK         // Poll without blocking, then block after the idle threshold.
+};
+
+// Enumeration for the ways received datagrams are queued.
+enum rxQueueMode{
+    RXQ_FIFO = 0,           // One queue shared by every consumer.
+    RXQ_PARTITIONED,        // One queue per key partition, each with its own lock.
+    RXQ_FAIR,               // Per-source sub-queues served by deficit round robin.
+    RXQ_PRIORITY,           // Lock-free lanes selected by envelope priority, highest drained first.
+    RXQ_CONFLATED           // Only the latest datagram per key is kept; consumers read updated keys.
+};
+
+// Enumeration for what a full priority lane discards.
+enum dropPolicy{
+    DROP_NEWEST = 0,        // Discard the incoming datagram.
+    DROP_OLDEST             // Discard the oldest queued datagram to make room.
+};
+
+// Structure holding the metrics of a priority lane.
+struct laneStats{
+    size_t depth;           // Datagrams currently queued.
+    size_t capacity;        // Configured capacity.
+    uint64_t enqueued;      // Datagrams written to the lane.
+    uint64_t drops;         // Datagrams discarded by the lane's drop policy.
+};
+
+// Structure holding the depth metrics of a receive partition.
+struct partitionStats{
+    size_t depth;           // Datagrams currently queued.
+    size_t highwatermark;   // Largest depth seen.
+    uint64_t enqueued;      // Datagrams written to the partition.
+    uint64_t drops;         // Datagrams dropped because the partition was full.
+};
+
+// Structure holding the rate limiting counters of one source address.
+struct sourceRateStats{
+    std::string ipaddr;     // Source IP address, or "*" for the sources a full table could not track.
+    uint64_t admitted;      // Datagrams admitted.
+    uint64_t rejected;      // Datagrams rejected for exceeding the limit.
+};
+
+// Structure describing a multicast group membership.
+struct mcastGroup{
+    std::string group;      // Multicast group address (IPv4 or IPv6).
+    std::string iface;      // Interface name or IPv4 address, empty for the default interface.
+};
+
+// Structure holding optional settings for a UDPNode.
+struct nodeOptions{
+    // Send from the bound listening socket instead of an ephemeral one, so
+    // that receivers see our listening port as the source port.
+    bool txfromlistensocket = false;
+
+    // Multicast groups joined when the listening socket is bound.
+    std::vector<mcastGroup> mcastgroups;
+
+    // Hop limit for outgoing multicast datagrams.
+    int mcastttl = 1;
+
+    // Deliver our own multicast datagrams back to local subscribers.
+    bool mcastloop = true;
+
+    // Interface name or IPv4 address for outgoing multicast, empty for the default.
+    std::string mcastiface;
+
+    // Accept IPv4 peers on an IPv6 listening socket (IPV6_V6ONLY=0).
+    bool dualstack = false;
+
+    // Additional addresses and ports served by the same receive loop.
+    std::vector<bindAddress> bindaddrs;
+
+    // Socket receive and send buffer sizes in bytes, 0 for the system default.
+    int rcvbuf = 0;
+    int sndbuf = 0;
+
+    // Use SO_RCVBUFFORCE/SO_SNDBUFFORCE to exceed the system limits when privileged.
+    bool forcebuffers = false;
+
+    // Double the receive buffer, up to rcvbufmax, whenever the kernel reports drops.
+    bool autotunercvbuf = false;
+    int rcvbufmax = 16 * 1024 * 1024;
+
+    // Maximum number of datagrams read by one recvmmsg() call.
+    unsigned int rxbatch = 1;
+
+    // How the receive loop waits for datagrams.
+    waitStrategy rxwait = WAIT_BLOCK;
+
+    // Empty polls between yields (WAIT_SPIN_YIELD) or idle checks (WAIT_SPIN_BLOCK).
+    unsigned int spinbudget = 1000;
+
+    // Idle time in microseconds after which WAIT_SPIN_BLOCK blocks again.
+    unsigned int idlethresholdus = 1000;
+
+    // SO_BUSY_POLL time in microseconds, 0 to leave busy polling off.
+    int busypollus = 0;
+
+    // Set SO_PREFER_BUSY_POLL and SO_BUSY_POLL_BUDGET (Linux 5.11+) along with SO_BUSY_POLL.
+    bool preferbusypoll = false;
+    int busypollbudget = 0;
+
+    // CPUs the receive thread is pinned to, empty to leave placement to the scheduler.
+    std::vector<int> rxcpus;
+
+    // SCHED_FIFO priority of the receive thread, 0 to keep the default policy.
+    int rxschedpriority = 0;
+
+    // Set SO_REUSEPORT so several nodes (shards) can bind the same port.
+    bool reuseport = false;
+
+    // CPU set with SO_INCOMING_CPU on the listening sockets, -1 to leave it unset.
+    int incomingcpu = -1;
+
+    // Number of parse workers; 0 parses on the receive thread.
+    unsigned int parseworkers = 0;
+
+    // Raw buffers per parse worker.
+    unsigned int workerqueuesize = 1024;
+
+    // Send all datagrams of a source to the same worker so they are queued in order.
+    bool preservesourceorder = true;
+
+    // CPUs for the parse workers (worker i runs on workercpus[i % size]) and their SCHED_FIFO priority.
+    std::vector<int> workercpus;
+    int workerschedpriority = 0;
+
+    // How received datagrams are queued.
+    rxQueueMode rxqueuemode = RXQ_FIFO;
+
+    // Number of partitions in RXQ_PARTITIONED mode; each holds up to maxqsize datagrams.
+    unsigned int partitions = 1;
+
+    // Partition or conflation key of a datagram, e.g. a field of the message; the source address and port when empty.
+    std::function<uint64_t(const rxDatagram &)> keyextractor;
+
+    // Datagrams one source may hold in RXQ_FAIR mode, 0 for maxqsize.
+    unsigned int fairsourcecap = 0;
+
+    // Message bytes a source may dequeue per round in RXQ_FAIR mode, 0 for maxmsgsize.
+    unsigned int fairquantum = 0;
+
+    // Distinct keys held in RXQ_CONFLATED mode, 0 for maxqsize.
+    size_t conflationkeys = 0;
+
+    // Number of lanes in RXQ_PRIORITY mode; priorities above the top lane use it.
+    unsigned int prioritylanes = 3;
+
+    // Capacity and drop policy of each lane, indexed by priority; missing entries use maxqsize and DROP_NEWEST.
+    std::vector<unsigned int> lanecapacity;
+    std::vector<dropPolicy> lanedroppolicy;
+
+    // Datagrams per second admitted from each source address, 0 for no limit.
+    double sourcerate = 0;
+
+    // Token bucket depth per source, 0 for one second worth of sourcerate.
+    double sourceburst = 0;
+
+    // Maximum number of source addresses tracked by the rate limiter; further sources share one bucket.
+    size_t ratelimitsources = 65536;
+
+    // Queued datagrams older than this (from kernel arrival) are skipped at dequeue, 0 to keep them.
+    unsigned int rxttlms = 0;
+
+    // Deadline stamped into the envelope of sent datagrams, relative to the send time, 0 for none.
+    unsigned int txttlms = 0;
+
+    // Directory of the spill segments used when the RXQ_FIFO queue is full, empty to drop instead.
+    std::string spilldir;
+
+    // Size of each spill segment file.
+    size_t spillsegmentsize = 64 * 1024 * 1024;
+
+    // Maximum size of the spill segments in use, 0 for no limit.
+    size_t spillmaxbytes = 0;
+
+    // Directory of the journal of received datagrams, empty for no journal.
+    std::string journaldir;
+
+    // File name prefix of the journal files.
+    std::string journalprefix = "udpnode";
+
+    // Size of each preallocated journal file before rotation.
+    size_t journalfilesize = 256 * 1024 * 1024;
+
+    // Size of each journal write buffer.
+    size_t journalbuffersize = 1024 * 1024;
+
+    // Interval at which a partially filled journal buffer is written.
+    unsigned int journalflushms = 100;
+
+    // Unix socket of a node handing its listening sockets over (see UDPNode::handoff()), empty to bind instead.
+    std::string handoffpath;
+
+    // Time to wait for the handing-over node before binding instead.
+    unsigned int handofftimeoutms = 5000;
+
+    // Unix datagram socket to listen on, '@' prefix for the abstract namespace; required by unixdgram nodes.
+    std::string unixpath;
+
+    // Exchange datagrams with nodes on the same host over shared-memory rings instead of UDP.
+    bool shmtransport = false;
+
+    // Size of each shared-memory ring this node sends through.
+    size_t shmringsize = 4 * 1024 * 1024;
+
+    // Directory of the Unix sockets through which same-host nodes hand over their shared-memory rings;
+    // empty for $XDG_RUNTIME_DIR, or else a private /tmp/udpnode-<uid> directory.
+    std::string shmdir;
+
+    // Hand datagrams to nodes of this process straight into their queues, skipping the kernel and the envelope.
+    bool loopbackshortcut = false;
+
+    // Network used instead of kernel sockets, such as a SimNetwork; null for the kernel.
+    std::shared_ptr<Transport> transport;
+
+    // Address the node binds on the transport, empty for the loopback address of its family.
+    std::string transportaddr;
+};
+
+// Structure describing a pre-resolved destination of a DestinationGroup.
+struct txEndpoint{
+    std::string host;       // Destination host as given when added.
+    int port;               // Destination port number.
+    struct sockaddr_storage addr;   // Resolved binary address; a sockaddr_un for unixdgram members.
+    socklen_t addrlen;      // Length of the resolved address.
+    err_code lasterror;     // Result of the last txGroup() send to this endpoint.
+};
+
+// Class holding a set of pre-resolved destinations for UDPNode::txGroup().
+class DestinationGroup{
+    public:
+        /**
+         * @brief Resolves a destination and adds it to the group.
+         *
+         * @param destport Destination port number, ignored for unixdgram.
+         * @param ver IP version to use (ipv4 or ipv6), or unixdgram.
+         * @param host Destination IP address or hostname, or the socket path for unixdgram.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code add(int destport, ipFamily ver, std::string host);
+
+        /**
+         * @brief Removes every member with the given host and port.
+         *
+         * @param destport Destination port number.
+         * @param host Destination host as given to add().
+         */
+        void remove(int destport, std::string host);
+
+        /**
+         * @brief Removes all members.
+         */
+        void clear(void);
+
+        /**
+         * @brief Returns the number of members.
+         *
+         * @return size_t The number of members.
+         */
+        size_t size(void) const;
+
+        /**
+         * @brief Returns the members and the result of the last send to each.
+         *
+         * @return const std::vector<txEndpoint>& The members of the group.
+         */
+        const std::vector<txEndpoint> &members(void) const;
+
+        /**
+         * @brief Returns the number of members whose last send failed.
+         *
+         * @return size_t The number of failed members.
+         */
+        size_t failedCount(void) const;
+
+    private:
+        friend class UDPNode;
+
+        // Resolved members of the group.
+        std::vector<txEndpoint> _members;
 };
 
 // Class that handles sending and receiving UDP datagrams.
@@ -65,8 +434,9 @@ class UDPNode{
         * @param maxmsgsize Maximum size of messages to be received.
         * @param maxqsize Maximum size of the receive queue.
         * @param debug Flag to enable/disable debug mode.
+        * @param opts Optional node settings.
         */
-        UDPNode(int lport, ipFamily ver, unsigned int maxmsgsize = 1024, unsigned int maxqsize = 100, bool debug = false);
+        UDPNode(int lport, ipFamily ver, unsigned int maxmsgsize = 1024, unsigned int maxqsize = 100, bool debug = false, const nodeOptions &opts = nodeOptions());
         
         /**
          * @brief Destructor that cleans up resources and closes sockets.
@@ -81,9 +451,57 @@ class UDPNode{
          * @param host Destination IP address or hostname.
          * @param msg Message to be sent.
          * @param jointhread Flag to indicate if the thread should join.
+         * @param priority Envelope priority, higher values are dequeued first by RXQ_PRIORITY receivers.
          * @return err_code Error code indicating success or failure.
          */
-        err_code tx(int destport, ipFamily ver, std::string host, std::string msg, bool jointhread = false);  
+        err_code tx(int destport, ipFamily ver, std::string host, std::string msg, bool jointhread = false, unsigned int priority = 0);  
+
+        /**
+         * @brief Sends a message back to the sender of a received datagram.
+         *
+         * Reuses the binary source address captured by the receive loop and
+         * sends from the listening socket, so no name resolution or socket
+         * creation takes place.
+         *
+         * @param datagram The datagram being replied to.
+         * @param msg Message to be sent.
+         * @param priority Envelope priority.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code reply(const rxDatagram &datagram, std::string msg, unsigned int priority = 0);
+
+        /**
+         * @brief Sends one message to every member of a destination group.
+         *
+         * The message is serialized once and sent with a single sendmmsg()
+         * call per address family. A failing member does not stop the
+         * fan-out; its error is recorded in its txEndpoint::lasterror.
+         *
+         * @param group The destination group.
+         * @param msg Message to be sent.
+         * @param jointhread Flag to indicate if the thread should join.
+         * @param priority Envelope priority.
+         * @return err_code SUCCESS if every member was sent to, otherwise the last error.
+         */
+        err_code txGroup(DestinationGroup &group, std::string msg, bool jointhread = false, unsigned int priority = 0);
+
+        /**
+         * @brief Joins a multicast group on the listening socket.
+         *
+         * @param group Multicast group address of the listening IP family.
+         * @param iface Interface name or IPv4 address, empty for the default interface.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code joinMulticastGroup(std::string group, std::string iface = "");
+
+        /**
+         * @brief Leaves a multicast group previously joined on the listening socket.
+         *
+         * @param group Multicast group address of the listening IP family.
+         * @param iface Interface name or IPv4 address used when joining.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code leaveMulticastGroup(std::string group, std::string iface = "");
         
         /**
          * @brief Starts the receive loop in a separate thread.
@@ -94,6 +512,93 @@ class UDPNode{
          * @brief Stops the receive loop and joins the thread.
          */
         void endRxLoop(void);
+
+        /**
+         * @brief Hands the listening sockets and queued datagrams over to a restarted node.
+         *
+         * Listens on a Unix socket until the new node, constructed with
+         * nodeOptions::handoffpath set to the same path, connects. The
+         * receive loop is then stopped, the bound sockets are passed with
+         * SCM_RIGHTS and the queued datagrams are sent after them, so the
+         * new node resumes without re-binding. Datagrams arriving meanwhile
+         * wait in the kernel. On success this node no longer listens.
+         *
+         * @param path Path of the Unix socket; a leading '@' selects the abstract namespace.
+         * @param timeoutms Time to wait for the new node to connect.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code handoff(const std::string &path, unsigned int timeoutms = 5000);
+
+        /**
+         * @brief Attaches a classic BPF filter to every listening socket.
+         *
+         * Datagrams the filter rejects are dropped in the kernel, before
+         * they cost a receive call, a copy or a parse.
+         *
+         * @param program The filter, e.g. built from BpfProgram checks.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code attachFilter(const BpfProgram &program);
+
+        /**
+         * @brief Attaches raw classic BPF instructions to every listening socket.
+         *
+         * @param code The instructions.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code attachFilter(const std::vector<struct sock_filter> &code);
+
+        /**
+         * @brief Removes the socket filter from every listening socket.
+         *
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code detachFilter(void);
+
+        /**
+         * @brief Attaches a SO_REUSEPORT steering program to the node's reuseport group.
+         *
+         * The kernel then picks the shard for every datagram instead of
+         * hashing the 4-tuple: shard i is the i-th socket bound to the port.
+         * Requires the reuseport option. Shard count changes need a new
+         * program, so reattach after adding or removing a shard.
+         *
+         * @param rule What to shard by: receiving CPU, source address hash or payload key.
+         * @param shards Number of nodes in the group.
+         * @param keyoffset Payload offset of the key for STEER_PAYLOAD_KEY (default: start of Msg).
+         * @param keylen Key length in bytes (1 to 4) for STEER_PAYLOAD_KEY.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code attachReuseportSteering(steerRule rule, unsigned int shards, unsigned int keyoffset = ENVELOPE_MSG_OFFSET, unsigned int keylen = 4);
+
+        /**
+         * @brief Removes the steering program, restoring the kernel's 4-tuple hash.
+         *
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code detachReuseportSteering(void);
+
+        /**
+         * @brief Pins the calling thread to a set of CPUs and optionally makes it SCHED_FIFO.
+         *
+         * Used for the receive thread and available for sender threads.
+         * Memory first touched by the thread afterwards is placed on the
+         * NUMA node of those CPUs by the kernel's default policy.
+         *
+         * @param cpus CPUs the thread may run on, empty to leave the affinity unchanged.
+         * @param schedpriority SCHED_FIFO priority, 0 to keep the current policy.
+         * @return err_code Error code indicating success or failure.
+         */
+        static err_code pinCurrentThread(const std::vector<int> &cpus, int schedpriority = 0);
+
+        /**
+         * @brief Returns the CPU that last processed a datagram for the listening socket.
+         *
+         * Reads SO_INCOMING_CPU, which reflects the RSS queue the flow hashes to.
+         *
+         * @return int The CPU number, or -1 if unavailable.
+         */
+        int rxIncomingCpu(void);
         
         /**
          * @brief Prints the contents of a received datagram.
@@ -130,6 +635,135 @@ class UDPNode{
          * @return rxDatagram The datagram read from the queue.
          */
         rxDatagram readRxDatagramFromQueue();
+
+        /**
+         * @brief Returns the number of receive partitions (RXQ_PARTITIONED mode).
+         *
+         * @return unsigned int The number of partitions, 0 in other modes.
+         */
+        unsigned int rxPartitionCount(void);
+
+        /**
+         * @brief Checks if a receive partition holds data.
+         *
+         * @param partition Index of the partition.
+         * @return bool True if data is available, false otherwise.
+         */
+        bool rxPartitionDataAvailable(unsigned int partition);
+
+        /**
+         * @brief Returns the current size of a receive partition.
+         *
+         * @param partition Index of the partition.
+         * @return int The size of the partition.
+         */
+        int rxPartitionQueueSize(unsigned int partition);
+
+        /**
+         * @brief Reads and removes the oldest datagram of a receive partition.
+         *
+         * Each partition has its own lock, so one consumer thread per
+         * partition drains in key order without contending with the others.
+         *
+         * @param partition Index of the partition.
+         * @return rxDatagram The datagram, default constructed if the partition is empty.
+         */
+        rxDatagram readRxDatagramFromPartition(unsigned int partition);
+
+        /**
+         * @brief Returns the depth metrics of every receive partition.
+         *
+         * @return std::vector<partitionStats> One entry per partition.
+         */
+        std::vector<partitionStats> getPartitionStats(void);
+
+        /**
+         * @brief Updates the per-source cap and quantum of the RXQ_FAIR mode at runtime.
+         *
+         * @param sourcecap Datagrams one source may hold, 0 for the queue size.
+         * @param quantum Message bytes a source may dequeue per round, 0 for the message size.
+         */
+        void setFairQueueLimits(unsigned int sourcecap, unsigned int quantum);
+
+        /**
+         * @brief Returns the depth and drop metrics of every priority lane (RXQ_PRIORITY mode).
+         *
+         * @return std::vector<laneStats> One entry per lane, lowest priority first.
+         */
+        std::vector<laneStats> getLaneStats(void);
+
+        /**
+         * @brief Reads the latest datagram of a key without taking a lock (RXQ_CONFLATED mode).
+         *
+         * Does not mark the key as read; readRxDatagramFromQueue() still
+         * returns it if it was updated.
+         *
+         * @param key The key, as returned by the keyextractor option.
+         * @param datagram Receives the datagram.
+         * @return bool False if no datagram with this key was received.
+         */
+        bool readLatest(uint64_t key, rxDatagram &datagram);
+
+        /**
+         * @brief Sets the default per-source token bucket at runtime.
+         *
+         * @param rate Datagrams per second admitted from each source address, 0 for no limit.
+         * @param burst Bucket depth, 0 for one second worth of rate.
+         */
+        void setSourceRateLimit(double rate, double burst = 0);
+
+        /**
+         * @brief Sets the token bucket of one source address at runtime, overriding the default.
+         *
+         * @param ipaddr Source IP address.
+         * @param rate Datagrams per second admitted, 0 for no limit.
+         * @param burst Bucket depth, 0 for one second worth of rate.
+         * @return err_code GETADDRINFO_FAILED for an invalid address, RATE_TABLE_FULL if the table has no room for it.
+         */
+        err_code setSourceRateLimit(std::string ipaddr, double rate, double burst = 0);
+
+        /**
+         * @brief Removes the override of a source address, which then uses the default limit.
+         *
+         * @param ipaddr Source IP address.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code clearSourceRateLimit(std::string ipaddr);
+
+        /**
+         * @brief Returns the sources with the most rate-limited datagrams.
+         *
+         * Includes offenders a full table has since dropped, and the
+         * sources it could not track at all as one "*" entry.
+         *
+         * @param count Maximum number of sources to return.
+         * @return std::vector<sourceRateStats> The sources, most rejected first.
+         */
+        std::vector<sourceRateStats> topRateLimitedSources(size_t count = 10);
+
+        /**
+         * @brief Compiles and installs a subscription filter, e.g. src in 10.0.0.0/8 && msg startswith "px.".
+         *
+         * The filter runs right after a datagram is parsed, so datagrams it
+         * rejects are never queued and never wake a consumer. It can be
+         * replaced at any time; see RxFilter.h for the expression grammar.
+         *
+         * @param expression The filter expression.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code setRxFilter(const std::string &expression);
+
+        /**
+         * @brief Removes the subscription filter, so every datagram is queued again.
+         */
+        void clearRxFilter(void);
+
+        /**
+         * @brief Returns the receive statistics, including application and kernel drops.
+         *
+         * @return rxStats The current receive statistics.
+         */
+        rxStats getRxStats();
         
 
     private:
@@ -137,9 +771,92 @@ class UDPNode{
          * @brief Writes a datagram to the receive queue.
          * 
          * @param datagram The datagram to be written to the queue.
+         * @return bool False if the queue is full and the datagram was dropped.
          */
-        void writeRxDatagramToQueue(const rxDatagram &datagram);
+        bool writeRxDatagramToQueue(rxDatagram &&datagram);
         
+        /**
+         * @brief Charges a datagram to the token bucket of its source address.
+         *
+         * @param srcaddr Binary source address.
+         * @param now Current steady clock time in nanoseconds.
+         * @return bool True if the datagram is admitted.
+         */
+        bool admitSource(const struct sockaddr_storage &srcaddr, int64_t now);
+
+        // Structure holding the token bucket of one source address.
+        struct rateBucket{
+            bool used = false;      // Slot holds a source.
+            bool custom = false;    // Rate and burst override the defaults.
+            uint8_t addr[16];       // IPv6 or IPv4-mapped source address.
+            double tokens = 0;      // Tokens left.
+            int64_t last = 0;       // Time of the last refill in nanoseconds.
+            double rate = 0, burst = 0; // Override values.
+            uint64_t admitted = 0, rejected = 0;
+        };
+
+        /**
+         * @brief Looks a source address up in the rate limiter table; caller holds _ratemtx.
+         *
+         * @param addr IPv6 or IPv4-mapped address.
+         * @param insert Insert the address if missing.
+         * @return rateBucket* The bucket, or nullptr if missing or the table holds ratelimitsources sources.
+         */
+        rateBucket *findRateBucket(const uint8_t *addr, bool insert);
+
+        /**
+         * @brief Drops idle default buckets to make room in a full rate limiter table; caller holds _ratemtx.
+         *
+         * A bucket is idle once it has refilled to its burst, so a source
+         * coming back starts exactly as a new one would. Runs at most once
+         * per refill interval, so a flood of new sources cannot make every
+         * datagram pay for a scan of the table.
+         *
+         * @param now Current steady clock time in nanoseconds.
+         * @param force Sweep even if the last sweep was less than a refill interval ago.
+         */
+        void sweepRateTable(int64_t now, bool force = false);
+
+        /**
+         * @brief Keeps the counts of a bucket a sweep drops if it rejected anything; caller holds _ratemtx.
+         *
+         * @param b The bucket.
+         */
+        void recordRateOffender(const rateBucket &b);
+
+        /**
+         * @brief Converts a textual IP address into a rate limiter key.
+         *
+         * @param ipaddr IPv4 or IPv6 address.
+         * @param addr Receives the 16-byte key.
+         * @return bool False if the address is invalid.
+         */
+        static bool parseRateKey(const std::string &ipaddr, uint8_t *addr);
+
+        /**
+         * @brief Writes a datagram to the lane of its priority, applying the lane's drop policy.
+         *
+         * @param datagram The datagram to be written.
+         * @return bool False if the datagram was dropped.
+         */
+        bool writeRxDatagramToLane(rxDatagram &&datagram);
+
+        /**
+         * @brief Writes a datagram to the partition selected by its key.
+         *
+         * @param datagram The datagram to be written.
+         * @return bool False if the partition is full and the datagram was dropped.
+         */
+        bool writeRxDatagramToPartition(rxDatagram &&datagram);
+
+        /**
+         * @brief Stores a datagram as the latest value of its key (RXQ_CONFLATED mode).
+         *
+         * @param datagram The datagram.
+         * @return bool False if the key is new and the table is full.
+         */
+        bool writeRxDatagramToConflation(const rxDatagram &datagram);
+
         /**
          * @brief Retrieves the IP address from a sockaddr structure.
          * 
@@ -156,27 +873,371 @@ class UDPNode{
          */
         uint16_t getInPort(struct sockaddr *sa);
 
+        /**
+         * @brief Checks whether a sockaddr holds a multicast address.
+         *
+         * @param sa The sockaddr structure.
+         * @return bool True if the address is multicast.
+         */
+        bool isMulticastAddr(const struct sockaddr *sa);
+
+        /**
+         * @brief Adds or drops a multicast membership on the listening socket.
+         *
+         * @param group Multicast group address.
+         * @param iface Interface name or IPv4 address, may be empty.
+         * @param join True to join, false to leave.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code setMulticastMembership(const std::string &group, const std::string &iface, bool join);
+
+        /**
+         * @brief Applies the multicast TTL, loopback and interface options to a sending socket.
+         *
+         * @param sockfd The socket to configure.
+         * @param family Address family of the socket.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code applyMulticastTxOptions(int sockfd, int family);
+
         /**
          * @brief Serializes a message and additional data into a JSON string.
          * 
          * @param msg The message to be serialized.
          * @param jointhread Flag to indicate if the thread should join.
+         * @param priority Envelope priority, written only when non-zero.
          * @return rapidjson::StringBuffer The serialized JSON string.
          */
-        rapidjson::StringBuffer serialize(std::string msg, bool jointhread);
+        rapidjson::StringBuffer serialize(std::string msg, bool jointhread, unsigned int priority = 0);
         
         /**
-         * @brief Creates a socket and binds it to the specified port.
+         * @brief Creates the listening sockets and binds them to the configured addresses.
          * 
          * @return err_code Error code indicating success or failure.
          */ 
         err_code createSocketAndBind(void);
+
+        /**
+         * @brief Binds a listening socket to every address a host resolves to.
+         *
+         * @param host Local address to bind, NULL for the wildcard address.
+         * @param port Local port to bind.
+         * @param family Address family (AF_INET, AF_INET6 or AF_UNSPEC).
+         * @return err_code Error code indicating success, or the error of the first address that failed to bind.
+         */
+        err_code bindListenSockets(const char *host, int port, int family);
+
+        /**
+         * @brief Binds a Unix datagram listening socket.
+         *
+         * @param path Socket path; a leading '@' selects the abstract namespace.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code bindUnixSocket(const std::string &path);
+
+        /**
+         * @brief Sends a message to a Unix datagram socket.
+         *
+         * @param path Destination socket path; a leading '@' selects the abstract namespace.
+         * @param msg Message to be sent.
+         * @param jointhread Flag to indicate if the thread should join.
+         * @param priority Envelope priority.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code txUnix(const std::string &path, const std::string &msg, bool jointhread, unsigned int priority);
+
+        /**
+         * @brief Binds the node's address on nodeOptions::transport instead of opening sockets.
+         *
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code bindTransport(void);
+
+        /**
+         * @brief Parses and queues a datagram delivered by the transport; runs on the transport's thread.
+         *
+         * @param src Address of the sender.
+         * @param data The encoded datagram.
+         * @param len Length of the datagram.
+         */
+        void receiveFromTransport(const struct sockaddr_storage &src, const char *data, size_t len);
+
+        /**
+         * @brief Sets the socket options of a listening socket before it is bound.
+         *
+         * @param sockfd The socket to configure.
+         * @param family Address family of the socket.
+         */
+        void configureListenSocket(int sockfd, int family);
+
+        /**
+         * @brief Closes every listening socket.
+         */
+        void closeListenSockets(void);
+
+        /**
+         * @brief Stops the receive thread and the parse workers, leaving the sockets open.
+         *
+         * The receive loop is woken through _wakefd, so stopping takes no
+         * datagram and does not depend on the listening address family.
+         */
+        void stopRxLoop(void);
+
+        /**
+         * @brief Takes over the listening sockets and queued datagrams of the node at nodeOptions::handoffpath.
+         *
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code adoptListenSockets(void);
+
+        /**
+         * @brief Fills a Unix socket address.
+         *
+         * @param path Socket path; a leading '@' selects the abstract namespace.
+         * @param addr Receives the address.
+         * @return socklen_t Length of the address, 0 if the path is empty or too long.
+         */
+        static socklen_t unixAddress(const std::string &path, struct sockaddr_un &addr);
+
+        /**
+         * @brief Removes a Unix socket file left behind by a process that is gone, so the path can be bound.
+         *
+         * Anything but a socket is left alone, and so is a socket that
+         * accepts a connection probe, as some process still has it bound.
+         *
+         * @param path Socket path; abstract names have no file and always pass.
+         * @param type SOCK_DGRAM or SOCK_STREAM, the type of socket expected at the path.
+         * @return bool False if the path holds something else or a live socket.
+         */
+        static bool removeStaleSocket(const std::string &path, int type);
+
+        // DestinationGroup::add() fills unixdgram members with unixAddress().
+        friend class DestinationGroup;
         
         /**
          * @brief The main receive loop that listens for incoming datagrams.
          */
         void rxLoop(void);
 
+        /**
+         * @brief Fills the address and ancillary fields of a datagram; runs on the receive thread.
+         *
+         * @param sockidx Index of the listening socket the datagram arrived on.
+         * @param mh The message header filled by recvmmsg().
+         * @param datagram The datagram to fill.
+         */
+        void prepareRxDatagram(size_t sockidx, const struct msghdr &mh, rxDatagram &datagram);
+
+        /**
+         * @brief Parses, validates and queues a received datagram; runs on the receive thread or a parse worker.
+         *
+         * @param buf The received buffer, with room for a terminating NUL.
+         * @param numbytes The number of bytes received.
+         * @param datagram The datagram prepared by prepareRxDatagram().
+         */
+        void processRxDatagram(char *buf, int numbytes, rxDatagram &datagram);
+
+        /**
+         * @brief Applies the deadline, journal and subscription filter to a parsed datagram and queues it.
+         *
+         * @param datagram The parsed datagram.
+         */
+        void queueRxDatagram(rxDatagram &datagram);
+
+        /**
+         * @brief Checks whether an address belongs to this host.
+         *
+         * @param sa The address.
+         * @return bool True for loopback addresses and the addresses of the local interfaces.
+         */
+        bool isLocalAddr(const struct sockaddr *sa);
+
+        /**
+         * @brief Sends a message to a same-host node through its shared-memory ring.
+         *
+         * @param destport Listening port of the destination node.
+         * @param addr Resolved destination address.
+         * @param msg The message; borrowed for the duration of the call.
+         * @param priority Datagram priority.
+         * @return err_code SOCKET_CONN_FAILED if no listener bound to the destination address or its wildcard accepts shared-memory peers, SENDTO_FAILED if its ring is full.
+         */
+        err_code txShm(int destport, const struct sockaddr *addr, std::string &msg, unsigned int priority);
+
+        /**
+         * @brief Fills the fields of a datagram for a same-host node that the envelope would otherwise carry.
+         *
+         * @param src Address the datagram comes from, see localSourceAddr().
+         * @param destport Listening port of the destination node.
+         * @param addr Resolved destination address.
+         * @param msg The message, for the checksum.
+         * @param priority Datagram priority.
+         * @param datagram The datagram to fill, apart from its message.
+         */
+        void prepareLocalDatagram(const struct sockaddr_storage &src, int destport, const struct sockaddr *addr, const std::string &msg, unsigned int priority, rxDatagram &datagram);
+
+        /**
+         * @brief Finds the address a datagram to a local destination would come from.
+         *
+         * That is the listening socket of the destination's family, or a
+         * dual-stack IPv6 one for IPv4; a wildcard bind takes the
+         * destination address, as the kernel would pick it.
+         *
+         * @param dst The local destination.
+         * @param src Receives the source address.
+         * @return bool False if the node has no listening socket to send from.
+         */
+        bool localSourceAddr(const struct sockaddr *dst, struct sockaddr_storage &src);
+
+        /**
+         * @brief Admits, checks and queues a datagram handed over by a same-host node, as the socket path does.
+         *
+         * @param datagram The datagram, with rxsockfd set to the listening socket it was addressed to.
+         */
+        void receiveLocalDatagram(rxDatagram &datagram);
+
+        /**
+         * @brief Moves a message into the queue of a node of this process listening on the destination.
+         *
+         * @param destport Listening port of the destination node.
+         * @param addr Resolved destination address.
+         * @param msg The message; moved from on success.
+         * @param priority Datagram priority.
+         * @return err_code SOCKET_CONN_FAILED if no node of this process accepts the destination.
+         */
+        err_code txLoopback(int destport, const struct sockaddr *addr, std::string &msg, unsigned int priority);
+
+        /**
+         * @brief Adds the node's listening sockets to, or removes them from, the registry txLoopback() looks in.
+         *
+         * @param accept True to register, false to unregister and wait for deliveries in progress.
+         */
+        void registerLoopback(bool accept);
+
+        /**
+         * @brief Forgets the absent rendezvous paths that inotify has since seen created.
+         */
+        void refreshShmAbsent(void);
+
+        /**
+         * @brief Connects to the shared-memory listener at a rendezvous path and hands it a new ring.
+         *
+         * @param path Socket path of the listener in nodeOptions::shmdir.
+         * @return bool False if nothing accepts peers at the path.
+         */
+        bool connectShmPeer(const std::string &path);
+
+        /**
+         * @brief Starts accepting shared-memory peers and the thread reading their rings.
+         */
+        void startShmTransport(void);
+
+        /**
+         * @brief Abandons every inbound ring after queueing what it holds, and stops accepting peers.
+         */
+        void closeShmTransport(void);
+
+        /**
+         * @brief Accepts shared-memory peers and moves datagrams from their rings into the receive queue.
+         */
+        void shmLoop(void);
+
+        /**
+         * @brief Accepts pending shared-memory peers; their hello is read once it arrives.
+         *
+         * @param idx Index of the listener in _shmlisteners.
+         */
+        void acceptShmPeers(size_t idx);
+
+        /**
+         * @brief Reads the hello of an accepted peer and maps the ring it hands over.
+         *
+         * @param idx Index of the connection in _shmpending.
+         * @return bool False if the hello has not arrived yet and the connection stays pending.
+         */
+        bool readShmHello(size_t idx);
+
+        /**
+         * @brief Moves every datagram waiting in the inbound rings into the receive queue.
+         *
+         * @return bool True if any datagram was moved.
+         */
+        bool drainShmRings(void);
+
+        /**
+         * @brief Creates the receive queue of the configured nodeOptions::rxqueuemode.
+         */
+        void allocateRxQueues(void);
+
+        /**
+         * @brief Runs a function on a temporary thread pinned to a set of CPUs.
+         *
+         * Memory the function first touches is placed on the NUMA node of
+         * those CPUs. Runs it on the calling thread if the set is empty.
+         *
+         * @param cpus CPUs to run on.
+         * @param fn The function.
+         */
+        void runOnCpus(const std::vector<int> &cpus, const std::function<void()> &fn);
+
+        /**
+         * @brief Starts the parse worker pool when nodeOptions::parseworkers is set.
+         */
+        void startParseWorkers(void);
+
+        /**
+         * @brief Stops the parse workers after they drained their rings.
+         */
+        void stopParseWorkers(void);
+
+        /**
+         * @brief Body of a parse worker thread.
+         *
+         * @param index Index of the worker.
+         */
+        void parseWorkerLoop(unsigned int index);
+
+        /**
+         * @brief Picks the parse worker for a datagram.
+         *
+         * @param datagram The datagram, with its source address filled.
+         * @return size_t Index of the worker.
+         */
+        size_t parseWorkerFor(const rxDatagram &datagram);
+
+        /**
+         * @brief Hashes the binary source address and port of a sender.
+         *
+         * @param addr The sender address.
+         * @return uint64_t The hash.
+         */
+        static uint64_t sourceHash(const struct sockaddr_storage &addr);
+
+        /**
+         * @brief Extracts the local address, interface and kernel drop count from the ancillary data of a datagram.
+         *
+         * @param sockidx Index of the listening socket the datagram arrived on.
+         * @param mh The message header filled by recvmsg().
+         * @param datagram The datagram to update.
+         */
+        void readAncillaryData(size_t sockidx, const struct msghdr &mh, rxDatagram &datagram);
+
+        /**
+         * @brief Sets a socket buffer size, using the FORCE variant first when configured.
+         *
+         * @param sockfd The socket to configure.
+         * @param optname SO_RCVBUF or SO_SNDBUF.
+         * @param size Requested size in bytes.
+         * @return err_code Error code indicating success or failure.
+         */
+        err_code setSocketBufferSize(int sockfd, int optname, int size);
+
+        /**
+         * @brief Grows the receive buffer of a listening socket after kernel drops.
+         *
+         * @param sockidx Index of the listening socket.
+         */
+        void growRxBuffer(size_t sockidx);
+
         /**
          * @brief Parses a received datagram and extracts its contents.
          * 
@@ -217,12 +1278,83 @@ class UDPNode{
         // Queue to store received datagrams.
         std::queue<rxDatagram> _rxqueue;
 
+        // Overflow of _rxqueue on disk, protected by _mtx. Once it holds a datagram,
+        // new datagrams are appended to it too, so the order is preserved.
+        std::unique_ptr<SpillQueue> _spill;
+
+        // Datagrams written to _spill.
+        std::atomic<uint64_t> _spilled;
+
+        // Journal of every valid datagram received, fed by the receive path.
+        std::unique_ptr<JournalWriter> _journal;
+
+        // Outbound shared-memory ring to a same-host node.
+        struct shmPeer{
+            std::unique_ptr<ShmRing> ring;
+            int connfd;             // Handshake connection, kept open so the peer notices when this node goes away.
+            std::mutex mtx;         // Serializes the producers of the ring.
+
+            ~shmPeer(){
+                if(connfd != -1){
+                    close(connfd);
+                }
+            }
+        };
+
+        // Inbound shared-memory ring from a same-host node.
+        struct shmInbound{
+            std::unique_ptr<ShmRing> ring;
+            int connfd;
+            int rxsockfd;           // Listening socket the peer addressed, used by reply().
+        };
+
+        // Accepted shared-memory peer whose hello has not arrived yet.
+        struct shmPending{
+            int fd;
+            size_t listener;        // Index in _shmlisteners.
+            std::chrono::steady_clock::time_point deadline;
+        };
+
+        // Rendezvous socket accepting shared-memory peers for one listening socket.
+        struct shmListener{
+            int fd;
+            std::string path;       // Removed when the listener is closed.
+            int rxsockfd;           // The listening socket it stands for.
+        };
+
+        // Outbound rings by rendezvous path.
+        std::unordered_map<std::string, std::shared_ptr<shmPeer>> _shmpeers;
+        std::mutex _shmmtx;
+
+        // Rendezvous paths nobody listened on, forgotten when inotify reports one created in shmdir; -1 without a watch.
+        std::unordered_set<std::string> _shmabsent;
+        int _shmnotifyfd;
+
+        // Addresses of the local interfaces, read once when the shared-memory transport is enabled.
+        std::vector<struct sockaddr_storage> _localaddrs;
+
+        // Listeners for shared-memory peers and the thread reading their rings, which owns _shmpending and _shminbound while it runs.
+        std::vector<shmListener> _shmlisteners;
+        std::thread _shmthread;
+        std::vector<shmPending> _shmpending;
+        std::vector<shmInbound> _shminbound;
+        std::atomic<uint64_t> _shmreceived;
+
+        // Datagrams queued by txLoopback() of nodes of this process.
+        std::atomic<uint64_t> _loopbackreceived;
+
+        // Per-source queue used instead of _rxqueue in RXQ_FAIR mode, protected by _mtx.
+        std::unique_ptr<FairQueue<rxDatagram>> _fairqueue;
+
         // Atomic flag to control the receive loop.
         std::atomic<bool> _stoprecvthread; 
         
         // Thread for the receive loop.
         std::thread _rxthread;
 
+        // Eventfd polled with the listening sockets; written to wake the receive loop for shutdown.
+        int _wakefd;
+
         // String to store the current message being processed.
         std::string _message;
 
@@ -232,9 +1364,174 @@ class UDPNode{
         // Port number to bind the socket.
         int _listenport; 
 
-        // File descriptor for the listening & sending sockets.
-        int _listensockfd, _sendsockfd;
+        // File descriptor for the primary listening socket.
+        int _listensockfd;
+
+        // Filesystem path of the bound Unix socket, removed when the socket is closed; empty for abstract names.
+        std::string _unixpath;
+
+        // Address bound on nodeOptions::transport, and whether it still is.
+        struct sockaddr_storage _transportaddr;
+        bool _transportbound;
+
+        // Structure describing a bound listening socket.
+        struct listenSocket{
+            int fd;         // File descriptor of the socket.
+            int family;     // Address family of the socket.
+            int port;       // Local port the socket is bound to.
+            uint32_t kerneldrops;   // Last cumulative SO_RXQ_OVFL count seen on the socket.
+            struct sockaddr_storage addr;   // Bound address (getsockname()), a wildcard for any local address.
+        };
+
+        // Every bound listening socket; the first one is _listensockfd.
+        std::vector<listenSocket> _listensockets;
+
+        // Receive counters reported by getRxStats().
+        std::atomic<uint64_t> _received, _queued, _parsedrops, _crcdrops, _queuefulldrops, _kerneldrops, _pipelinedrops;
+
+        // Structure holding a datagram received for a parse worker.
+        struct rawDatagram{
+            std::unique_ptr<char[]> buf;    // Received bytes, _maxmessagesize long.
+            int numbytes;                   // Number of bytes received.
+            rxDatagram datagram;            // Address and ancillary fields filled by the receive thread.
+        };
+
+        // Structure holding a parse worker thread and its input ring.
+        struct parseWorker{
+            parseWorker(size_t capacity):work(capacity){}
+            std::thread thread;                 // The worker thread.
+            RingBuffer<rawDatagram *> work;     // Datagrams waiting to be parsed, in arrival order.
+            std::atomic<uint32_t> signal;       // Bumped by the receive thread to wake the worker.
+        };
+
+        // Parse workers of the pipelined receive mode.
+        std::vector<std::unique_ptr<parseWorker>> _workers;
+
+        // Raw buffers owned by the pipeline and the ring of the free ones.
+        std::vector<std::unique_ptr<rawDatagram>> _rawpool;
+        std::unique_ptr<RingBuffer<rawDatagram *>> _freeraw;
+
+        // Flag telling the parse workers to exit once drained.
+        std::atomic<bool> _stopworkers;
+
+        // Round-robin counter used when source order is not preserved.
+        size_t _nextworker;
+
+        // Structure holding one receive partition.
+        struct rxPartition{
+            std::mutex mtx;                 // Protects the partition.
+            std::queue<rxDatagram> queue;   // Datagrams of the keys mapped to the partition.
+            size_t highwatermark = 0;       // Largest depth seen.
+            uint64_t enqueued = 0;          // Datagrams written.
+            uint64_t drops = 0;             // Datagrams dropped because the partition was full.
+        };
+
+        // Receive partitions of the RXQ_PARTITIONED mode.
+        std::vector<std::unique_ptr<rxPartition>> _partitions;
+
+        // Next partition tried by readRxDatagramFromQueue().
+        std::atomic<unsigned int> _nextpartition;
+
+        // Structure holding one priority lane.
+        struct priorityLane{
+            priorityLane(size_t cap):ring(cap, true){}
+            RingBuffer<rxDatagram> ring;    // Queued datagrams.
+            size_t capacity;                // Configured capacity.
+            dropPolicy policy;              // What to discard when full.
+            std::atomic<uint64_t> enqueued, drops;
+        };
+
+        // Priority lanes of the RXQ_PRIORITY mode, lowest priority first.
+        std::vector<std::unique_ptr<priorityLane>> _lanes;
+
+        // Fixed-size part of a conflated datagram; the message is stored next to it.
+        struct conflatedHeader{
+            unsigned int srcport;
+            time_t time_stamp;
+            unsigned int crc_checksum;
+            unsigned int priority;
+            struct sockaddr_storage srcaddr;
+            socklen_t srcaddrlen;
+            char srcipaddr[INET6_ADDRSTRLEN];
+            char dstipaddr[INET6_ADDRSTRLEN];
+            struct sockaddr_storage dstaddr;
+            unsigned int dstport;
+            unsigned int ifindex;
+            int rxsockfd;
+            uint32_t kerneldrops;
+            uint64_t arrivalns;
+            uint64_t deadlinens;
+        };
+
+        // Latest datagram per key in RXQ_CONFLATED mode.
+        std::unique_ptr<ConflationTable<conflatedHeader>> _conflation;
+
+        // Unread datagrams replaced by newer ones.
+        std::atomic<uint64_t> _conflated;
+
+        // Skipped expired datagrams.
+        std::atomic<uint64_t> _expireddrops;
+
+        // Set once a datagram with a deadline was queued, so dequeues without deadlines skip the clock.
+        std::atomic<bool> _deadlines;
+
+        /**
+         * @brief Returns the time used for deadlines, or 0 if no queued datagram can have one.
+         *
+         * @return uint64_t Nanoseconds since the epoch.
+         */
+        uint64_t expiryClock(void);
+
+        /**
+         * @brief Checks whether a dequeued datagram has expired and counts it if so.
+         *
+         * @param datagram The datagram.
+         * @param now Result of expiryClock().
+         * @return bool True if the datagram must be skipped.
+         */
+        bool isExpired(const rxDatagram &datagram, uint64_t now){
+            if(now != 0 && datagram.deadlinens != 0 && datagram.deadlinens <= now){
+                _expireddrops.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        // Converts a conflated entry back to a datagram.
+        static void fromConflated(const conflatedHeader &header, std::string &&msg, rxDatagram &datagram);
+
+        // Open-addressing table of per-source token buckets, protected by _ratemtx.
+        std::vector<rateBucket> _ratetable;
+        size_t _rateused;
+
+        // Bucket shared by the sources a full table cannot track, and time of the last sweep for idle buckets.
+        rateBucket _rateoverflow;
+        int64_t _ratesweep;
+        std::mutex _ratemtx;
+
+        // Counts of the heaviest offenders swept out of the table, at most RATE_OFFENDERS entries.
+        std::vector<rateBucket> _rateoffenders;
+
+        // Number of sources with overridden limits.
+        size_t _ratecustomsources;
+
+        // True when a default or per-source limit is set.
+        std::atomic<bool> _ratelimiting;
+
+        // Datagrams rejected by the rate limiter.
+        std::atomic<uint64_t> _ratelimitdrops;
+
+        // Subscription filter, swapped atomically; _filtering skips the load when none is set.
+        std::atomic<std::shared_ptr<const RxFilter>> _rxfilter;
+        std::atomic<bool> _filtering;
+
+        // Datagrams passed and dropped by the subscription filter.
+        std::atomic<uint64_t> _filterpassed;
+        std::atomic<uint64_t> _filterdrops;
 
          // Flag to enable/disable debug mode.
         bool _debug;
+
+        // Optional node settings.
+        nodeOptions _options;
 };
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "UDPNode.h"
+
+// Round-trip latency and CPU cost of each receive wait strategy.
+// A client pings an echo node over loopback; both nodes use the same strategy.
+// Only the two receive threads' CPU time is counted (getRxStats().rxcpuns):
+// the client and echo threads poll the queues and would otherwise dominate it.
+
+static double rxCpuSeconds(UDPNode &a, UDPNode &b){
+    return (a.getRxStats().rxcpuns + b.getRxStats().rxcpuns) / 1e9;
+}
+
+int main(void){
+    const int pings = 1000;
+    const waitStrategy strategies[] = {WAIT_BLOCK, WAIT_SPIN, WAIT_SPIN_YIELD, WAIT_SPIN_BLOCK};
+    const char *names[] = {"block", "spin", "spin-then-yield", "spin-then-block"};
+
+    for(int s = 0; s < 4; s++){
+        nodeOptions opts;
+        opts.txfromlistensocket = true;
+        opts.rxwait = strategies[s];
+        opts.rxbatch = 16;
+
+        UDPNode server(7000 + s, ipv4, 1024, 100, false, opts);
+        UDPNode client(7100 + s, ipv4, 1024, 100, false, opts);
+        server.startRxLoop();
+        client.startRxLoop();
+
+        std::atomic<bool> done(false);
+        std::thread echo([&](){
+            while(!done){
+                if(server.rxDataAvailable()){
+                    server.reply(server.readRxDatagramFromQueue(), "pong");
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        std::vector<double> rtts;
+        double cpu0 = rxCpuSeconds(server, client);
+        auto wall0 = std::chrono::steady_clock::now();
+        for(int i = 0; i < pings; i++){
+            auto t0 = std::chrono::steady_clock::now();
+            client.tx(7000 + s, ipv4, "127.0.0.1", "ping");
+            while(!client.rxDataAvailable()){
+                std::this_thread::yield();
+            }
+            client.readRxDatagramFromQueue();
+            rtts.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+        }
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall0).count();
+        double cpu = rxCpuSeconds(server, client) - cpu0;
+
+        done = true;
+        echo.join();
+
+        std::sort(rtts.begin(), rtts.end());
+        std::cout << names[s] << ": p50 " << rtts[pings / 2] << " us, p99 " << rtts[pings * 99 / 100]
+                  << " us, receive threads " << (cpu / wall / 2) * 100 << "% of one core each"
+                  << " (spinbudget " << opts.spinbudget << ", idlethresholdus " << opts.idlethresholdus << ")" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include <stdio.h>
+
+// Checks shared by the test executables. A failed check is reported and
+// counted, and the test carries on; main() returns checkResult().
+
+static int checkFailures = 0;
+
+#define CHECK(cond) do{ \
+    if(!(cond)){ \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        checkFailures++; \
+    } \
+}while(0)
+
+/**
+ * @brief Reports the outcome of a test executable.
+ *
+ * @param name Name of the test.
+ * @return int Exit status: 0 if every check passed.
+ */
+static inline int checkResult(const char *name){
+    if(checkFailures > 0){
+        fprintf(stderr, "%s: %d check(s) failed\n", name, checkFailures);
+        return 1;
+    }
+    printf("%s: all checks passed\n", name);
+    return 0;
+}
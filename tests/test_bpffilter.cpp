@@ -0,0 +1,339 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "BpfFilter.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+// What a classic BPF program sees of a datagram.
+struct packet{
+    std::vector<uint8_t> net;   // IP header, read through SKF_NET_OFF.
+    std::vector<uint8_t> data;  // Bytes from offset 0: the UDP header and payload, or only the payload for reuseport programs.
+    uint32_t cpu = 0;           // Value of SKF_AD_CPU.
+};
+
+// Reads a big-endian value of 1, 2 or 4 bytes; false past the end.
+static bool loadBytes(const std::vector<uint8_t> &buf, uint32_t off, int width, uint32_t &value){
+    if((uint64_t)off + width > buf.size()){
+        return false;
+    }
+    value = 0;
+    for(int i = 0; i < width; i++){
+        value = (value << 8) | buf[off + i];
+    }
+    return true;
+}
+
+// Runs a program the way the kernel does; a load out of bounds returns 0.
+static uint32_t runProgram(const std::vector<struct sock_filter> &prog, const packet &p){
+    uint32_t a = 0, x = 0;
+    for(size_t pc = 0; pc < prog.size(); pc++){
+        const struct sock_filter &f = prog[pc];
+        uint32_t src = BPF_SRC(f.code) == BPF_X ? x : f.k;
+        switch(BPF_CLASS(f.code)){
+            case BPF_LD:
+                if(BPF_MODE(f.code) == BPF_LEN){
+                    a = p.data.size();
+                } else if(BPF_MODE(f.code) == BPF_IMM){
+                    a = f.k;
+                } else if(BPF_MODE(f.code) == BPF_ABS){
+                    int width = BPF_SIZE(f.code) == BPF_W ? 4 : BPF_SIZE(f.code) == BPF_H ? 2 : 1;
+                    int32_t k = (int32_t)f.k;
+                    bool ok;
+                    if(k == SKF_AD_OFF + SKF_AD_CPU){
+                        a = p.cpu;
+                        ok = true;
+                    } else if(k >= 0){
+                        ok = loadBytes(p.data, k, width, a);
+                    } else if(k >= SKF_NET_OFF && k < SKF_AD_OFF){
+                        ok = loadBytes(p.net, k - SKF_NET_OFF, width, a);
+                    } else {
+                        ok = false;
+                    }
+                    if(!ok){
+                        return 0;
+                    }
+                } else {
+                    return 0;
+                }
+                break;
+            case BPF_ALU:
+                switch(BPF_OP(f.code)){
+                    case BPF_ADD: a += src; break;
+                    case BPF_SUB: a -= src; break;
+                    case BPF_MUL: a *= src; break;
+                    case BPF_DIV: if(src == 0) return 0; a /= src; break;
+                    case BPF_MOD: if(src == 0) return 0; a %= src; break;
+                    case BPF_OR: a |= src; break;
+                    case BPF_AND: a &= src; break;
+                    case BPF_XOR: a ^= src; break;
+                    case BPF_LSH: a <<= src; break;
+                    case BPF_RSH: a >>= src; break;
+                    case BPF_NEG: a = -a; break;
+                    default: return 0;
+                }
+                break;
+            case BPF_JMP:
+                if(BPF_OP(f.code) == BPF_JA){
+                    pc += f.k;
+                } else {
+                    bool taken;
+                    switch(BPF_OP(f.code)){
+                        case BPF_JEQ: taken = a == src; break;
+                        case BPF_JGT: taken = a > src; break;
+                        case BPF_JGE: taken = a >= src; break;
+                        case BPF_JSET: taken = (a & src) != 0; break;
+                        default: return 0;
+                    }
+                    pc += taken ? f.jt : f.jf;
+                }
+                break;
+            case BPF_RET:
+                return BPF_RVAL(f.code) == BPF_A ? a : f.k;
+            case BPF_MISC:
+                if(BPF_MISCOP(f.code) == BPF_TAX){
+                    x = a;
+                } else {
+                    a = x;
+                }
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+// IPv4 or IPv6 header with a source address.
+static std::vector<uint8_t> ipHeader(const char *src){
+    std::vector<uint8_t> h;
+    unsigned char bytes[16];
+    if(inet_pton(AF_INET, src, bytes) == 1){
+        h.assign(20, 0);
+        h[0] = 0x45;
+        memcpy(&h[12], bytes, 4);
+    } else {
+        inet_pton(AF_INET6, src, bytes);
+        h.assign(40, 0);
+        h[0] = 0x60;
+        memcpy(&h[8], bytes, 16);
+    }
+    return h;
+}
+
+// Datagram as a socket filter sees it: UDP header, then the payload.
+static packet udpPacket(const char *src, const std::string &payload){
+    packet p;
+    p.net = ipHeader(src);
+    p.data.assign(8, 0);
+    p.data.insert(p.data.end(), payload.begin(), payload.end());
+    return p;
+}
+
+// Checks that the kernel accepts a program as a socket filter.
+static bool kernelAccepts(const std::vector<struct sock_filter> &prog){
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sock_fprog fprog;
+    fprog.len = prog.size();
+    fprog.filter = const_cast<struct sock_filter *>(prog.data());
+    bool ok = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof fprog) == 0;
+    close(fd);
+    return ok;
+}
+
+static void testEnvelopeFormat(void){
+    std::vector<struct sock_filter> prog = BpfProgram::envelopeFormat(64).build();
+    CHECK(!prog.empty());
+    CHECK(kernelAccepts(prog));
+    CHECK(runProgram(prog, udpPacket("10.0.0.1", "{\"Time\":1700000000,\"Msg\":\"hi\"}")) != 0);
+    CHECK(runProgram(prog, udpPacket("10.0.0.1", "{\"Time\"")) == 0);
+    CHECK(runProgram(prog, udpPacket("10.0.0.1", "hello world, not an envelope")) == 0);
+    CHECK(runProgram(prog, udpPacket("10.0.0.1", "{\"Time\":" + std::string(57, '1'))) == 0);
+    CHECK(runProgram(prog, udpPacket("10.0.0.1", "{\"Time\":" + std::string(56, '1'))) != 0);
+
+    // Prefixes of every length are compared a word, half-word or byte at a time.
+    for(const std::string magic : {"a", "ab", "abc", "abcdefg"}){
+        std::vector<struct sock_filter> p = BpfProgram().requirePrefix(magic).build();
+        CHECK(runProgram(p, udpPacket("10.0.0.1", magic + "tail")) != 0);
+        std::string wrong = magic;
+        wrong.back() ^= 1;
+        CHECK(runProgram(p, udpPacket("10.0.0.1", wrong + "tail")) == 0);
+        CHECK(runProgram(p, udpPacket("10.0.0.1", magic.substr(0, magic.size() - 1))) == 0);
+    }
+}
+
+static void testAllowSources(void){
+    std::vector<struct sock_filter> prog = BpfProgram().allowSources({"10.0.0.0/8", "192.168.1.7", "fd00::/8", "2001:db8::/127"}).build();
+    CHECK(!prog.empty());
+    CHECK(kernelAccepts(prog));
+    CHECK(runProgram(prog, udpPacket("10.200.0.1", "x")) != 0);
+    CHECK(runProgram(prog, udpPacket("11.0.0.1", "x")) == 0);
+    CHECK(runProgram(prog, udpPacket("192.168.1.7", "x")) != 0);
+    CHECK(runProgram(prog, udpPacket("192.168.1.8", "x")) == 0);
+    CHECK(runProgram(prog, udpPacket("fd12::1", "x")) != 0);
+    CHECK(runProgram(prog, udpPacket("fe80::1", "x")) == 0);
+    CHECK(runProgram(prog, udpPacket("2001:db8::1", "x")) != 0);
+    CHECK(runProgram(prog, udpPacket("2001:db8::2", "x")) == 0);
+
+    // One family's networks say nothing about the other's.
+    std::vector<struct sock_filter> v6only = BpfProgram().allowSources({"::/0"}).build();
+    CHECK(runProgram(v6only, udpPacket("fe80::1", "x")) != 0);
+    CHECK(runProgram(v6only, udpPacket("10.0.0.1", "x")) == 0);
+    std::vector<struct sock_filter> v4all = BpfProgram().allowSources({"0.0.0.0/0"}).build();
+    CHECK(runProgram(v4all, udpPacket("203.0.113.9", "x")) != 0);
+    CHECK(runProgram(v4all, udpPacket("::1", "x")) == 0);
+
+    // Checks combine: the length check runs before the sources.
+    std::vector<struct sock_filter> both = BpfProgram().requireLength(2, 10).allowSources({"10.0.0.0/8"}).build();
+    CHECK(runProgram(both, udpPacket("10.0.0.1", "ok")) != 0);
+    CHECK(runProgram(both, udpPacket("10.0.0.1", "o")) == 0);
+    CHECK(runProgram(both, udpPacket("11.0.0.1", "ok")) == 0);
+
+    // Jumps past a long list of networks still reach their targets.
+    std::vector<std::string> many;
+    for(int i = 0; i < 100; i++){
+        many.push_back("10." + std::to_string(i) + ".0.0/16");
+    }
+    for(int i = 1; i <= 20; i++){
+        many.push_back("fd00:" + std::to_string(i) + "::/32");
+    }
+    BpfProgram large;
+    large.requireLength(1, 100).allowSources(many);
+    CHECK(large.valid());
+    std::vector<struct sock_filter> longprog = large.build();
+    CHECK(longprog.size() > 256);
+    CHECK(kernelAccepts(longprog));
+    CHECK(runProgram(longprog, udpPacket("10.0.1.1", "x")) != 0);
+    CHECK(runProgram(longprog, udpPacket("10.99.1.1", "x")) != 0);
+    CHECK(runProgram(longprog, udpPacket("10.100.1.1", "x")) == 0);
+    CHECK(runProgram(longprog, udpPacket("10.99.1.1", "")) == 0);
+    CHECK(runProgram(longprog, udpPacket("fd00:1::1", "x")) != 0);
+    CHECK(runProgram(longprog, udpPacket("fd00:20::1", "x")) != 0);
+    CHECK(runProgram(longprog, udpPacket("fd00:21::1", "x")) == 0);
+
+    // A program the kernel would refuse is invalid.
+    many.clear();
+    for(int i = 0; i < 2000; i++){
+        many.push_back("10." + std::to_string(i / 256) + "." + std::to_string(i % 256) + ".0/24");
+    }
+    BpfProgram huge;
+    huge.allowSources(many);
+    CHECK(!huge.valid());
+    CHECK(huge.build().empty());
+
+    // Malformed networks make the program invalid instead of widening it.
+    for(const char *bad : {"10.0.0.0/x", "10.0.0.0/-1", "10.0.0.0/+8", "10.0.0.0/33", "10.0.0.0/", "fd00::/129", "bogus/8"}){
+        BpfProgram p;
+        p.allowSources({"192.168.0.0/16", bad});
+        CHECK(!p.valid());
+        CHECK(p.build().empty());
+    }
+}
+
+// Shard a payload key steers to, computed as the program should.
+static uint32_t expectedShard(uint32_t key, unsigned int shards){
+    uint32_t m = key * 0x9e3779b1u;
+    return (m ^ (m >> 16)) % shards;
+}
+
+static void testSteering(void){
+    packet p;
+    p.cpu = 13;
+    std::vector<struct sock_filter> cpu = BpfProgram::reuseportSteering(STEER_CPU, 4);
+    CHECK(runProgram(cpu, p) == 1);
+
+    // The same source always lands on the same shard, and every shard is in range.
+    std::vector<struct sock_filter> source = BpfProgram::reuseportSteering(STEER_SOURCE_HASH, 5);
+    packet a, b;
+    a.net = ipHeader("10.0.0.1");
+    b.net = ipHeader("10.0.0.1");
+    b.data.assign(10, 'x');
+    CHECK(runProgram(source, a) == runProgram(source, b));
+    CHECK(runProgram(source, a) == expectedShard(0x0a000001, 5));
+    a.net = ipHeader("2001:db8::1:2");
+    CHECK(runProgram(source, a) == expectedShard(0x20010db8 ^ 0 ^ 0 ^ 0x00010002, 5));
+
+    // Keys of 1 to 4 bytes are read big-endian at their offset.
+    packet k;
+    std::string payload = "{\"Time\":1700000000,\"Msg\":\"\x12\x34\x56\x78 rest";
+    k.data.assign(payload.begin(), payload.end());
+    uint32_t keys[5] = {0, 0x12, 0x1234, 0x123456, 0x12345678};
+    for(unsigned int len = 1; len <= 4; len++){
+        std::vector<struct sock_filter> key = BpfProgram::reuseportSteering(STEER_PAYLOAD_KEY, 7, ENVELOPE_MSG_OFFSET, len);
+        CHECK(!key.empty());
+        CHECK(runProgram(key, k) == expectedShard(keys[len], 7));
+    }
+
+    // A 3-byte key depends on exactly its three bytes.
+    std::vector<struct sock_filter> key3 = BpfProgram::reuseportSteering(STEER_PAYLOAD_KEY, 1000, 0, 3);
+    packet x, y;
+    x.data = {1, 2, 3, 4};
+    y.data = {1, 2, 3, 9};
+    CHECK(runProgram(key3, x) == runProgram(key3, y));
+    y.data = {1, 2, 4, 4};
+    CHECK(runProgram(key3, x) == expectedShard(0x010203, 1000));
+    CHECK(runProgram(key3, y) == expectedShard(0x010204, 1000));
+
+    CHECK(BpfProgram::reuseportSteering(STEER_PAYLOAD_KEY, 4, 0, 0).empty());
+    CHECK(BpfProgram::reuseportSteering(STEER_PAYLOAD_KEY, 4, 0, 5).empty());
+    CHECK(BpfProgram::reuseportSteering(STEER_CPU, 0).empty());
+
+    // The kernel loads every steering program into a reuseport group.
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one);
+    for(const auto &prog : {cpu, source, key3, BpfProgram::reuseportSteering(STEER_PAYLOAD_KEY, 3, ENVELOPE_MSG_OFFSET, 4)}){
+        struct sock_fprog fprog;
+        fprog.len = prog.size();
+        fprog.filter = const_cast<struct sock_filter *>(prog.data());
+        CHECK(setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof fprog) == 0);
+    }
+    close(fd);
+}
+
+// Attached to a socket, the envelope filter drops other datagrams in the kernel.
+static void testKernelFilter(void){
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof addr;
+    CHECK(bind(rx, (struct sockaddr *)&addr, sizeof addr) == 0);
+    getsockname(rx, (struct sockaddr *)&addr, &len);
+
+    std::vector<struct sock_filter> prog = BpfProgram::envelopeFormat(1024).build();
+    struct sock_fprog fprog;
+    fprog.len = prog.size();
+    fprog.filter = prog.data();
+    CHECK(setsockopt(rx, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof fprog) == 0);
+
+    const std::string junk = "junk", envelope = "{\"Time\":1700000000,\"Msg\":\"ok\"}";
+    sendto(tx, junk.data(), junk.size(), 0, (struct sockaddr *)&addr, sizeof addr);
+    sendto(tx, envelope.data(), envelope.size(), 0, (struct sockaddr *)&addr, sizeof addr);
+
+    char buf[2048];
+    struct pollfd pfd = {rx, POLLIN, 0};
+    CHECK(poll(&pfd, 1, 1000) == 1);
+    ssize_t n = recv(rx, buf, sizeof buf, MSG_DONTWAIT);
+    CHECK(n == (ssize_t)envelope.size() && std::string(buf, n) == envelope);
+    CHECK(recv(rx, buf, sizeof buf, MSG_DONTWAIT) == -1);
+    close(rx);
+    close(tx);
+}
+
+int main(void){
+    testEnvelopeFormat();
+    testAllowSources();
+    testSteering();
+    testKernelFilter();
+    return checkResult("bpffilter");
+}
@@ -0,0 +1,105 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "ConflationTable.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+struct testHeader{
+    uint64_t version;
+};
+
+// Later writes replace the value and the key is listed once until popped.
+static void testLatestValue(void){
+    ConflationTable<testHeader> table(4, 16);
+    bool conflated;
+    CHECK(table.write(7, testHeader{1}, "one", 3, conflated));
+    CHECK(!conflated);
+    CHECK(table.write(7, testHeader{2}, "two", 3, conflated));
+    CHECK(conflated);
+    CHECK(table.write(9, testHeader{1}, "nine", 4, conflated));
+    CHECK(!conflated);
+    CHECK(table.keys() == 2);
+    CHECK(table.updated() == 2);
+
+    testHeader header;
+    std::string data;
+    CHECK(table.read(7, header, data));
+    CHECK(header.version == 2 && data == "two");
+    CHECK(!table.read(8, header, data));
+
+    uint64_t key;
+    CHECK(table.popUpdated(key, header, data));
+    CHECK(key == 7 && header.version == 2 && data == "two");
+    CHECK(table.popUpdated(key, header, data));
+    CHECK(key == 9 && data == "nine");
+    CHECK(!table.popUpdated(key, header, data));
+
+    // A popped key is listed again by its next write, which is not a conflation.
+    CHECK(table.write(9, testHeader{2}, "nine2", 5, conflated));
+    CHECK(!conflated);
+    CHECK(table.popUpdated(key, header, data));
+    CHECK(key == 9 && data == "nine2");
+}
+
+// Payloads are truncated to maxbytes, and every key of a full table keeps its own payload.
+static void testCapacity(void){
+    const size_t keys = 37, maxbytes = 8;
+    ConflationTable<testHeader> table(keys, maxbytes);
+    bool conflated;
+    CHECK(table.write(1000, testHeader{0}, "0123456789", 10, conflated));
+    for(size_t k = 1; k < keys; k++){
+        std::string payload(maxbytes, (char)('A' + k % 26));
+        CHECK(table.write(k, testHeader{k}, payload.data(), payload.size(), conflated));
+    }
+    CHECK(table.keys() == keys);
+    CHECK(!table.write(5000, testHeader{0}, "x", 1, conflated));
+    CHECK(table.write(3, testHeader{3}, "DDDDDDDD", 8, conflated));
+
+    testHeader header;
+    std::string data;
+    CHECK(table.read(1000, header, data));
+    CHECK(data == "01234567");
+    for(size_t k = 1; k < keys; k++){
+        CHECK(table.read(k, header, data));
+        CHECK(header.version == k);
+        CHECK(data == std::string(maxbytes, (char)('A' + k % 26)));
+    }
+}
+
+// Readers racing with a writer never see a header and payload from different writes.
+static void testConcurrentRead(void){
+    ConflationTable<testHeader> table(1, 64);
+    bool conflated;
+    CHECK(table.write(1, testHeader{0}, "0", 1, conflated));
+    std::atomic<bool> stop(false);
+    std::atomic<int> torn(0);
+    std::thread reader([&](){
+        testHeader header;
+        std::string data;
+        while(!stop.load()){
+            if(table.read(1, header, data) && data != std::to_string(header.version)){
+                torn++;
+            }
+        }
+    });
+    for(uint64_t v = 1; v <= 200000; v++){
+        std::string payload = std::to_string(v);
+        table.write(1, testHeader{v}, payload.data(), payload.size(), conflated);
+    }
+    stop = true;
+    reader.join();
+    CHECK(torn.load() == 0);
+    CHECK(table.updated() == 1);
+}
+
+int main(void){
+    testLatestValue();
+    testCapacity();
+    testConcurrentRead();
+    return checkResult("conflation");
+}
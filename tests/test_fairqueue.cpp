@@ -0,0 +1,138 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "FairQueue.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Equal costs alternate between the backlogged sources, whatever the arrival order.
+static void testRoundRobin(void){
+    FairQueue<int> q(100, 100, 10);
+    for(int i = 0; i < 6; i++){
+        CHECK(q.push(1, 100 + i, 10));
+    }
+    for(int i = 0; i < 3; i++){
+        CHECK(q.push(2, 200 + i, 10));
+    }
+    CHECK(q.size() == 9);
+    CHECK(q.activeSources() == 2);
+
+    int expected[] = {100, 200, 101, 201, 102, 202, 103, 104, 105};
+    int value;
+    for(int e : expected){
+        CHECK(q.pop(value));
+        CHECK(value == e);
+    }
+    CHECK(!q.pop(value));
+    CHECK(q.empty());
+    CHECK(q.activeSources() == 0);
+}
+
+// A source sending elements three times the quantum is served once every three turns.
+static void testDeficit(void){
+    FairQueue<std::string> q(100, 100, 100);
+    for(int i = 0; i < 2; i++){
+        CHECK(q.push(1, "big", 300));
+    }
+    for(int i = 0; i < 6; i++){
+        CHECK(q.push(2, "small", 100));
+    }
+    std::vector<std::string> order;
+    std::string value;
+    while(q.pop(value)){
+        order.push_back(value);
+    }
+    std::vector<std::string> expected = {"small", "small", "big", "small", "small", "small", "big", "small"};
+    CHECK(order == expected);
+}
+
+// The per-source cap is enforced, and a full queue makes room for shorter sub-queues.
+static void testCaps(void){
+    FairQueue<int> q(5, 3, 1);
+    CHECK(q.push(1, 10, 1));
+    CHECK(q.push(1, 11, 1));
+    CHECK(q.push(1, 12, 1));
+    CHECK(!q.push(1, 13, 1));
+    CHECK(q.push(2, 20, 1));
+    CHECK(q.push(2, 21, 1));
+    CHECK(q.size() == 5);
+
+    // A new source pushes out the newest element of the longest sub-queue.
+    CHECK(q.push(3, 30, 1));
+    CHECK(q.size() == 5);
+    CHECK(q.pushOuts() == 1);
+
+    // No sub-queue is longer than source 3's would become, so it is refused.
+    CHECK(!q.push(3, 31, 1));
+    CHECK(!q.push(1, 13, 1));
+    CHECK(q.pushOuts() == 1);
+
+    int expected[] = {10, 20, 30, 11, 21};
+    int value;
+    for(int e : expected){
+        CHECK(q.pop(value));
+        CHECK(value == e);
+    }
+    CHECK(q.empty());
+
+    // Raising the cap lets the source queue more.
+    q.setLimits(10, 1);
+    for(int i = 0; i < 5; i++){
+        CHECK(q.push(1, 40 + i, 1));
+    }
+    CHECK(!q.push(1, 45, 1));
+    CHECK(q.pushOuts() == 1);
+}
+
+// A source already at a lowered cap is refused without pushing out another source's element.
+static void testLoweredCap(void){
+    FairQueue<int> q(4, 4, 1);
+    for(int i = 0; i < 4; i++){
+        CHECK(q.push(1, 10 + i, 1));
+    }
+    q.setLimits(0, 1);
+    CHECK(!q.push(2, 20, 1));
+    CHECK(q.size() == 4);
+    CHECK(q.pushOuts() == 0);
+}
+
+// Growing the source table keeps every element and each source's order.
+static void testManySources(void){
+    const int sources = 1000, per = 5;
+    FairQueue<std::pair<int, int>> q(sources * per, per, 1);
+    for(int i = 0; i < per; i++){
+        for(int s = 0; s < sources; s++){
+            CHECK(q.push((uint64_t)s * 0x10001, std::make_pair(s, i), 1));
+        }
+    }
+    CHECK(q.activeSources() == (size_t)sources);
+
+    std::map<int, int> next;
+    std::pair<int, int> value;
+    int popped = 0;
+    while(q.pop(value)){
+        CHECK(next[value.first] == value.second);
+        next[value.first]++;
+        popped++;
+    }
+    CHECK(popped == sources * per);
+
+    // Idle sources are dropped on the next growth and new ones still fit.
+    for(int s = 0; s < 2 * sources; s++){
+        CHECK(q.push((uint64_t)s + 7, std::make_pair(s, 0), 1));
+    }
+    CHECK(q.size() == (size_t)2 * sources);
+}
+
+int main(void){
+    testRoundRobin();
+    testDeficit();
+    testCaps();
+    testLoweredCap();
+    testManySources();
+    return checkResult("fairqueue");
+}
@@ -0,0 +1,192 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "UDPNode.h"
+#include "Journal.h"
+#include "RecordFormat.h"
+
+#include <dirent.h>
+#include <chrono>
+#include <thread>
+
+static const uint64_t BASE_NS = 1700000000000000000ULL;
+
+// Datagram number i, arriving i ms after BASE_NS.
+static rxDatagram makeDatagram(int i){
+    rxDatagram d;
+    memset(&d.srcaddr, 0, sizeof d.srcaddr);
+    struct sockaddr_in *sin = (struct sockaddr_in *)&d.srcaddr;
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(4000);
+    inet_pton(AF_INET, "10.0.0.1", &sin->sin_addr);
+    d.srcaddrlen = sizeof *sin;
+    d.srcport = 4000;
+    d.srcipaddr = "10.0.0.1";
+    d.time_stamp = 1700000000;
+    d.msg = "record " + std::to_string(i) + std::string(i % 300, '.');
+    d.crc_checksum = 0;
+    d.jointhread = false;
+    d.dstipaddr = "10.0.0.2";
+    d.dstport = 5000;
+    d.ifindex = 1;
+    d.arrivalns = BASE_NS + (uint64_t)i * 1000000ULL;
+    return d;
+}
+
+// Appends a datagram, waiting while every buffer is queued for the disk.
+static void append(JournalWriter &writer, const rxDatagram &datagram){
+    while(!writer.append(datagram)){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// Removes the files of a test directory and the directory.
+static void removeDir(const std::string &dir){
+    DIR *d = opendir(dir.c_str());
+    if(d != NULL){
+        while(struct dirent *e = readdir(d)){
+            if(strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0){
+                unlink((dir + "/" + e->d_name).c_str());
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+// Records come back in order across rotated files, and numbering continues after a restart.
+static void testRoundTrip(const std::string &dir){
+    const int n = 2000;
+    {
+        JournalWriter writer(dir, "rt", 16 * 1024, 4096, 10);
+        for(int i = 0; i < n; i++){
+            append(writer, makeDatagram(i));
+        }
+        CHECK(writer.records() == (uint64_t)n);
+    }
+    std::vector<std::string> files = JournalReader::list(dir, "rt");
+    CHECK(files.size() > 2);
+
+    JournalReader reader;
+    rxDatagram d;
+    int next = 0;
+    for(const auto &path : files){
+        CHECK(reader.open(path));
+        while(reader.next(d)){
+            rxDatagram expected = makeDatagram(next);
+            CHECK(d.msg == expected.msg);
+            CHECK(d.arrivalns == expected.arrivalns);
+            CHECK(d.srcipaddr == "10.0.0.1" && d.srcport == 4000);
+            next++;
+        }
+    }
+    CHECK(next == n);
+
+    // A second writer appends new files after the existing ones.
+    {
+        JournalWriter writer(dir, "rt", 16 * 1024, 4096, 10);
+        append(writer, makeDatagram(n));
+    }
+    std::vector<std::string> after = JournalReader::list(dir, "rt");
+    CHECK(after.size() == files.size() + 1);
+    CHECK(std::equal(files.begin(), files.end(), after.begin()));
+    // A record larger than a buffer is dropped and counted.
+    {
+        JournalWriter writer(dir, "big", 16 * 1024, 4096, 10);
+        rxDatagram big = makeDatagram(0);
+        big.msg.assign(5000, 'x');
+        CHECK(!writer.append(big));
+        CHECK(writer.drops() == 1);
+        CHECK(writer.records() == 0);
+    }
+
+    CHECK(reader.open(after.back()));
+    CHECK(reader.next(d));
+    CHECK(d.msg == makeDatagram(n).msg);
+    CHECK(!reader.next(d));
+
+    // Other prefixes are not listed.
+    CHECK(JournalReader::list(dir, "other").empty());
+}
+
+// seek() lands on the last indexed buffer at or before a time, never past the wanted record.
+static void testIndexSeek(const std::string &dir){
+    const int n = 1000;
+    {
+        JournalWriter writer(dir, "idx", 4 * 1024 * 1024, 4096, 10);
+        for(int i = 0; i < n; i++){
+            append(writer, makeDatagram(i));
+        }
+    }
+    std::vector<std::string> files = JournalReader::list(dir, "idx");
+    CHECK(files.size() == 1);
+    if(files.size() != 1){
+        return;
+    }
+
+    JournalReader reader;
+    CHECK(reader.open(files[0]));
+    rxDatagram d;
+    for(int target : {0, 1, 137, 500, 999}){
+        uint64_t t = makeDatagram(target).arrivalns;
+        reader.seek(t);
+        CHECK(reader.next(d));
+        CHECK(d.arrivalns <= t);
+
+        // The index skips whole buffers, so fewer than a buffer's worth of records are left to skip.
+        int skipped = 0;
+        while(d.arrivalns < t && reader.next(d)){
+            skipped++;
+        }
+        CHECK(d.arrivalns == t);
+        CHECK(skipped < 4096 / (int)RECORD_HEADER_LEN);
+    }
+
+    // Before the first record seeks to the start, after the last to the last buffer.
+    reader.seek(BASE_NS - 1);
+    CHECK(reader.next(d));
+    CHECK(d.msg == makeDatagram(0).msg);
+    reader.seek(UINT64_MAX);
+    int tail = 0;
+    while(reader.next(d)){
+        tail++;
+    }
+    CHECK(tail > 0 && tail < n);
+    CHECK(d.msg == makeDatagram(n - 1).msg);
+}
+
+// The flush interval writes a partly filled buffer while the writer runs.
+static void testFlush(const std::string &dir){
+    JournalWriter writer(dir, "flush", 1024 * 1024, 64 * 1024, 10);
+    CHECK(writer.append(makeDatagram(1)));
+    CHECK(writer.append(makeDatagram(2)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::vector<std::string> files = JournalReader::list(dir, "flush");
+    CHECK(files.size() == 1);
+    JournalReader reader;
+    rxDatagram d;
+    int count = 0;
+    if(!files.empty() && reader.open(files[0])){
+        while(reader.next(d)){
+            count++;
+        }
+    }
+    CHECK(count == 2);
+}
+
+int main(void){
+    char tmpl[] = "/tmp/udpnode-test-journal-XXXXXX";
+    if(mkdtemp(tmpl) == NULL){
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = tmpl;
+    testRoundTrip(dir);
+    testIndexSeek(dir);
+    testFlush(dir);
+    removeDir(dir);
+    return checkResult("journal");
+}
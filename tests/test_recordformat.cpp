@@ -0,0 +1,186 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "UDPNode.h"
+#include "RecordFormat.h"
+
+#include <vector>
+
+// Offset of the v2 srcpathlen field: length, version, family, srcport, srcaddr, dstport, dstiplen.
+static const size_t SRCPATHLEN_OFFSET = 4 + 1 + 1 + 2 + 16 + 2 + 2;
+
+// Datagram with every field of the record set, from an IP source.
+static rxDatagram makeDatagram(int family, const char *src){
+    rxDatagram d;
+    memset(&d.srcaddr, 0, sizeof d.srcaddr);
+    if(family == AF_INET){
+        struct sockaddr_in *sin = (struct sockaddr_in *)&d.srcaddr;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(4000);
+        inet_pton(AF_INET, src, &sin->sin_addr);
+        d.srcaddrlen = sizeof *sin;
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&d.srcaddr;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(4000);
+        inet_pton(AF_INET6, src, &sin6->sin6_addr);
+        d.srcaddrlen = sizeof *sin6;
+    }
+    d.srcport = 4000;
+    d.srcipaddr = src;
+    d.time_stamp = 1700000000;
+    d.msg = std::string("payload\0with nul", 16);
+    d.crc_checksum = 1234;
+    d.jointhread = false;
+    d.priority = 3;
+    d.dstipaddr = family == AF_INET ? "10.0.0.2" : "fd00::2";
+    d.dstport = 5000;
+    d.ifindex = 2;
+    d.rxsockfd = 9;
+    d.kerneldrops = 17;
+    d.arrivalns = 1700000000123456789ULL;
+    d.deadlinens = 1700000001000000000ULL;
+    return d;
+}
+
+// Checks every field a record carries.
+static void checkSame(const rxDatagram &a, const rxDatagram &b){
+    CHECK(a.srcaddr.ss_family == b.srcaddr.ss_family);
+    CHECK(a.srcaddrlen == b.srcaddrlen);
+    CHECK(memcmp(&a.srcaddr, &b.srcaddr, a.srcaddrlen) == 0);
+    CHECK(a.srcport == b.srcport);
+    CHECK(a.srcipaddr == b.srcipaddr);
+    CHECK(a.time_stamp == b.time_stamp);
+    CHECK(a.msg == b.msg);
+    CHECK(a.crc_checksum == b.crc_checksum);
+    CHECK(a.priority == b.priority);
+    CHECK(a.dstipaddr == b.dstipaddr);
+    CHECK(a.dstport == b.dstport);
+    CHECK(a.ifindex == b.ifindex);
+    CHECK(a.rxsockfd == b.rxsockfd);
+    CHECK(a.kerneldrops == b.kerneldrops);
+    CHECK(a.arrivalns == b.arrivalns);
+    CHECK(a.deadlinens == b.deadlinens);
+}
+
+// Encodes a datagram and decodes it back.
+static rxDatagram roundTrip(const rxDatagram &in, std::vector<char> &buf){
+    buf.assign(recordSize(in), 0);
+    CHECK(encodeRecord(in, buf.data()) == buf.size());
+    rxDatagram out;
+    CHECK(decodeRecord(buf.data(), buf.size(), out) == buf.size());
+    return out;
+}
+
+static void testIpSources(void){
+    std::vector<char> buf;
+    rxDatagram v4 = makeDatagram(AF_INET, "192.0.2.7");
+    CHECK(recordSize(v4) == RECORD_HEADER_LEN + v4.dstipaddr.size() + v4.msg.size());
+    checkSame(v4, roundTrip(v4, buf));
+    CHECK((uint8_t)buf[4] == RECORD_VERSION);
+
+    rxDatagram v6 = makeDatagram(AF_INET6, "2001:db8::7");
+    checkSame(v6, roundTrip(v6, buf));
+}
+
+static void testUnixSources(void){
+    std::vector<char> buf;
+    rxDatagram d = makeDatagram(AF_INET, "192.0.2.7");
+
+    // A filesystem path.
+    struct sockaddr_un *sun = (struct sockaddr_un *)&d.srcaddr;
+    memset(&d.srcaddr, 0, sizeof d.srcaddr);
+    sun->sun_family = AF_UNIX;
+    strcpy(sun->sun_path, "/run/udpnode.sock");
+    d.srcaddrlen = offsetof(struct sockaddr_un, sun_path) + strlen(sun->sun_path) + 1;
+    d.srcport = 0;
+    rxDatagram out = roundTrip(d, buf);
+    CHECK(out.srcaddr.ss_family == AF_UNIX);
+    CHECK(out.srcaddrlen == d.srcaddrlen);
+    CHECK(strcmp(((struct sockaddr_un *)&out.srcaddr)->sun_path, "/run/udpnode.sock") == 0);
+    CHECK(out.srcipaddr == "/run/udpnode.sock");
+
+    // An abstract name, shown with a leading '@'.
+    memset(&d.srcaddr, 0, sizeof d.srcaddr);
+    sun->sun_family = AF_UNIX;
+    memcpy(sun->sun_path, "\0client", 7);
+    d.srcaddrlen = offsetof(struct sockaddr_un, sun_path) + 7;
+    out = roundTrip(d, buf);
+    CHECK(out.srcaddrlen == d.srcaddrlen);
+    CHECK(memcmp(&out.srcaddr, &d.srcaddr, d.srcaddrlen) == 0);
+    CHECK(out.srcipaddr == "@client");
+
+    // An unnamed socket.
+    memset(&d.srcaddr, 0, sizeof d.srcaddr);
+    sun->sun_family = AF_UNIX;
+    d.srcaddrlen = offsetof(struct sockaddr_un, sun_path);
+    out = roundTrip(d, buf);
+    CHECK(out.srcaddr.ss_family == AF_UNIX);
+    CHECK(out.srcipaddr.empty());
+}
+
+// Version 1 records, written before srcpathlen existed, still decode.
+static void testVersion1(void){
+    std::vector<char> buf;
+    rxDatagram d = makeDatagram(AF_INET6, "2001:db8::9");
+    buf.assign(recordSize(d), 0);
+    encodeRecord(d, buf.data());
+
+    // Drop the srcpathlen field and shorten the length accordingly.
+    std::vector<char> v1(buf.begin(), buf.begin() + SRCPATHLEN_OFFSET);
+    v1.insert(v1.end(), buf.begin() + SRCPATHLEN_OFFSET + 2, buf.end());
+    uint32_t len;
+    memcpy(&len, v1.data(), sizeof len);
+    len -= 2;
+    memcpy(v1.data(), &len, sizeof len);
+    v1[4] = 1;
+    CHECK(v1.size() == RECORD_V1_HEADER_LEN + d.dstipaddr.size() + d.msg.size());
+
+    rxDatagram out;
+    CHECK(decodeRecord(v1.data(), v1.size(), out) == v1.size());
+    checkSame(d, out);
+}
+
+// Truncated, inconsistent or unknown records decode to nothing.
+static void testInvalid(void){
+    std::vector<char> buf;
+    rxDatagram d = makeDatagram(AF_INET, "192.0.2.7");
+    buf.assign(recordSize(d), 0);
+    encodeRecord(d, buf.data());
+    rxDatagram out;
+
+    CHECK(decodeRecord(buf.data(), buf.size() - 1, out) == 0);
+    CHECK(decodeRecord(buf.data(), RECORD_V1_HEADER_LEN - 1, out) == 0);
+
+    std::vector<char> bad = buf;
+    bad[4] = 3;
+    CHECK(decodeRecord(bad.data(), bad.size(), out) == 0);
+
+    // The field lengths must add up to the record length.
+    bad = buf;
+    uint16_t dstiplen = d.dstipaddr.size() + 1;
+    memcpy(&bad[SRCPATHLEN_OFFSET - 2], &dstiplen, sizeof dstiplen);
+    CHECK(decodeRecord(bad.data(), bad.size(), out) == 0);
+
+    // A zero length marks the end of a preallocated region.
+    std::vector<char> zero(RECORD_HEADER_LEN * 2, 0);
+    CHECK(decodeRecord(zero.data(), zero.size(), out) == 0);
+
+    // Records follow each other; the second still decodes after the first.
+    std::vector<char> two = buf;
+    two.insert(two.end(), buf.begin(), buf.end());
+    size_t n = decodeRecord(two.data(), two.size(), out);
+    CHECK(n == buf.size());
+    CHECK(decodeRecord(two.data() + n, two.size() - n, out) == buf.size());
+    checkSame(d, out);
+}
+
+int main(void){
+    testIpSources();
+    testUnixSources();
+    testVersion1();
+    testInvalid();
+    return checkResult("recordformat");
+}
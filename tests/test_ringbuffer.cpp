@@ -0,0 +1,112 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Capacity rounds up to a power of two and the ring is first-in first-out.
+static void testSingleThread(void){
+    RingBuffer<int> ring(5);
+    CHECK(ring.capacity() == 8);
+    CHECK(ring.size() == 0);
+
+    int value;
+    CHECK(!ring.pop(value));
+    for(int i = 0; i < 8; i++){
+        CHECK(ring.push(i));
+    }
+    CHECK(!ring.push(8));
+    CHECK(ring.size() == 8);
+
+    // Wrapping around keeps the order.
+    for(int round = 0; round < 3; round++){
+        for(int i = 0; i < 8; i++){
+            CHECK(ring.pop(value));
+            CHECK(value == round * 8 + i);
+            CHECK(ring.push(round * 8 + i + 8));
+        }
+    }
+    CHECK(ring.size() == 8);
+}
+
+// An exact ring holds its requested capacity, also after wrapping.
+static void testExact(void){
+    RingBuffer<int> ring(5, true);
+    CHECK(ring.capacity() == 5);
+    int value;
+    for(int round = 0; round < 3; round++){
+        for(int i = 0; i < 5; i++){
+            CHECK(ring.push(i));
+        }
+        CHECK(!ring.push(5));
+        CHECK(ring.size() == 5);
+        for(int i = 0; i < 5; i++){
+            CHECK(ring.pop(value) && value == i);
+        }
+    }
+    RingBuffer<int> one(1, true);
+    CHECK(one.push(1));
+    CHECK(!one.push(2));
+}
+
+// Elements are moved in and out, so move-only types work.
+static void testMoveOnly(void){
+    RingBuffer<std::unique_ptr<std::string>> ring(2);
+    CHECK(ring.push(std::unique_ptr<std::string>(new std::string("a"))));
+    std::unique_ptr<std::string> out;
+    CHECK(ring.pop(out));
+    CHECK(out && *out == "a");
+}
+
+// Several producers and consumers lose and duplicate nothing.
+static void testConcurrent(void){
+    const int producers = 4, consumers = 4, perproducer = 100000;
+    RingBuffer<uint64_t> ring(1024);
+    std::atomic<uint64_t> sum(0), count(0);
+    std::vector<std::thread> threads;
+    for(int p = 0; p < producers; p++){
+        threads.emplace_back([&ring, p](){
+            for(int i = 1; i <= perproducer; i++){
+                uint64_t v = (uint64_t)p * perproducer + i;
+                while(!ring.push(v)){
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for(int c = 0; c < consumers; c++){
+        threads.emplace_back([&](){
+            uint64_t v;
+            while(count.load() < (uint64_t)producers * perproducer){
+                if(ring.pop(v)){
+                    sum += v;
+                    count++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for(auto &t : threads){
+        t.join();
+    }
+    uint64_t n = (uint64_t)producers * perproducer;
+    CHECK(count.load() == n);
+    CHECK(sum.load() == n * (n + 1) / 2);
+    CHECK(ring.size() == 0);
+}
+
+int main(void){
+    testSingleThread();
+    testExact();
+    testMoveOnly();
+    testConcurrent();
+    return checkResult("ringbuffer");
+}
@@ -0,0 +1,152 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "UDPNode.h"
+#include "RxFilter.h"
+
+// Datagram from a source address and port, arriving on a local address.
+static rxDatagram makeDatagram(const char *src, unsigned int srcport, const char *dst, const std::string &msg){
+    rxDatagram d;
+    memset(&d.srcaddr, 0, sizeof d.srcaddr);
+    struct sockaddr_in *sin = (struct sockaddr_in *)&d.srcaddr;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&d.srcaddr;
+    if(inet_pton(AF_INET, src, &sin->sin_addr) == 1){
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(srcport);
+        d.srcaddrlen = sizeof *sin;
+    } else {
+        inet_pton(AF_INET6, src, &sin6->sin6_addr);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(srcport);
+        d.srcaddrlen = sizeof *sin6;
+    }
+    d.srcport = srcport;
+    d.srcipaddr = src;
+    d.time_stamp = 0;
+    d.msg = msg;
+    d.crc_checksum = 0;
+    d.jointhread = false;
+    d.priority = 2;
+    d.dstipaddr = dst;
+    memset(&d.dstaddr, 0, sizeof d.dstaddr);
+    if(inet_pton(AF_INET, dst, &((struct sockaddr_in *)&d.dstaddr)->sin_addr) == 1){
+        d.dstaddr.ss_family = AF_INET;
+    } else if(inet_pton(AF_INET6, dst, &((struct sockaddr_in6 *)&d.dstaddr)->sin6_addr) == 1){
+        d.dstaddr.ss_family = AF_INET6;
+    }
+    d.dstport = 5000;
+    d.ifindex = 3;
+    return d;
+}
+
+// Compiles an expression and evaluates it on a datagram.
+static bool matches(const std::string &expression, const rxDatagram &d){
+    std::string error;
+    std::shared_ptr<const RxFilter> f = RxFilter::compile(expression, &error);
+    if(!f){
+        fprintf(stderr, "unexpected syntax error in '%s': %s\n", expression.c_str(), error.c_str());
+        checkFailures++;
+        return false;
+    }
+    CHECK(f->expression() == expression);
+    return f->match(d);
+}
+
+// Checks that an expression is refused with an error message.
+static bool refused(const std::string &expression){
+    std::string error;
+    return !RxFilter::compile(expression, &error) && !error.empty();
+}
+
+static void testAddresses(void){
+    rxDatagram v4 = makeDatagram("10.1.2.3", 4000, "192.168.0.1", "px.EURUSD 1.1");
+    CHECK(matches("src in 10.0.0.0/8", v4));
+    CHECK(!matches("src in 11.0.0.0/8", v4));
+    CHECK(matches("src in 10.1.2.3", v4));
+    CHECK(matches("src in 10.1.2.0/31 || src in 10.1.2.2/31", v4));
+    CHECK(matches("src in [172.16.0.0/12, 10.1.0.0/16]", v4));
+    CHECK(!matches("src in [172.16.0.0/12, fd00::/8]", v4));
+    CHECK(matches("src in 0.0.0.0/0", v4));
+    CHECK(matches("src == 10.1.2.3", v4));
+    CHECK(matches("src != 10.1.2.4", v4));
+    CHECK(matches("dst in 192.168.0.0/16", v4));
+    CHECK(!matches("dst == 192.168.0.2", v4));
+
+    rxDatagram v6 = makeDatagram("fd00::5", 4000, "fd00::1", "x");
+    CHECK(matches("src in fd00::/8", v6));
+    CHECK(!matches("src in fe80::/10", v6));
+    CHECK(!matches("src in 10.0.0.0/8", v6));
+    CHECK(matches("dst == fd00::1", v6));
+
+    // IPv4-mapped sources, as seen on dual-stack sockets, match IPv4 networks.
+    rxDatagram mapped = makeDatagram("::ffff:10.9.9.9", 4000, "::ffff:10.0.0.1", "x");
+    CHECK(matches("src in 10.0.0.0/8", mapped));
+    CHECK(matches("dst == 10.0.0.1", mapped));
+
+    // The binary local address is matched, not its text.
+    v4.dstipaddr = "10.0.0.1";
+    CHECK(matches("dst == 192.168.0.1", v4));
+    v4.dstaddr.ss_family = AF_UNSPEC;
+    CHECK(!matches("dst in 0.0.0.0/0", v4));
+    CHECK(matches("dst != 192.168.0.1", v4));
+}
+
+static void testMessageAndNumbers(void){
+    rxDatagram d = makeDatagram("10.1.2.3", 4000, "192.168.0.1", "px.EURUSD \"1.1\"");
+    CHECK(matches("msg startswith \"px.\"", d));
+    CHECK(!matches("msg startswith \"py.\"", d));
+    CHECK(matches("msg endswith \"\\\"1.1\\\"\"", d));
+    CHECK(matches("msg contains \"EUR\"", d));
+    CHECK(matches("msg != \"px\"", d));
+    CHECK(matches("msg == \"px.EURUSD \\\"1.1\\\"\"", d));
+    CHECK(matches("srcport == 4000 && dstport == 5000", d));
+    CHECK(matches("prio >= 2 && prio < 3 && ifindex == 3", d));
+    CHECK(matches("len == " + std::to_string(d.msg.size()), d));
+    CHECK(!matches("len > 100", d));
+    CHECK(matches("srcport == 04000", d));
+    CHECK(matches("!(srcport <= 3999)", d));
+    CHECK(matches("srcport > 1 && (prio == 7 || msg contains \"USD\")", d));
+    CHECK(!matches("srcport > 1 && !(prio == 7 || msg contains \"USD\")", d));
+
+    // && binds tighter than ||.
+    CHECK(matches("prio == 9 && prio == 9 || prio == 2", d));
+    CHECK(!matches("prio == 9 && (prio == 9 || prio == 2)", d));
+}
+
+static void testSyntaxErrors(void){
+    CHECK(refused(""));
+    CHECK(refused("src"));
+    CHECK(refused("src in"));
+    CHECK(refused("src in 10.0.0.0/8 &&"));
+    CHECK(refused("(src in 10.0.0.0/8"));
+    CHECK(refused("msg startswith px"));
+    CHECK(refused("msg startswith \"px"));
+    CHECK(refused("prio == high"));
+    CHECK(refused("color == 1"));
+    CHECK(refused("src in [10.0.0.0/8,"));
+    CHECK(refused("src in 300.0.0.0/8"));
+
+    // Prefixes must be plain decimal numbers within the family's length.
+    CHECK(refused("src in 10.0.0.0/33"));
+    CHECK(refused("src in 10.0.0.0/-1"));
+    CHECK(refused("src in 10.0.0.0/+8"));
+    CHECK(refused("src in 10.0.0.0/ 8"));
+    CHECK(refused("src in fd00::/129"));
+    CHECK(refused("src in 10.0.0.0/99999999999999999999"));
+    CHECK(!refused("src in fd00::/128"));
+    CHECK(!refused("src in 10.0.0.0/32"));
+
+    // Numbers are plain decimal and must fit in 64 bits.
+    CHECK(refused("len == 0x10"));
+    CHECK(refused("len == 18446744073709551616"));
+    CHECK(!refused("len == 18446744073709551615"));
+}
+
+int main(void){
+    testAddresses();
+    testMessageAndNumbers();
+    testSyntaxErrors();
+    return checkResult("rxfilter");
+}
@@ -0,0 +1,214 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "UDPNode.h"
+#include "SimNetwork.h"
+
+// Datagram seen by a receiver bound directly on the network.
+struct arrival{
+    int srcport;
+    std::string data;
+    uint64_t at;
+
+    bool operator==(const arrival &other) const{
+        return srcport == other.srcport && data == other.data && at == other.at;
+    }
+};
+
+// IPv4 socket address on the network.
+static struct sockaddr_storage simAddr(const char *host, int port){
+    struct sockaddr_storage addr;
+    SimNetwork resolver;
+    resolver.resolve(host, port, AF_INET, addr);
+    return addr;
+}
+
+// Binds a receiver that records what arrives and when.
+static void bindRecorder(SimNetwork &net, const struct sockaddr_storage &addr, std::vector<arrival> &log){
+    net.bind(addr, [&net, &log](const struct sockaddr_storage &src, const char *data, size_t len){
+        log.push_back({ntohs(((const struct sockaddr_in *)&src)->sin_port), std::string(data, len), net.now()});
+    });
+}
+
+static void send(SimNetwork &net, int srcport, int dstport, const std::string &data){
+    net.send(simAddr("127.0.0.1", srcport), simAddr("127.0.0.1", dstport), data.data(), data.size());
+}
+
+static void testDelivery(void){
+    SimNetwork net;
+    std::vector<arrival> log;
+    CHECK(net.bind(simAddr("127.0.0.1", 2000), [](const struct sockaddr_storage &, const char *, size_t){}));
+    CHECK(!net.bind(simAddr("127.0.0.1", 2000), [](const struct sockaddr_storage &, const char *, size_t){}));
+    net.unbind(simAddr("127.0.0.1", 2000));
+    bindRecorder(net, simAddr("127.0.0.1", 2000), log);
+
+    // An unimpaired link delivers at once, in send order.
+    send(net, 1000, 2000, "a");
+    send(net, 1000, 2000, "b");
+    send(net, 1000, 3000, "nobody");
+    CHECK(net.inFlight() == 3);
+    net.advance(0);
+    CHECK(log.size() == 2 && log[0].data == "a" && log[1].data == "b" && log[0].srcport == 1000);
+    simStats stats = net.getStats();
+    CHECK(stats.sent == 3 && stats.delivered == 2 && stats.unreachable == 1);
+
+    // The delay holds a datagram until its due time, and the receiver sees that time.
+    simLinkOptions slow;
+    slow.delayus = 500;
+    slow.distribution = SIM_DELAY_CONSTANT;
+    net.setLink(1000, 2000, slow);
+    log.clear();
+    uint64_t sent = net.now();
+    send(net, 1000, 2000, "late");
+    send(net, 1001, 2000, "other link");
+    net.advance(0);
+    CHECK(log.size() == 1 && log[0].data == "other link");
+    net.advance(499);
+    CHECK(log.size() == 1);
+    net.advance(1);
+    CHECK(log.size() == 2 && log[1].data == "late" && log[1].at == sent + 500);
+    CHECK(net.now() == sent + 500);
+
+    // A datagram that skips the delay overtakes those in flight.
+    log.clear();
+    send(net, 1000, 2000, "first");
+    slow.reorder = 1;
+    net.setLink(1001, 2000, slow);
+    send(net, 1001, 2000, "second");
+    net.advance(0);
+    CHECK(log.size() == 1 && log[0].data == "second");
+    net.advance(500);
+    CHECK(log.size() == 2 && log[1].data == "first");
+    CHECK(net.getStats().reordered == 1);
+
+    // Nothing reaches an unbound address.
+    net.unbind(simAddr("127.0.0.1", 2000));
+    send(net, 1000, 2000, "gone");
+    net.advance(1000);
+    CHECK(log.size() == 2);
+}
+
+// Sends through a lossy, jittery link and returns what arrived, in order.
+static std::vector<arrival> impairedRun(uint64_t seed, simStats &stats){
+    SimNetwork net(seed);
+    simLinkOptions opts;
+    opts.loss = 0.3;
+    opts.delayus = 1000;
+    opts.jitterus = 400;
+    opts.reorder = 0.1;
+    opts.duplicate = 0.1;
+    net.setLink(opts);
+    std::vector<arrival> log;
+    bindRecorder(net, simAddr("127.0.0.1", 2000), log);
+    for(int i = 0; i < 200; i++){
+        send(net, 1000, 2000, std::to_string(i));
+        net.advance(10);
+    }
+    net.advance(10000);
+    stats = net.getStats();
+    return log;
+}
+
+static void testDeterminism(void){
+    simStats a, b, c;
+    std::vector<arrival> first = impairedRun(7, a);
+    CHECK(first == impairedRun(7, b));
+    CHECK(first != impairedRun(8, c));
+    CHECK(a.lost > 0 && a.duplicated > 0 && a.reordered > 0);
+    CHECK(a.lost == b.lost && a.duplicated == b.duplicated && a.reordered == b.reordered);
+    CHECK(a.delivered == a.sent - a.lost + a.duplicated);
+    CHECK(first.size() == a.delivered);
+
+    // Jitter reorders some datagrams, and every delay stays within its bounds.
+    bool reordered = false;
+    for(size_t i = 1; i < first.size(); i++){
+        reordered |= std::stoi(first[i].data) < std::stoi(first[i - 1].data);
+    }
+    CHECK(reordered);
+    for(const arrival &x : first){
+        CHECK(x.at <= (uint64_t)std::stoi(x.data) * 10 + 1400);
+    }
+}
+
+static void testRateLimit(void){
+    SimNetwork net;
+    simLinkOptions opts;
+    opts.ratebps = 8000000;     // One byte per microsecond.
+    opts.queuebytes = 1500;
+    opts.distribution = SIM_DELAY_CONSTANT;
+    opts.delayus = 100;
+    net.setLink(opts);
+    std::vector<arrival> log;
+    bindRecorder(net, simAddr("127.0.0.1", 2000), log);
+
+    // The second datagram waits behind the first; the rest find the queue full.
+    std::string datagram(1000, 'x');
+    for(int i = 0; i < 4; i++){
+        send(net, 1000, 2000, datagram);
+    }
+    net.advance(10000);
+    CHECK(log.size() == 2);
+    CHECK(log.size() == 2 && log[0].at == 1100 && log[1].at == 2100);
+    CHECK(net.getStats().queuedrops == 2);
+
+    // Once the link has drained, it sends at once again.
+    send(net, 1000, 2000, datagram);
+    net.advance(1100);
+    CHECK(log.size() == 3 && log[2].at == 10000 + 1100);
+}
+
+static void testNodes(void){
+    auto net = std::make_shared<SimNetwork>(3);
+    net->addHost("alpha", "10.0.0.1");
+    net->addHost("beta", "10.0.0.2");
+    nodeOptions aopts, bopts;
+    aopts.transport = bopts.transport = net;
+    aopts.transportaddr = "10.0.0.1";
+    bopts.transportaddr = "10.0.0.2";
+    UDPNode a(47100, ipv4, 1024, 100, false, aopts);
+    UDPNode b(47101, ipv4, 1024, 100, false, bopts);
+
+    // Host names resolve through the network, and the receiver sees the sender's address.
+    CHECK(a.tx(47101, ipv4, "beta", "hello") == SUCCESS);
+    CHECK(a.tx(47101, ipv4, "gamma", "hello") != SUCCESS);
+    CHECK(!b.rxDataAvailable());
+    net->advance(0);
+    CHECK(b.rxDataAvailable());
+    rxDatagram d = b.readRxDatagramFromQueue();
+    CHECK(d.msg == "hello");
+    CHECK(d.srcipaddr == "10.0.0.1" && d.srcport == 47100);
+    CHECK(d.dstipaddr == "10.0.0.2" && d.dstport == 47101);
+    CHECK(d.rxsockfd == -1);
+
+    // A reply goes back through the network, over the link's impairments.
+    simLinkOptions slow;
+    slow.delayus = 300;
+    slow.distribution = SIM_DELAY_CONSTANT;
+    net->setLink(47101, 47100, slow);
+    CHECK(b.reply(d, "world") == SUCCESS);
+    net->advance(299);
+    CHECK(!a.rxDataAvailable());
+    net->advance(1);
+    CHECK(a.rxDataAvailable());
+    CHECK(a.readRxDatagramFromQueue().msg == "world");
+
+    // A lost datagram never reaches the node.
+    simLinkOptions lossy;
+    lossy.loss = 1;
+    net->setLink(47100, 47101, lossy);
+    a.tx(47101, ipv4, "10.0.0.2", "lost");
+    net->advance(1000);
+    CHECK(!b.rxDataAvailable());
+    rxStats stats = b.getRxStats();
+    CHECK(stats.received == 1 && stats.queued == 1);
+}
+
+int main(void){
+    testDelivery();
+    testDeterminism();
+    testRateLimit();
+    testNodes();
+    return checkResult("simnetwork");
+}
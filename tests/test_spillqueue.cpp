@@ -0,0 +1,119 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "UDPNode.h"
+#include "SpillQueue.h"
+#include "RecordFormat.h"
+
+#include <dirent.h>
+
+// Datagram from 10.0.0.1:4000 carrying a message.
+static rxDatagram makeDatagram(const std::string &msg){
+    rxDatagram d;
+    memset(&d.srcaddr, 0, sizeof d.srcaddr);
+    struct sockaddr_in *sin = (struct sockaddr_in *)&d.srcaddr;
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(4000);
+    inet_pton(AF_INET, "10.0.0.1", &sin->sin_addr);
+    d.srcaddrlen = sizeof *sin;
+    d.srcport = 4000;
+    d.srcipaddr = "10.0.0.1";
+    d.time_stamp = 1700000000;
+    d.msg = msg;
+    d.crc_checksum = 0;
+    d.jointhread = false;
+    d.dstipaddr = "10.0.0.2";
+    d.dstport = 5000;
+    d.ifindex = 1;
+    return d;
+}
+
+// Number of entries in a directory, apart from . and ..
+static int countFiles(const std::string &dir){
+    int n = 0;
+    DIR *d = opendir(dir.c_str());
+    if(d == NULL){
+        return -1;
+    }
+    while(struct dirent *e = readdir(d)){
+        if(strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0){
+            n++;
+        }
+    }
+    closedir(d);
+    return n;
+}
+
+// Order is kept across segments, and segment files never show up in the directory.
+static void testOrder(const std::string &dir){
+    const size_t segmentsize = 4096;
+    SpillQueue q(dir, segmentsize, 0);
+    rxDatagram d;
+    CHECK(q.empty());
+    CHECK(!q.pop(d));
+
+    // Enough records for several segments.
+    const int n = 500;
+    for(int i = 0; i < n; i++){
+        CHECK(q.push(makeDatagram("message " + std::to_string(i))));
+    }
+    CHECK(q.size() == (size_t)n);
+    CHECK(countFiles(dir) == 0);
+
+    for(int i = 0; i < n; i++){
+        CHECK(q.pop(d));
+        CHECK(d.msg == "message " + std::to_string(i));
+        CHECK(d.srcipaddr == "10.0.0.1" && d.srcport == 4000);
+        CHECK(d.dstipaddr == "10.0.0.2" && d.dstport == 5000);
+    }
+    CHECK(q.empty());
+    CHECK(!q.pop(d));
+
+    // Interleaved use reuses the spare segments.
+    for(int round = 0; round < 100; round++){
+        for(int i = 0; i < 20; i++){
+            CHECK(q.push(makeDatagram(std::string(100, 'a' + i))));
+        }
+        for(int i = 0; i < 20; i++){
+            CHECK(q.pop(d));
+            CHECK(d.msg == std::string(100, 'a' + i));
+        }
+    }
+}
+
+// The size limit counts whole segments and a record larger than a segment is refused.
+static void testLimits(const std::string &dir){
+    const size_t segmentsize = 4096;
+    SpillQueue q(dir, segmentsize, 2 * segmentsize);
+    CHECK(!q.push(makeDatagram(std::string(segmentsize, 'x'))));
+
+    std::string msg(1000, 'm');
+    size_t perseg = segmentsize / recordSize(makeDatagram(msg));
+    for(size_t i = 0; i < 2 * perseg; i++){
+        CHECK(q.push(makeDatagram(msg)));
+    }
+    CHECK(!q.push(makeDatagram(msg)));
+    CHECK(q.size() == 2 * perseg);
+
+    // Reading out the first segment makes room again.
+    rxDatagram d;
+    for(size_t i = 0; i < perseg; i++){
+        CHECK(q.pop(d));
+    }
+    CHECK(q.push(makeDatagram(msg)));
+}
+
+int main(void){
+    char tmpl[] = "/tmp/udpnode-test-spill-XXXXXX";
+    if(mkdtemp(tmpl) == NULL){
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = tmpl;
+    testOrder(dir);
+    testLimits(dir);
+    rmdir(dir.c_str());
+    return checkResult("spillqueue");
+}
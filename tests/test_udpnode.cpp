@@ -0,0 +1,712 @@
+// Copyright 2024 Hussam Al-Hertani. All rights reserved.
+// Use of this source code is governed by a license that can be
+// found in the LICENSE file.
+
+#include "Check.h"
+#include "UDPNode.h"
+#include "SimNetwork.h"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+// Waits up to two seconds for a condition the receive threads make true.
+static bool waitFor(const std::function<bool(void)> &cond){
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(!cond()){
+        if(std::chrono::steady_clock::now() > deadline){
+            return false;
+        }
+        usleep(1000);
+    }
+    return true;
+}
+
+// Sends raw bytes to a local IPv4 port, bypassing the envelope.
+static void sendRaw(int port, const std::string &data){
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sendto(fd, data.data(), data.size(), 0, (struct sockaddr *)&addr, sizeof addr);
+    close(fd);
+}
+
+// Datagrams that are not a well-formed envelope.
+static const std::vector<std::string> malformed = {
+    "garbage",
+    "[1,2]",
+    "\"just a string\"",
+    "{\"Time\":1",
+    "{\"Time\":\"x\",\"Msg\":5,\"CRC\":\"y\"}",
+    "{\"Time\":1700000000,\"CRC\":1}",
+    "{\"Time\":1700000000,\"Msg\":\"no crc\"}",
+};
+
+// Malformed datagrams are counted and dropped, and the node keeps receiving.
+static void testMalformed(void){
+    UDPNode node(47201, ipv4, 1024, 100, false);
+    node.startRxLoop();
+    for(const std::string &data : malformed){
+        sendRaw(47201, data);
+    }
+    sendRaw(47201, "{\"Time\":1700000000,\"Msg\":\"bad crc\",\"CRC\":1}");
+
+    // An empty datagram is skipped without being counted.
+    sendRaw(47201, "");
+    CHECK(waitFor([&]{ rxStats stats = node.getRxStats(); return stats.parsedrops + stats.crcdrops == malformed.size() + 1; }));
+    rxStats stats = node.getRxStats();
+    CHECK(stats.received == malformed.size() + 1);
+    CHECK(stats.parsedrops == malformed.size());
+    CHECK(stats.crcdrops == 1);
+    CHECK(stats.queued == 0 && !node.rxDataAvailable());
+
+    CHECK(node.tx(47201, ipv4, "127.0.0.1", "still here") == SUCCESS);
+    CHECK(waitFor([&]{ return node.rxDataAvailable(); }));
+    CHECK(node.readRxDatagramFromQueue().msg == "still here");
+    CHECK(node.getRxStats().received == malformed.size() + 2);
+    node.endRxLoop();
+}
+
+// A transport node takes the same path for what its transport delivers.
+static void testMalformedTransport(void){
+    auto net = std::make_shared<SimNetwork>();
+    nodeOptions opts;
+    opts.transport = net;
+    UDPNode node(47202, ipv4, 1024, 100, false, opts);
+    struct sockaddr_storage src, dst;
+    net->resolve("127.0.0.1", 47203, AF_INET, src);
+    net->resolve("127.0.0.1", 47202, AF_INET, dst);
+    for(const std::string &data : malformed){
+        net->send(src, dst, data.data(), data.size());
+    }
+    net->advance(0);
+    rxStats stats = node.getRxStats();
+    CHECK(stats.received == malformed.size());
+    CHECK(stats.parsedrops == malformed.size());
+    CHECK(!node.rxDataAvailable());
+}
+
+// Whether a path exists.
+static bool exists(const std::string &path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+// Same-host nodes exchange datagrams over shared memory, addressed by their bound addresses.
+static void testShm(void){
+    char dirtemplate[] = "/tmp/udpnode-test-XXXXXX";
+    std::string dir = mkdtemp(dirtemplate);
+    nodeOptions base;
+    base.shmtransport = true;
+    base.shmdir = dir;
+    {
+        // Two receivers share a port on different loopback addresses; the second limits each source.
+        nodeOptions o1 = base, o2 = base, os = base;
+        o1.bindaddrs = {{"127.0.0.1", 47310}};
+        o2.bindaddrs = {{"127.0.0.2", 47310}};
+        o2.sourcerate = 1;
+        o2.sourceburst = 2;
+        os.bindaddrs = {{"127.0.0.3", 47314}};
+        UDPNode n1(47311, ipv4, 1024, 100, false, o1), n2(47312, ipv4, 1024, 100, false, o2);
+        UDPNode sender(47313, ipv4, 1024, 100, false, os);
+        n1.startRxLoop();
+        n2.startRxLoop();
+        sender.startRxLoop();
+        CHECK(exists(dir + "/udpnode-shm-4-127.0.0.1-47310"));
+        CHECK(exists(dir + "/udpnode-shm-4-127.0.0.2-47310"));
+        CHECK(exists(dir + "/udpnode-shm-4-0.0.0.0-47311"));
+
+        // Connections that never say hello do not hold up the peers behind them.
+        int silent[3];
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, (dir + "/udpnode-shm-4-127.0.0.1-47310").c_str());
+        for(int &fd : silent){
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            CHECK(connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0);
+        }
+
+        // Each datagram reaches the node bound to its destination, never the other.
+        CHECK(sender.tx(47310, ipv4, "127.0.0.1", "to1") == SUCCESS);
+        for(int i = 0; i < 4; i++){
+            sender.tx(47310, ipv4, "127.0.0.2", "to2");
+        }
+        CHECK(waitFor([&]{ return n1.getRxStats().shmreceived == 1 && n2.getRxStats().received == 4; }));
+        rxStats s1 = n1.getRxStats(), s2 = n2.getRxStats();
+        CHECK(s1.received == 1 && s1.queued == 1);
+        CHECK(s2.shmreceived == 4 && s2.ratelimitdrops == 2 && s2.queued == 2);
+        rxDatagram d = n1.readRxDatagramFromQueue();
+        CHECK(d.msg == "to1");
+        CHECK(d.srcipaddr == "127.0.0.1" && d.srcport == 47313);
+        CHECK(d.dstipaddr == "127.0.0.1" && d.dstport == 47310);
+        CHECK(d.dstaddr.ss_family == AF_INET && ((struct sockaddr_in *)&d.dstaddr)->sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+        CHECK(n2.readRxDatagramFromQueue().msg == "to2");
+        for(int fd : silent){
+            close(fd);
+        }
+
+        // The source is the sender's listening socket, so a reply reaches it.
+        CHECK(n1.reply(d, "back") == SUCCESS);
+        CHECK(waitFor([&]{ return sender.rxDataAvailable(); }));
+        rxDatagram r = sender.readRxDatagramFromQueue();
+        CHECK(r.msg == "back" && r.srcport == 47310);
+
+        // A node found absent is used as soon as its listener appears.
+        CHECK(sender.tx(47315, ipv4, "127.0.0.1", "before") == SUCCESS);
+        UDPNode late(47315, ipv4, 1024, 100, false, base);
+        late.startRxLoop();
+        CHECK(waitFor([&]{ return exists(dir + "/udpnode-shm-4-0.0.0.0-47315"); }));
+        CHECK(sender.tx(47315, ipv4, "127.0.0.1", "after") == SUCCESS);
+        CHECK(waitFor([&]{ return late.getRxStats().shmreceived == 1; }));
+        CHECK(late.readRxDatagramFromQueue().msg == "after");
+
+        late.endRxLoop();
+        sender.endRxLoop();
+        n2.endRxLoop();
+        n1.endRxLoop();
+    }
+
+    // Closed nodes remove their rendezvous sockets.
+    CHECK(!exists(dir + "/udpnode-shm-4-127.0.0.1-47310"));
+    CHECK(rmdir(dir.c_str()) == 0);
+
+    // Without a shmdir the rendezvous sockets go to the user's private runtime directory, never a shared one.
+    char rundirtemplate[] = "/tmp/udpnode-test-XXXXXX";
+    std::string rundir = mkdtemp(rundirtemplate);
+    setenv("XDG_RUNTIME_DIR", rundir.c_str(), 1);
+    nodeOptions opts;
+    opts.shmtransport = true;
+    {
+        UDPNode n(47316, ipv4, 1024, 100, false, opts);
+        n.startRxLoop();
+        CHECK(exists(rundir + "/udpnode-shm-4-0.0.0.0-47316"));
+        n.endRxLoop();
+    }
+    CHECK(chmod(rundir.c_str(), 0755) == 0);
+    {
+        UDPNode n(47316, ipv4, 1024, 100, false, opts);
+        n.startRxLoop();
+        CHECK(!exists(rundir + "/udpnode-shm-4-0.0.0.0-47316"));
+        n.endRxLoop();
+    }
+    unsetenv("XDG_RUNTIME_DIR");
+    CHECK(rmdir(rundir.c_str()) == 0);
+
+    // A ring whose memfd could still be resized is refused.
+    int memfd = memfd_create("udpnode-test", MFD_CLOEXEC);
+    CHECK(memfd != -1 && ftruncate(memfd, 4096 + 64 * 1024) == 0);
+    CHECK(!ShmRing::attach(memfd, eventfd(0, EFD_CLOEXEC)));
+    std::unique_ptr<ShmRing> ring = ShmRing::create(64 * 1024);
+    CHECK(ring && ftruncate(ring->memfd(), 4096) == -1);
+}
+
+// Nodes of one process hand datagrams to each other, matched as the kernel would match their sockets.
+static void testLoopback(void){
+    nodeOptions base;
+    base.loopbackshortcut = true;
+    nodeOptions o1 = base, o2 = base, os = base;
+    o1.bindaddrs = {{"127.0.0.1", 47410}};
+    o2.bindaddrs = {{"127.0.0.2", 47410}};
+    o2.sourcerate = 1;
+    o2.sourceburst = 2;
+    os.bindaddrs = {{"127.0.0.3", 47414}};
+    UDPNode n1(47411, ipv4, 1024, 100, false, o1), n2(47412, ipv4, 1024, 100, false, o2);
+    UDPNode sender(47413, ipv4, 1024, 100, false, os);
+    n1.startRxLoop();
+    n2.startRxLoop();
+    sender.startRxLoop();
+
+    // The exact address wins, and each node limits its sources as for socket traffic.
+    CHECK(sender.tx(47410, ipv4, "127.0.0.1", "to1") == SUCCESS);
+    for(int i = 0; i < 4; i++){
+        sender.tx(47410, ipv4, "127.0.0.2", "to2");
+    }
+    rxStats s1 = n1.getRxStats(), s2 = n2.getRxStats();
+    CHECK(s1.loopbackreceived == 1 && s1.received == 1 && s1.queued == 1);
+    CHECK(s2.loopbackreceived == 4 && s2.ratelimitdrops == 2 && s2.queued == 2);
+    rxDatagram d = n1.readRxDatagramFromQueue();
+    CHECK(d.msg == "to1");
+    CHECK(d.srcipaddr == "127.0.0.1" && d.srcport == 47413);
+    CHECK(d.dstipaddr == "127.0.0.1" && d.dstport == 47410);
+    CHECK(d.dstaddr.ss_family == AF_INET && ((struct sockaddr_in *)&d.dstaddr)->sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+    CHECK(d.rxsockfd >= 0);
+
+    // A reply from the receiving socket reaches the sender's listening socket.
+    CHECK(n1.reply(d, "back") == SUCCESS);
+    CHECK(waitFor([&]{ return sender.rxDataAvailable(); }));
+    rxDatagram r = sender.readRxDatagramFromQueue();
+    CHECK(r.msg == "back" && r.srcipaddr == "127.0.0.1" && r.srcport == 47410);
+
+    // A wildcard socket takes any local address; an address nobody bound takes nothing.
+    CHECK(sender.tx(47411, ipv4, "127.0.0.9", "wild") == SUCCESS);
+    CHECK(n1.getRxStats().loopbackreceived == 2);
+    CHECK(n1.readRxDatagramFromQueue().msg == "wild");
+    sender.tx(47410, ipv4, "127.0.0.5", "nobody");
+    usleep(50000);
+    CHECK(n1.getRxStats().received == 2 && n2.getRxStats().received == 4);
+
+    // A node without the option receives through its socket.
+    UDPNode plain(47415, ipv4, 1024, 100, false);
+    plain.startRxLoop();
+    CHECK(sender.tx(47415, ipv4, "127.0.0.1", "kernel") == SUCCESS);
+    CHECK(waitFor([&]{ return plain.rxDataAvailable(); }));
+    CHECK(plain.readRxDatagramFromQueue().msg == "kernel");
+    CHECK(plain.getRxStats().loopbackreceived == 0);
+
+    plain.endRxLoop();
+    sender.endRxLoop();
+    n2.endRxLoop();
+    n1.endRxLoop();
+}
+
+// Sends a raw datagram over a simulated network from a given source address.
+static void sendFrom(SimNetwork &net, const char *src, int dstport, const std::string &data){
+    struct sockaddr_storage from, to;
+    net.resolve(src, 40000, AF_INET, from);
+    net.resolve("127.0.0.1", dstport, AF_INET, to);
+    net.send(from, to, data.data(), data.size());
+    net.advance(0);
+}
+
+// A full rate limiter table still limits new sources, and makes room once sources go idle.
+static void testRateLimitTableFull(void){
+    auto net = std::make_shared<SimNetwork>();
+    nodeOptions opts;
+    opts.transport = net;
+    opts.sourcerate = 10;
+    opts.sourceburst = 2;
+    opts.ratelimitsources = 8;
+    UDPNode node(47204, ipv4, 1024, 100, false, opts);
+    const std::string envelope = "{\"Time\":1700000000,\"Msg\":\"x\"}";
+    for(int i = 1; i <= 8; i++){
+        sendFrom(*net, ("10.0.0." + std::to_string(i)).c_str(), 47204, envelope);
+    }
+    CHECK(node.getRxStats().ratelimitdrops == 0);
+
+    // Sources the table cannot hold share one bucket of the default depth.
+    for(int i = 0; i < 5; i++){
+        sendFrom(*net, "10.0.1.1", 47204, envelope);
+    }
+    CHECK(node.getRxStats().ratelimitdrops == 3);
+    for(int i = 0; i < 3; i++){
+        sendFrom(*net, "10.0.1.2", 47204, envelope);
+    }
+    CHECK(node.getRxStats().ratelimitdrops == 6);
+
+    // Once the tracked sources have refilled, a new source gets its own bucket.
+    usleep(250000);
+    for(int i = 0; i < 4; i++){
+        sendFrom(*net, "10.0.1.3", 47204, envelope);
+    }
+    CHECK(node.getRxStats().ratelimitdrops == 8);
+    std::vector<sourceRateStats> top = node.topRateLimitedSources();
+    CHECK(top.size() == 2 && top[0].ipaddr == "*" && top[0].rejected == 6);
+    CHECK(top[1].ipaddr == "10.0.1.3" && top[1].admitted == 2 && top[1].rejected == 2);
+
+    // An offender keeps its counts after a sweep drops its bucket.
+    usleep(250000);
+    for(int i = 1; i <= 8; i++){
+        sendFrom(*net, ("10.0.2." + std::to_string(i)).c_str(), 47204, envelope);
+    }
+    top = node.topRateLimitedSources();
+    CHECK(top.size() == 2 && top[1].ipaddr == "10.0.1.3" && top[1].rejected == 2);
+
+    // A custom limit needs a slot of its own.
+    CHECK(node.setSourceRateLimit("10.0.3.1", 5, 5) == RATE_TABLE_FULL);
+    CHECK(node.setSourceRateLimit("10.0.2.1", 5, 5) == SUCCESS);
+}
+
+// A flooding source cannot keep a quiet one out of a fair queue.
+static void testFairQueueFlood(void){
+    auto net = std::make_shared<SimNetwork>();
+    nodeOptions opts, fopts, qopts;
+    opts.transport = fopts.transport = qopts.transport = net;
+    opts.rxqueuemode = RXQ_FAIR;
+    fopts.transportaddr = "10.0.0.1";
+    qopts.transportaddr = "10.0.0.2";
+    UDPNode node(47205, ipv4, 1024, 10, false, opts);
+    UDPNode flooder(47206, ipv4, 1024, 10, false, fopts);
+    UDPNode quiet(47207, ipv4, 1024, 10, false, qopts);
+    for(int i = 0; i < 50; i++){
+        flooder.tx(47205, ipv4, "127.0.0.1", "flood");
+    }
+    net->advance(0);
+    for(int i = 0; i < 3; i++){
+        quiet.tx(47205, ipv4, "127.0.0.1", "quiet " + std::to_string(i));
+    }
+    net->advance(0);
+
+    // The quiet source's datagrams push out the flood's newest ones instead of being dropped.
+    rxStats stats = node.getRxStats();
+    CHECK(stats.queuefulldrops == 43);
+    CHECK(node.rxDataQueueSize() == 10);
+    CHECK(stats.activesources == 2);
+    std::vector<std::string> quietmsgs;
+    for(int i = 0; i < 10; i++){
+        rxDatagram d = node.readRxDatagramFromQueue();
+        if(d.srcipaddr == "10.0.0.2"){
+            quietmsgs.push_back(d.msg);
+        }
+    }
+    CHECK(quietmsgs == std::vector<std::string>({"quiet 0", "quiet 1", "quiet 2"}));
+    CHECK(!node.rxDataAvailable());
+}
+
+// Priority lanes hold exactly their capacity, apply their drop policy and drain highest first.
+static void testPriorityLanes(void){
+    auto net = std::make_shared<SimNetwork>();
+    nodeOptions opts, sopts;
+    opts.transport = sopts.transport = net;
+    opts.rxqueuemode = RXQ_PRIORITY;
+    opts.lanecapacity = {3, 5, 2};
+    opts.lanedroppolicy = {DROP_NEWEST, DROP_OLDEST, DROP_NEWEST};
+    sopts.transportaddr = "10.0.0.1";
+    UDPNode node(47208, ipv4, 1024, 100, false, opts);
+    UDPNode sender(47209, ipv4, 1024, 10, false, sopts);
+    for(int i = 0; i < 5; i++){
+        sender.tx(47208, ipv4, "127.0.0.1", "bulk " + std::to_string(i));
+    }
+    for(int i = 0; i < 7; i++){
+        sender.tx(47208, ipv4, "127.0.0.1", "mid " + std::to_string(i), false, 1);
+    }
+    // Priorities above the last lane share it.
+    for(int i = 0; i < 4; i++){
+        sender.tx(47208, ipv4, "127.0.0.1", "high " + std::to_string(i), false, 5);
+    }
+    net->advance(0);
+
+    std::vector<laneStats> lanes = node.getLaneStats();
+    CHECK(lanes.size() == 3);
+    CHECK(lanes[0].depth == 3 && lanes[0].capacity == 3 && lanes[0].enqueued == 3 && lanes[0].drops == 2);
+    CHECK(lanes[1].depth == 5 && lanes[1].capacity == 5 && lanes[1].enqueued == 7 && lanes[1].drops == 2);
+    CHECK(lanes[2].depth == 2 && lanes[2].capacity == 2 && lanes[2].enqueued == 2 && lanes[2].drops == 2);
+
+    std::vector<std::string> msgs;
+    while(node.rxDataAvailable()){
+        msgs.push_back(node.readRxDatagramFromQueue().msg);
+    }
+    CHECK(msgs == std::vector<std::string>({"high 0", "high 1", "mid 2", "mid 3", "mid 4", "mid 5", "mid 6", "bulk 0", "bulk 1", "bulk 2"}));
+
+    // Parse workers pushing at once cannot overshoot a lane either.
+    nodeOptions wopts;
+    wopts.rxqueuemode = RXQ_PRIORITY;
+    wopts.prioritylanes = 1;
+    wopts.lanecapacity = {5};
+    wopts.parseworkers = 4;
+    UDPNode receiver(47210, ipv4, 1024, 100, false, wopts);
+    receiver.startRxLoop();
+    UDPNode wsender(47211, ipv4, 1024, 10, false);
+    for(int i = 0; i < 200; i++){
+        wsender.tx(47210, ipv4, "127.0.0.1", "x");
+    }
+    CHECK(waitFor([&]{ return receiver.getRxStats().received == 200; }));
+    usleep(100000);
+    laneStats ls = receiver.getLaneStats()[0];
+    CHECK(ls.depth <= 5 && ls.enqueued == 5);
+    receiver.endRxLoop();
+}
+
+// A destination group fans out to IP and Unix members alike.
+static void testGroupUnix(void){
+    char dirtemplate[] = "/tmp/udpnode-test-XXXXXX";
+    std::string dir = mkdtemp(dirtemplate);
+    std::string path = dir + "/member.sock";
+    {
+        nodeOptions oa, ob, os;
+        oa.unixpath = "@udpnode-test-group-a";
+        ob.unixpath = path;
+        os.unixpath = "@udpnode-test-group-s";
+        UDPNode a(0, unixdgram, 1024, 100, false, oa), b(0, unixdgram, 1024, 100, false, ob);
+        UDPNode c(47420, ipv4, 1024, 100, false);
+        UDPNode sender(47421, ipv4, 1024, 100, false, os);
+        a.startRxLoop();
+        b.startRxLoop();
+        c.startRxLoop();
+
+        DestinationGroup group;
+        CHECK(group.add(0, unixdgram, "@udpnode-test-group-a") == SUCCESS);
+        CHECK(group.add(0, unixdgram, path) == SUCCESS);
+        CHECK(group.add(47420, ipv4, "127.0.0.1") == SUCCESS);
+        CHECK(group.add(0, unixdgram, "") == GETADDRINFO_FAILED);
+        CHECK(group.add(0, unixdgram, "@udpnode-test-group-nobody") == SUCCESS);
+        CHECK(group.size() == 4);
+
+        // The member nobody listens on fails alone.
+        CHECK(sender.txGroup(group, "fan-out") == SENDTO_FAILED);
+        CHECK(group.failedCount() == 1 && group.members()[3].lasterror == SENDTO_FAILED);
+        for(UDPNode *node : {&a, &b, &c}){
+            CHECK(waitFor([&]{ return node->rxDataAvailable(); }));
+            CHECK(node->readRxDatagramFromQueue().msg == "fan-out");
+        }
+
+        // Unix members see the sender's own Unix socket and can reply to it.
+        group.remove(0, "@udpnode-test-group-nobody");
+        CHECK(sender.txGroup(group, "again") == SUCCESS);
+        CHECK(waitFor([&]{ return a.rxDataAvailable(); }));
+        rxDatagram d = a.readRxDatagramFromQueue();
+        CHECK(d.msg == "again" && d.srcipaddr == "@udpnode-test-group-s");
+        CHECK(a.reply(d, "back") == SUCCESS);
+        sender.startRxLoop();
+        CHECK(waitFor([&]{ return sender.rxDataAvailable(); }));
+        CHECK(sender.readRxDatagramFromQueue().msg == "back");
+
+        sender.endRxLoop();
+        c.endRxLoop();
+        b.endRxLoop();
+        a.endRxLoop();
+    }
+    CHECK(rmdir(dir.c_str()) == 0);
+}
+
+// Exit status of a node constructed in a child process; the constructor exits when it cannot bind.
+static int constructInChild(int lport, ipFamily ver, const nodeOptions &opts){
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0){
+        UDPNode node(lport, ver, 1024, 100, false, opts);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// A Unix socket path is only taken over from a node that is gone.
+static void testUnixPathClaim(void){
+    char dirtemplate[] = "/tmp/udpnode-test-XXXXXX";
+    std::string dir = mkdtemp(dirtemplate);
+    std::string file = dir + "/file", stale = dir + "/stale.sock", live = dir + "/live.sock";
+
+    // A regular file is not removed.
+    int fd = open(file.c_str(), O_CREAT | O_WRONLY, 0600);
+    CHECK(write(fd, "keep", 4) == 4);
+    close(fd);
+    nodeOptions opts;
+    opts.unixpath = file;
+    CHECK(constructInChild(0, unixdgram, opts) != 0);
+    struct stat st;
+    CHECK(stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size == 4);
+
+    // A socket file left by a closed socket is replaced.
+    int s = socket(AF_UNIX, SOCK_DGRAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, stale.c_str());
+    CHECK(bind(s, (struct sockaddr *)&addr, sizeof addr) == 0);
+    close(s);
+    opts.unixpath = stale;
+    CHECK(constructInChild(0, unixdgram, opts) == 0);
+
+    // A live node keeps its path, and keeps receiving on it.
+    opts.unixpath = live;
+    {
+        UDPNode owner(0, unixdgram, 1024, 100, false, opts);
+        owner.startRxLoop();
+        CHECK(constructInChild(0, unixdgram, opts) != 0);
+        UDPNode sender(47422, ipv4, 1024, 100, false);
+        CHECK(sender.tx(0, unixdgram, live, "still mine") == SUCCESS);
+        CHECK(waitFor([&]{ return owner.rxDataAvailable(); }));
+        CHECK(owner.readRxDatagramFromQueue().msg == "still mine");
+        owner.endRxLoop();
+    }
+
+    unlink(file.c_str());
+    unlink(stale.c_str());
+    CHECK(rmdir(dir.c_str()) == 0);
+}
+
+// A node hands its listening sockets and queue over to its successor, and only to it.
+static void testHandoff(void){
+    char dirtemplate[] = "/tmp/udpnode-test-XXXXXX";
+    std::string dir = mkdtemp(dirtemplate);
+    std::string path = dir + "/handoff.sock", file = dir + "/file";
+    nodeOptions sopts;
+    sopts.txfromlistensocket = true;
+    UDPNode sender(47431, ipv4, 1024, 100, false, sopts);
+    sender.startRxLoop();
+    UDPNode *old = new UDPNode(47430, ipv4, 1024, 100, false);
+    old->startRxLoop();
+    for(int i = 0; i < 3; i++){
+        sender.tx(47430, ipv4, "127.0.0.1", "old-" + std::to_string(i));
+    }
+    CHECK(waitFor([&]{ return old->rxDataQueueSize() == 3; }));
+
+    // A regular file at the path is left alone.
+    int fd = open(file.c_str(), O_CREAT | O_WRONLY, 0600);
+    close(fd);
+    CHECK(old->handoff(file, 100) == HANDOFF_FAILED);
+    CHECK(exists(file));
+
+    err_code rv = SUCCESS;
+    std::thread t([&]{ rv = old->handoff(path, 3000); });
+    CHECK(waitFor([&]{ return exists(path); }));
+
+    // A second handoff on the path is refused, and its probe is not taken for the successor.
+    UDPNode other(47432, ipv4, 1024, 100, false);
+    CHECK(other.handoff(path, 100) == HANDOFF_FAILED);
+    CHECK(exists(path));
+
+    nodeOptions opts;
+    opts.handoffpath = path;
+    UDPNode successor(47430, ipv4, 1024, 100, false, opts);
+    t.join();
+    CHECK(rv == SUCCESS);
+    CHECK(!exists(path));
+    delete old;
+
+    // The successor holds the queue and the port, and replies from the adopted socket.
+    successor.startRxLoop();
+    sender.tx(47430, ipv4, "127.0.0.1", "new");
+    CHECK(waitFor([&]{ return successor.rxDataQueueSize() == 4; }));
+    rxDatagram first = successor.readRxDatagramFromQueue();
+    CHECK(first.msg == "old-0");
+    CHECK(successor.readRxDatagramFromQueue().msg == "old-1");
+    CHECK(successor.readRxDatagramFromQueue().msg == "old-2");
+    CHECK(successor.readRxDatagramFromQueue().msg == "new");
+    CHECK(successor.reply(first, "pong") == SUCCESS);
+    CHECK(waitFor([&]{ return sender.rxDataAvailable(); }));
+    rxDatagram r = sender.readRxDatagramFromQueue();
+    CHECK(r.msg == "pong" && r.srcport == 47430);
+    CHECK(first.srcport == 47431);
+
+    successor.endRxLoop();
+    sender.endRxLoop();
+    unlink(file.c_str());
+    CHECK(rmdir(dir.c_str()) == 0);
+}
+
+// Reads the two datagrams a node received over IPv4 and IPv6, IPv4 first.
+static void readBothFamilies(UDPNode &node, rxDatagram &v4, rxDatagram &v6){
+    CHECK(waitFor([&]{ return node.rxDataQueueSize() == 2; }));
+    v4 = node.readRxDatagramFromQueue();
+    v6 = node.readRxDatagramFromQueue();
+    if(v4.msg != "v4"){
+        std::swap(v4, v6);
+    }
+    unsigned int lo = if_nametoindex("lo");
+    CHECK(v4.msg == "v4" && v4.dstipaddr == "127.0.0.1" && v4.ifindex == lo);
+    CHECK(v4.dstaddr.ss_family == AF_INET && ((struct sockaddr_in *)&v4.dstaddr)->sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+    CHECK(v6.msg == "v6" && v6.dstipaddr == "::1" && v6.ifindex == lo);
+    CHECK(v6.dstaddr.ss_family == AF_INET6 && IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6 *)&v6.dstaddr)->sin6_addr));
+}
+
+// Dual-stack sockets and wildcard bind addresses take both families, with the local address PKTINFO reports.
+static void testDualStack(void){
+    UDPNode sender(47520, ipv4, 1024, 10, false);
+    rxDatagram v4, v6;
+
+    // A dual-stack IPv6 node sees IPv4 peers as mapped addresses.
+    nodeOptions dual;
+    dual.dualstack = true;
+    {
+        UDPNode node(47521, ipv6, 1024, 10, false, dual);
+        node.startRxLoop();
+        CHECK(sender.tx(47521, ipv4, "127.0.0.1", "v4") == SUCCESS);
+        CHECK(sender.tx(47521, ipv6, "::1", "v6") == SUCCESS);
+        readBothFamilies(node, v4, v6);
+        CHECK(v4.srcipaddr == "::ffff:127.0.0.1");
+        node.endRxLoop();
+    }
+
+    // A wildcard bind address is one IPv6-only socket per family without dualstack, one dual-stack socket with it.
+    for(bool dualstack : {false, true}){
+        nodeOptions opts;
+        opts.dualstack = dualstack;
+        opts.bindaddrs = {{"", 47523}};
+        UDPNode node(47522, ipv4, 1024, 10, false, opts);
+        node.startRxLoop();
+        CHECK(sender.tx(47523, ipv4, "127.0.0.1", "v4") == SUCCESS);
+        CHECK(sender.tx(47523, ipv6, "::1", "v6") == SUCCESS);
+        readBothFamilies(node, v4, v6);
+        CHECK(v4.srcipaddr == (dualstack ? "::ffff:127.0.0.1" : "127.0.0.1"));
+        node.endRxLoop();
+    }
+
+    // Without dualstack an IPv6 socket takes no IPv4, whatever the system default.
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(47524);
+    CHECK(bind(fd, (struct sockaddr *)&addr, sizeof addr) == 0);
+    CHECK(constructInChild(47524, ipv6, nodeOptions()) == 0);
+
+    // One family of a wildcard failing to bind fails the node, even though the other was bound.
+    nodeOptions taken;
+    taken.bindaddrs = {{"", 47524}};
+    CHECK(constructInChild(47525, ipv4, taken) != 0);
+    close(fd);
+}
+
+// Threads sending through one node at once each use their own send socket.
+static void testConcurrentTx(void){
+    UDPNode receiver(47501, ipv4, 1024, 1000, false);
+    receiver.startRxLoop();
+    UDPNode sender(47502, ipv4, 1024, 10, false);
+    std::atomic<int> failed(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++){
+        threads.emplace_back([&]{
+            for(int i = 0; i < 50; i++){
+                if(sender.tx(47501, ipv4, "127.0.0.1", "x") != SUCCESS){
+                    failed++;
+                }
+            }
+        });
+    }
+    for(auto &t : threads){
+        t.join();
+    }
+    CHECK(failed == 0);
+    CHECK(waitFor([&]{ return receiver.rxDataQueueSize() == 200; }));
+
+    // Only a running receive thread has CPU time to report.
+    CHECK(receiver.getRxStats().rxcpuns > 0);
+    CHECK(sender.getRxStats().rxcpuns == 0);
+    receiver.endRxLoop();
+}
+
+// Queues and raw buffers allocated on a thread pinned to rxcpus are used as usual.
+static void testPinnedQueues(void){
+    nodeOptions opts;
+    opts.rxcpus = {0};
+    opts.rxqueuemode = RXQ_PRIORITY;
+    opts.parseworkers = 2;
+    UDPNode receiver(47530, ipv4, 1024, 100, false, opts);
+    receiver.startRxLoop();
+    UDPNode sender(47531, ipv4, 1024, 10, false);
+    for(int i = 0; i < 20; i++){
+        sender.tx(47530, ipv4, "127.0.0.1", "x");
+    }
+    CHECK(waitFor([&]{ return receiver.rxDataQueueSize() == 20; }));
+    CHECK(receiver.readRxDatagramFromQueue().msg == "x");
+    receiver.endRxLoop();
+}
+
+int main(void){
+    testMalformed();
+    testMalformedTransport();
+    testConcurrentTx();
+    testPinnedQueues();
+    testDualStack();
+    testRateLimitTableFull();
+    testFairQueueFlood();
+    testPriorityLanes();
+    testGroupUnix();
+    testUnixPathClaim();
+    testHandoff();
+    testShm();
+    testLoopback();
+    return checkResult("udpnode");
+}